@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+#include "LightGeometry.h"
+
+/*
+  Turns the edges handed to AddShadowCaster into the edge list the lights actually use
+
+  Per caster:
+    - Edges that chain into closed loops are wound clockwise on screen (y down), so every loop edge's outward normal is
+      (dy, -dx). Anything that doesn't close is left two-sided.
+
+  Over all casters:
+    - A loop edge that meets the same edge running the other way (two boxes sharing a side) is inside a wall, so both go
+    - Runs of collinear edges joined end to end (a row of wall tiles) are merged into one edge
+    - The result is sorted by position, so an edge's place in the list doesn't depend on the order casters were added in
+
+  Per light, a loop edge only casts a shadow if the light is on its outward side (see FacesLight). Seen from outside a
+  loop, the edges facing away are always behind one that faces the light, so skipping them doesn't change the shadow.
+  A light inside a loop (a room drawn as one closed caster) is the exception: there every edge of it faces away and
+  still has to cast, so Finish also numbers the loops, and LSystem keeps the edges of the ones the light is inside.
+*/
+class CasterEdgeBuilder
+{
+public:
+  void Begin() {
+    Work.clear();
+  }
+
+  void AddCaster(const std::vector<Edge> &edges) {
+    const std::size_t first = Work.size();
+    for (auto & edge : edges) {
+      if (Key(edge.Start) != Key(edge.End))
+        Work.push_back({ edge.Start, edge.End, true, false });
+    }
+    CloseLoops(first, Work.size());
+  }
+
+  //Edges that are already wound like closed loops (outward normal (dy, -dx)) without forming loops on their own, e.g. a
+  //piece of a tile layer's outline. They're one-sided as given, and merged and deduplicated with everything else
+  void AddOutline(const std::vector<Edge> &edges) {
+    for (auto & edge : edges) {
+      if (Key(edge.Start) != Key(edge.End))
+        Work.push_back({ edge.Start, edge.End, false, false });
+    }
+  }
+
+  static constexpr std::uint32_t NoLoop = 0xFFFFFFFFu;
+
+  /*
+    twoSided[i] is 1 for edges that shadow from both sides (open chains), 0 for loop edges.
+    loops[i] numbers the loop edge i is on, counting from 0, NoLoop for two-sided edges. Loops that touch at a corner
+    share a number, which only matters to EnclosesLight as the union of the two.
+  */
+  void Finish(EdgeSoA &out, std::vector<std::uint8_t> &twoSided, std::vector<std::uint32_t> &loops) {
+    RemoveSharedEdges();
+    MergeCollinear();
+
+    Order.clear();
+    for (std::uint32_t i = 0; i < Work.size(); ++i) {
+      if (!Work[i].Removed)
+        Order.push_back(i);
+    }
+    std::sort(Order.begin(), Order.end(), [this](std::uint32_t a, std::uint32_t b) {
+      return Less(Work[a], Work[b]);
+    });
+
+    out.Clear();
+    out.Reserve(Order.size());
+    twoSided.clear();
+    for (auto i : Order) {
+      out.Push(Work[i].Start, Work[i].End);
+      twoSided.push_back(Work[i].TwoSided ? 1 : 0);
+    }
+    NumberLoops(out, twoSided, loops);
+  }
+
+  //The light is on the outward side of start -> end
+  static bool FacesLight(const sf::Vector2f &start, const sf::Vector2f &end, const sf::Vector2f &light) {
+    return (end.y - start.y) * (light.x - start.x) - (end.x - start.x) * (light.y - start.y) > 0.f;
+  }
+
+  //A loop edge as LSystem gathers it for one light
+  struct LoopEdge
+  {
+    std::uint64_t Loop;
+    sf::Vector2f Start;
+    sf::Vector2f End;
+    bool Faces; //FacesLight
+    std::uint32_t Order; //Position in the gather, so sorting by loop keeps each loop's edges in the order they came in
+  };
+
+  /*
+    Whether light is inside the loop edges belong to, given every edge of it within radius of the light. One edge
+    facing away is picked, and the segment from the light to a point on it is walked: each edge it crosses on the way
+    either enters the loop (faces the light) or leaves it. The point is just inside the loop, so the light is too unless
+    the segment went in more often than it came out. Crossings past radius aren't counted, and the ones before it
+    always start with an exit from inside and an entry from outside, so a crossing that's missing can only keep edges
+    that weren't needed, never drop one that was.
+  */
+  static bool EnclosesLight(const LoopEdge *edges, std::size_t count, const sf::Vector2f &light, float radius) {
+    const LoopEdge *away = std::find_if(edges, edges + count, [](const LoopEdge &e) { return !e.Faces; });
+    if (away == edges + count)
+      return false;
+
+    //Away from the edge's corners, where the segment would run through the neighbouring edges' endpoints
+    const sf::Vector2f along = away->End - away->Start;
+    const sf::Vector2f toLight = light - away->Start;
+    const float t = std::min(std::max((toLight.x * along.x + toLight.y * along.y) / (along.x * along.x + along.y * along.y), 0.25f), 0.75f);
+    const sf::Vector2f d = away->Start + along * t - light;
+    const float reach = radius / std::sqrt(d.x * d.x + d.y * d.y);
+
+    int entries = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      const LoopEdge &e = edges[i];
+      if (&e == away)
+        continue;
+
+      const sf::Vector2f a = e.Start - light;
+      const sf::Vector2f b = e.End - light;
+      if ((d.x * a.y - d.y * a.x > 0.f) == (d.x * b.y - d.y * b.x > 0.f))
+        continue;
+
+      const sf::Vector2f ab = b - a;
+      const float s = (a.x * ab.y - a.y * ab.x) / (d.x * ab.y - d.y * ab.x);
+      if (s >= 0.f && s < 1.f && s <= reach)
+        entries += e.Faces ? 1 : -1;
+    }
+    return entries <= 0;
+  }
+
+  //Same order Finish sorts into, so two finished lists can be diffed with a single merge walk
+  static bool Less(const sf::Vector2f &startA, const sf::Vector2f &endA, bool twoSidedA,
+                   const sf::Vector2f &startB, const sf::Vector2f &endB, bool twoSidedB) {
+    return std::tie(startA.y, startA.x, endA.y, endA.x, twoSidedA) < std::tie(startB.y, startB.x, endB.y, endB.x, twoSidedB);
+  }
+
+private:
+  struct WorkEdge
+  {
+    sf::Vector2f Start;
+    sf::Vector2f End;
+    bool TwoSided = true;
+    bool Removed = false;
+  };
+
+  //(vertex key, edge index), sorted so every edge touching a vertex can be found with a binary search
+  using VertexEntry = std::pair<std::uint64_t, std::uint32_t>;
+
+  //Endpoints are matched after snapping to 1/256 of a pixel, so tiles computed as i * size line up even with a bit of float noise
+  static constexpr float Snap = 256.f;
+
+  static std::uint64_t Key(const sf::Vector2f &p) {
+    const std::uint32_t x = static_cast<std::uint32_t>(static_cast<std::int32_t>(std::lround(p.x * Snap)));
+    const std::uint32_t y = static_cast<std::uint32_t>(static_cast<std::int32_t>(std::lround(p.y * Snap)));
+    return (static_cast<std::uint64_t>(y) << 32) | x;
+  }
+
+  static bool Less(const WorkEdge &a, const WorkEdge &b) {
+    return Less(a.Start, a.End, a.TwoSided, b.Start, b.End, b.TwoSided);
+  }
+
+  static std::pair<std::vector<VertexEntry>::const_iterator, std::vector<VertexEntry>::const_iterator>
+  At(const std::vector<VertexEntry> &entries, std::uint64_t key) {
+    return std::equal_range(entries.begin(), entries.end(), VertexEntry{ key, 0 },
+                            [](const VertexEntry &a, const VertexEntry &b) { return a.first < b.first; });
+  }
+
+  void CloseLoops(std::size_t first, std::size_t last) {
+    Starts.clear();
+    for (std::size_t i = first; i < last; ++i)
+      Starts.push_back({ Key(Work[i].Start), static_cast<std::uint32_t>(i) });
+    std::sort(Starts.begin(), Starts.end());
+
+    Visited.assign(last - first, 0);
+    for (std::size_t head = first; head < last; ++head) {
+      if (Visited[head - first])
+        continue;
+
+      //Follow end -> start until we either get back to the head or run out of edges
+      Loop.clear();
+      std::size_t current = head;
+      bool closed = false;
+      for (;;) {
+        Visited[current - first] = 1;
+        Loop.push_back(static_cast<std::uint32_t>(current));
+
+        const std::uint64_t end = Key(Work[current].End);
+        if (end == Key(Work[head].Start)) {
+          closed = true;
+          break;
+        }
+
+        auto range = At(Starts, end);
+        auto next = std::find_if(range.first, range.second, [&](const VertexEntry &e) { return !Visited[e.second - first]; });
+        if (next == range.second)
+          break;
+        current = next->second;
+      }
+
+      if (!closed)
+        continue;
+
+      //Shoelace sum, positive when the loop runs clockwise on screen
+      float area = 0.f;
+      for (auto i : Loop)
+        area += Work[i].Start.x * Work[i].End.y - Work[i].End.x * Work[i].Start.y;
+
+      for (auto i : Loop) {
+        Work[i].TwoSided = false;
+        if (area < 0.f)
+          std::swap(Work[i].Start, Work[i].End);
+      }
+    }
+  }
+
+  //Loop edges that share an endpoint get the same number, via union-find over the sorted endpoints
+  void NumberLoops(const EdgeSoA &edges, const std::vector<std::uint8_t> &twoSided, std::vector<std::uint32_t> &loops) {
+    Starts.clear();
+    for (std::uint32_t i = 0; i < edges.Size(); ++i) {
+      if (twoSided[i])
+        continue;
+      Starts.push_back({ Key(edges.Start(i)), i });
+      Starts.push_back({ Key(edges.End(i)), i });
+    }
+    std::sort(Starts.begin(), Starts.end());
+
+    Next.resize(edges.Size());
+    for (std::uint32_t i = 0; i < edges.Size(); ++i)
+      Next[i] = i;
+    for (std::size_t i = 1; i < Starts.size(); ++i) {
+      if (Starts[i].first == Starts[i - 1].first)
+        Next[Root(Starts[i].second)] = Root(Starts[i - 1].second);
+    }
+
+    //Numbered in edge order, so the numbers don't depend on the order casters were added in either
+    loops.assign(edges.Size(), NoLoop);
+    Order.assign(edges.Size(), NoLoop);
+    std::uint32_t count = 0;
+    for (std::uint32_t i = 0; i < edges.Size(); ++i) {
+      if (twoSided[i])
+        continue;
+      std::uint32_t &number = Order[Root(i)];
+      if (number == NoLoop)
+        number = count++;
+      loops[i] = number;
+    }
+  }
+
+  std::uint32_t Root(std::uint32_t i) {
+    while (Next[i] != i)
+      i = Next[i] = Next[Next[i]];
+    return i;
+  }
+
+  void RemoveSharedEdges() {
+    Pairs.clear();
+    for (std::uint32_t i = 0; i < Work.size(); ++i)
+      Pairs.push_back({ Key(Work[i].Start), Key(Work[i].End), i });
+    std::sort(Pairs.begin(), Pairs.end());
+
+    for (auto & edge : Work) {
+      if (edge.Removed)
+        continue;
+
+      const std::uint64_t s = Key(edge.Start);
+      const std::uint64_t e = Key(edge.End);
+      auto range = std::equal_range(Pairs.begin(), Pairs.end(), EdgeKey{ e, s, 0 }, SameEnds);
+      for (auto it = range.first; it != range.second; ++it) {
+        WorkEdge &other = Work[it->Index];
+        if (other.Removed || &other == &edge || other.TwoSided != edge.TwoSided)
+          continue;
+
+        //Two loop edges running opposite ways are the inside of a wall, two open edges on top of each other are just a duplicate
+        other.Removed = true;
+        edge.Removed = !edge.TwoSided;
+        break;
+      }
+
+      if (edge.Removed)
+        continue;
+
+      //The same edge given twice
+      range = std::equal_range(Pairs.begin(), Pairs.end(), EdgeKey{ s, e, 0 }, SameEnds);
+      for (auto it = range.first; it != range.second; ++it) {
+        WorkEdge &other = Work[it->Index];
+        if (!other.Removed && &other != &edge && other.TwoSided == edge.TwoSided)
+          other.Removed = true;
+      }
+    }
+  }
+
+  void MergeCollinear() {
+    Starts.clear();
+    Ends.clear();
+    for (std::uint32_t i = 0; i < Work.size(); ++i) {
+      if (Work[i].Removed)
+        continue;
+      Starts.push_back({ Key(Work[i].Start), i });
+      Ends.push_back({ Key(Work[i].End), i });
+    }
+    std::sort(Starts.begin(), Starts.end());
+    std::sort(Ends.begin(), Ends.end());
+
+    //Next[i] is the edge that carries straight on from edge i, if there's exactly one way to go
+    Next.assign(Work.size(), NoEdge);
+    Visited.assign(Work.size(), 0);
+    for (auto & entry : Ends) {
+      const std::uint32_t i = entry.second;
+      auto out = At(Starts, entry.first);
+      auto in = At(Ends, entry.first);
+      if (out.second - out.first != 1 || in.second - in.first != 1)
+        continue;
+
+      const std::uint32_t j = out.first->second;
+      if (j != i && Work[j].TwoSided == Work[i].TwoSided && Collinear(Work[i], Work[j])) {
+        Next[i] = j;
+        Visited[j] = 1; //Has a predecessor, so it isn't the head of a run
+      }
+    }
+
+    for (std::uint32_t head = 0; head < Work.size(); ++head) {
+      if (Work[head].Removed || Visited[head] || Next[head] == NoEdge)
+        continue;
+
+      for (std::uint32_t j = Next[head]; j != NoEdge && j != head; j = Next[j]) {
+        Work[head].End = Work[j].End;
+        Work[j].Removed = true;
+      }
+    }
+  }
+
+  static bool Collinear(const WorkEdge &a, const WorkEdge &b) {
+    const sf::Vector2f da = a.End - a.Start;
+    const sf::Vector2f db = b.End - b.Start;
+    const float cross = da.x * db.y - da.y * db.x;
+    const float dot = da.x * db.x + da.y * db.y;
+    return dot > 0.f && std::abs(cross) <= 1e-5f * std::sqrt((da.x * da.x + da.y * da.y) * (db.x * db.x + db.y * db.y));
+  }
+
+  struct EdgeKey
+  {
+    std::uint64_t Start;
+    std::uint64_t End;
+    std::uint32_t Index;
+
+    friend bool operator<(const EdgeKey &a, const EdgeKey &b) {
+      return std::tie(a.Start, a.End, a.Index) < std::tie(b.Start, b.End, b.Index);
+    }
+  };
+
+  static bool SameEnds(const EdgeKey &a, const EdgeKey &b) {
+    return std::tie(a.Start, a.End) < std::tie(b.Start, b.End);
+  }
+
+  static constexpr std::uint32_t NoEdge = 0xFFFFFFFFu;
+
+  std::vector<WorkEdge> Work;
+  std::vector<VertexEntry> Starts;
+  std::vector<VertexEntry> Ends;
+  std::vector<EdgeKey> Pairs;
+  std::vector<std::uint32_t> Loop;
+  std::vector<std::uint32_t> Next;
+  std::vector<std::uint32_t> Order;
+  std::vector<std::uint8_t> Visited;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "LightGeometry.h"
+
+//How many edges the per-light radius test let through, summed over every light in an update
+struct CasterCullStats
+{
+  std::size_t Lights = 0;
+  std::size_t TotalEdges = 0;      //Edges every light would have walked without the grid
+  std::size_t CandidateEdges = 0;  //Edges the grid found within the light's radius
+  std::size_t CulledEdges = 0;     //TotalEdges - CandidateEdges
+  std::size_t BackFacingEdges = 0; //Candidates skipped because they face away from the light
+};
+
+/*
+  The query side of an EdgeGrid, over CSR arrays it doesn't own. EdgeGrid hands one out over its own vectors, and a
+  mapped scene file (see SceneFile.h) points one straight at the arrays in the file, so a baked grid is queried in place.
+*/
+struct EdgeGridView
+{
+  const std::uint32_t *CellStart = nullptr; //Columns * Rows + 1 entries
+  const std::uint32_t *CellEdges = nullptr; //CellStart[Columns * Rows] entries
+  int Columns = 0;
+  int Rows = 0;
+  sf::Vector2f Min;
+  float CellSize = 64.f;
+
+  /*
+    Every edge that comes within radius of center, in ascending index order so the output doesn't depend on the grid layout.
+    Returns how many edges came out of the cells before the exact segment/circle test.
+  */
+  std::size_t Query(const EdgeSoAView &edges, const sf::Vector2f &center, float radius, std::vector<std::uint32_t> &out) const {
+    out.clear();
+    if (Columns == 0)
+      return 0;
+
+    const int x0 = std::max(ToCell(center.x - radius, Min.x), 0);
+    const int y0 = std::max(ToCell(center.y - radius, Min.y), 0);
+    const int x1 = std::min(ToCell(center.x + radius, Min.x), Columns - 1);
+    const int y1 = std::min(ToCell(center.y + radius, Min.y), Rows - 1);
+
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        const int c = y * Columns + x;
+        out.insert(out.end(), CellEdges + CellStart[c], CellEdges + CellStart[c + 1]);
+      }
+    }
+
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    const std::size_t gathered = out.size();
+
+    const float r2 = radius * radius;
+    out.erase(std::remove_if(out.begin(), out.end(),
+                             [&](std::uint32_t i) { return DistanceSquared(edges.Start(i), edges.End(i), center) > r2; }),
+              out.end());
+    return gathered;
+  }
+
+  std::size_t GetCellEdgeCount() const {
+    return Columns == 0 ? 0 : CellStart[static_cast<std::size_t>(Columns) * Rows];
+  }
+
+  int ToCell(float v, float origin) const {
+    return static_cast<int>(std::floor((v - origin) / CellSize));
+  }
+
+  static float DistanceSquared(const sf::Vector2f &start, const sf::Vector2f &end, const sf::Vector2f &p) {
+    const sf::Vector2f d = end - start;
+    const sf::Vector2f w = p - start;
+    const float len2 = d.x * d.x + d.y * d.y;
+    float t = len2 > 0.f ? (w.x * d.x + w.y * d.y) / len2 : 0.f;
+    t = std::min(std::max(t, 0.f), 1.f);
+    const sf::Vector2f c = start + d * t - p;
+    return c.x * c.x + c.y * c.y;
+  }
+};
+
+/*
+  Uniform grid over a flat list of caster edges
+
+  Cells are stored flat (CSR style): CellStart[c] .. CellStart[c + 1] indexes into CellEdges, which holds edge indices.
+  An edge goes into every cell its bounding box touches, so an edge can show up in a query more than once before it is de-duplicated.
+*/
+class EdgeGrid
+{
+public:
+  void SetCellSize(float size) {
+    CellSize = std::max(size, 1.f);
+  }
+
+  float GetCellSize() const {
+    return CellSize;
+  }
+
+  void Build(const EdgeSoA &edges) {
+    CellStart.clear();
+    CellEdges.clear();
+    Columns = Rows = 0;
+    EdgeCount = edges.Size();
+    if (edges.Empty())
+      return;
+
+    Min = Max = edges.Start(0);
+    for (std::size_t i = 0; i < edges.Size(); ++i) {
+      Grow(edges.Start(i));
+      Grow(edges.End(i));
+    }
+
+    //Don't let a huge, sparse world blow up the cell array
+    float cell = CellSize;
+    while (CellsFor(cell) > MaxCells)
+      cell *= 2.f;
+    BuiltCellSize = cell;
+
+    Columns = static_cast<int>((Max.x - Min.x) / cell) + 1;
+    Rows = static_cast<int>((Max.y - Min.y) / cell) + 1;
+    CellStart.assign(static_cast<std::size_t>(Columns) * Rows + 1, 0);
+
+    //Count, prefix sum, then fill
+    for (std::size_t i = 0; i < edges.Size(); ++i) {
+      int x0, y0, x1, y1;
+      CellRange(edges.Start(i), edges.End(i), x0, y0, x1, y1);
+      for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x)
+          CellStart[y * Columns + x + 1]++;
+    }
+
+    for (std::size_t c = 1; c < CellStart.size(); ++c)
+      CellStart[c] += CellStart[c - 1];
+
+    CellEdges.resize(CellStart.back());
+    std::vector<std::uint32_t> fill(CellStart.begin(), CellStart.end() - 1);
+    for (std::uint32_t i = 0; i < edges.Size(); ++i) {
+      int x0, y0, x1, y1;
+      CellRange(edges.Start(i), edges.End(i), x0, y0, x1, y1);
+      for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x)
+          CellEdges[fill[y * Columns + x]++] = i;
+    }
+  }
+
+  //See EdgeGridView::Query
+  std::size_t Query(const EdgeSoA &edges, const sf::Vector2f &center, float radius, std::vector<std::uint32_t> &out) const {
+    return GetView().Query(edges.View(), center, radius, out);
+  }
+
+  //Only valid until the next Build
+  EdgeGridView GetView() const {
+    EdgeGridView view;
+    view.CellStart = CellStart.data();
+    view.CellEdges = CellEdges.data();
+    view.Columns = Columns;
+    view.Rows = Rows;
+    view.Min = Min;
+    view.CellSize = BuiltCellSize;
+    return view;
+  }
+
+  std::size_t GetEdgeCount() const {
+    return EdgeCount;
+  }
+
+private:
+  static constexpr std::size_t MaxCells = 1 << 22;
+
+  void Grow(const sf::Vector2f &p) {
+    Min.x = std::min(Min.x, p.x); Min.y = std::min(Min.y, p.y);
+    Max.x = std::max(Max.x, p.x); Max.y = std::max(Max.y, p.y);
+  }
+
+  std::size_t CellsFor(float cell) const {
+    return (static_cast<std::size_t>((Max.x - Min.x) / cell) + 1) * (static_cast<std::size_t>((Max.y - Min.y) / cell) + 1);
+  }
+
+  int ToCell(float v, float origin) const {
+    return static_cast<int>(std::floor((v - origin) / BuiltCellSize));
+  }
+
+  void CellRange(const sf::Vector2f &start, const sf::Vector2f &end, int &x0, int &y0, int &x1, int &y1) const {
+    x0 = std::min(std::max(ToCell(std::min(start.x, end.x), Min.x), 0), Columns - 1);
+    y0 = std::min(std::max(ToCell(std::min(start.y, end.y), Min.y), 0), Rows - 1);
+    x1 = std::min(std::max(ToCell(std::max(start.x, end.x), Min.x), 0), Columns - 1);
+    y1 = std::min(std::max(ToCell(std::max(start.y, end.y), Min.y), 0), Rows - 1);
+  }
+
+  float CellSize = 64.f;
+  float BuiltCellSize = 64.f;
+  int Columns = 0;
+  int Rows = 0;
+  std::size_t EdgeCount = 0;
+  sf::Vector2f Min;
+  sf::Vector2f Max;
+
+  std::vector<std::uint32_t> CellStart;
+  std::vector<std::uint32_t> CellEdges;
+};
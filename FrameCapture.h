@@ -0,0 +1,295 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "SoftwareLightRenderer.h"
+
+//Counters since capture was enabled
+struct CaptureStats
+{
+  std::size_t Queued = 0;  //Readbacks started
+  std::size_t Written = 0; //Images that made it to disk
+  std::size_t Dropped = 0; //Requests that found every slot busy
+  std::size_t Failed = 0;  //Images the encoder couldn't save
+};
+
+/*
+  Writes render targets out as PNGs without stalling the frame
+
+  There is a fixed ring of slots. Reading back a render texture only queues a glReadPixels into the slot's pixel buffer
+  object and drops a fence behind it, so nothing waits on the GPU. Poll (once a frame) picks up the slots whose fence
+  has passed, copies the pixels out and hands them to a background thread that flips and encodes them. CPU images
+  (the software renderer) skip the GPU part and go straight to the encoder.
+
+  If every slot is still busy the request is dropped rather than waited on, so a burst of captures can't hitch the game.
+  GL calls (ReadBack, Poll, Flush) have to happen on the thread that owns the context.
+*/
+class FrameCapture
+{
+public:
+  explicit FrameCapture(const std::string &prefix, unsigned ringSize = 4)
+    : Prefix(prefix)
+    , Slots(std::max(ringSize, 1u))
+  {
+    Encoder = std::thread(&FrameCapture::EncodeLoop, this);
+  }
+
+  FrameCapture(const FrameCapture &) = delete;
+  FrameCapture& operator=(const FrameCapture &) = delete;
+
+  ~FrameCapture() {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Quit = true;
+    }
+    Wake.notify_all();
+    Encoder.join();
+
+    for (auto & slot : Slots) {
+      if (slot.Fence)
+        glDeleteSync(slot.Fence);
+      if (slot.Buffer)
+        glDeleteBuffers(1, &slot.Buffer);
+    }
+  }
+
+  //Frame triggers: everything rendered after the frame-th UpdateLights gets written out
+  void RequestFrame(std::uint64_t frame) {
+    Frames.push_back(frame);
+  }
+
+  bool IsFrameRequested(std::uint64_t frame) const {
+    return std::find(Frames.begin(), Frames.end(), frame) != Frames.end();
+  }
+
+  //Called once the frame has been rendered, so every target drawn that frame gets its turn
+  void EndFrame(std::uint64_t frame) {
+    Frames.erase(std::remove(Frames.begin(), Frames.end(), frame), Frames.end());
+  }
+
+  //Light triggers: keyed by whatever the caller uses to name a light, taken (and cleared) the next time that light is drawn
+  void RequestLight(std::uint64_t key) {
+    if (std::find(Lights.begin(), Lights.end(), key) == Lights.end())
+      Lights.push_back(key);
+  }
+
+  bool TakeLight(std::uint64_t key) {
+    auto it = std::find(Lights.begin(), Lights.end(), key);
+    if (it == Lights.end())
+      return false;
+    Lights.erase(it);
+    return true;
+  }
+
+  bool HasLightRequests() const {
+    return !Lights.empty();
+  }
+
+  //Start an asynchronous readback of target. It has to have been drawn to (display() isn't needed)
+  bool ReadBack(sf::RenderTexture &target, const std::string &name) {
+    const sf::Vector2u size = target.getSize();
+    Slot *slot = Acquire();
+    if (!slot || size.x == 0 || size.y == 0 || !target.setActive(true))
+      return Release(slot);
+
+    const GLsizeiptr bytes = static_cast<GLsizeiptr>(size.x) * size.y * 4;
+    if (!slot->Buffer)
+      glGenBuffers(1, &slot->Buffer);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->Buffer);
+    if (slot->BufferBytes != bytes) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+      slot->BufferBytes = bytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, static_cast<GLsizei>(size.x), static_cast<GLsizei>(size.y), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->Width = size.x;
+    slot->Height = size.y;
+    slot->FlipRows = true; //GL rows start at the bottom
+    slot->Path = Prefix + name;
+    Reading.push_back(slot);
+    Count(Stats.Queued);
+    return true;
+  }
+
+  //The software renderer's output is already on the CPU, so it only needs converting and encoding
+  bool Capture(const SoftwareLightTarget &target, const std::string &name) {
+    Slot *slot = Acquire();
+    if (!slot || target.Width == 0 || target.Height == 0)
+      return Release(slot);
+
+    target.ToRGBA8(slot->Pixels);
+    slot->Width = target.Width;
+    slot->Height = target.Height;
+    slot->FlipRows = false;
+    slot->Path = Prefix + name;
+    Count(Stats.Queued);
+    Submit(slot);
+    return true;
+  }
+
+  //Hand every finished readback to the encoder. Never waits on the GPU
+  void Poll() {
+    while (!Reading.empty() && Finish(Reading.front(), 0))
+      Reading.pop_front();
+  }
+
+  //Wait for every readback and every encode to finish, e.g. before shutting down
+  void Flush() {
+    while (!Reading.empty()) {
+      Finish(Reading.front(), 1000000000ull);
+      Reading.pop_front();
+    }
+
+    std::unique_lock<std::mutex> lock(Mutex);
+    Idle.wait(lock, [this]() { return Encoding.empty() && !Busy; });
+  }
+
+  CaptureStats GetStats() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Stats;
+  }
+
+private:
+  enum class SlotState
+  {
+    Free,
+    Reading,  //glReadPixels queued, waiting on the fence
+    Encoding  //Pixels are on the CPU, owned by the encoder thread
+  };
+
+  struct Slot
+  {
+    SlotState State = SlotState::Free;
+    GLuint Buffer = 0;
+    GLsizeiptr BufferBytes = 0;
+    GLsync Fence = nullptr;
+    unsigned Width = 0;
+    unsigned Height = 0;
+    bool FlipRows = false;
+    std::string Path;
+    std::vector<std::uint8_t> Pixels;
+  };
+
+  Slot* Acquire() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    for (auto & slot : Slots) {
+      if (slot.State == SlotState::Free) {
+        slot.State = SlotState::Reading;
+        return &slot;
+      }
+    }
+    Stats.Dropped++;
+    return nullptr;
+  }
+
+  void Count(std::size_t &counter) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    counter++;
+  }
+
+  bool Release(Slot *slot) {
+    if (slot) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      slot->State = SlotState::Free;
+    }
+    return false;
+  }
+
+  //Copies the pixels out of the slot's buffer if the GPU is done with it (or once timeout runs out)
+  bool Finish(Slot *slot, GLuint64 timeout) {
+    const GLenum status = glClientWaitSync(slot->Fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    if (status == GL_TIMEOUT_EXPIRED && timeout == 0)
+      return false;
+
+    glDeleteSync(slot->Fence);
+    slot->Fence = nullptr;
+
+    bool copied = false;
+    if (status != GL_WAIT_FAILED && status != GL_TIMEOUT_EXPIRED) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->Buffer);
+      if (const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot->BufferBytes, GL_MAP_READ_BIT)) {
+        const std::uint8_t *bytes = static_cast<const std::uint8_t*>(mapped);
+        slot->Pixels.assign(bytes, bytes + slot->BufferBytes);
+        copied = glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE;
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    if (copied) {
+      Submit(slot);
+    }
+    else {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Stats.Failed++;
+      slot->State = SlotState::Free;
+    }
+    return true;
+  }
+
+  void Submit(Slot *slot) {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      slot->State = SlotState::Encoding;
+      Encoding.push_back(slot);
+    }
+    Wake.notify_one();
+  }
+
+  void EncodeLoop() {
+    sf::Image image;
+    for (;;) {
+      Slot *slot = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Wake.wait(lock, [this]() { return Quit || !Encoding.empty(); });
+        if (Encoding.empty())
+          return;
+        slot = Encoding.front();
+        Encoding.pop_front();
+        Busy = true;
+      }
+
+      image.create(slot->Width, slot->Height, slot->Pixels.data());
+      if (slot->FlipRows)
+        image.flipVertically();
+      const bool saved = image.saveToFile(slot->Path);
+
+      {
+        std::lock_guard<std::mutex> lock(Mutex);
+        saved ? Stats.Written++ : Stats.Failed++;
+        slot->State = SlotState::Free;
+        Busy = false;
+      }
+      Idle.notify_all();
+    }
+  }
+
+  std::string Prefix;
+  std::vector<Slot> Slots;
+  std::deque<Slot*> Reading; //Oldest first, only touched on the GL thread
+  std::vector<std::uint64_t> Frames;
+  std::vector<std::uint64_t> Lights;
+
+  mutable std::mutex Mutex;
+  std::condition_variable Wake;
+  std::condition_variable Idle;
+  std::deque<Slot*> Encoding;
+  bool Busy = false;
+  bool Quit = false;
+  CaptureStats Stats;
+  std::thread Encoder;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "LightGeometry.h"
+
+/*
+  C++ mirrors of the std430 blocks in SSBOLighting.fsh. The static_asserts pin every offset to what std430 gives the
+  GLSL side, so a field added to one and not the other fails to compile instead of reading garbage on the GPU.
+
+    layout (std430, binding = 2) buffer light_shader_data    layout (std430, binding = 3) buffer edge_shader_data
+    {                                                        {
+      int num_lights;        //0                               vec4 Edges[];          //xy = start, zw = end
+      int num_edges;         //4                             };
+      light_data Lights[];   //16, struct arrays align to 16
+    };
+*/
+struct light_stc_data_type
+{
+  sf::Glsl::Vec4 light_color;
+  sf::Glsl::Vec2 light_position; //16-byte alignment
+  float light_attenuation;
+  float light_intensity;
+};
+
+struct light_buffer_header
+{
+  std::int32_t num_lights;
+  std::int32_t num_edges;
+  std::int32_t padding[2];
+};
+
+struct shadow_caster_data_type
+{
+  sf::Glsl::Vec2 EdgeStart;
+  sf::Glsl::Vec2 EdgeEnd;
+};
+
+static_assert(sizeof(sf::Glsl::Vec4) == 16 && sizeof(sf::Glsl::Vec2) == 8, "Glsl vectors have to be tightly packed floats");
+static_assert(offsetof(light_stc_data_type, light_color) == 0, "std430: vec4 light_color at 0");
+static_assert(offsetof(light_stc_data_type, light_position) == 16, "std430: vec2 light_position at 16");
+static_assert(offsetof(light_stc_data_type, light_attenuation) == 24, "std430: float light_attenuation at 24");
+static_assert(offsetof(light_stc_data_type, light_intensity) == 28, "std430: float light_intensity at 28");
+static_assert(sizeof(light_stc_data_type) == 32, "std430: light_data is 32 bytes, a multiple of its 16 byte alignment");
+static_assert(offsetof(light_buffer_header, num_lights) == 0 && offsetof(light_buffer_header, num_edges) == 4, "std430: counts lead the block");
+static_assert(sizeof(light_buffer_header) == 16, "std430: Lights[] starts at the struct alignment, 16");
+static_assert(offsetof(shadow_caster_data_type, EdgeEnd) == 8 && sizeof(shadow_caster_data_type) == 16, "std430: vec4 Edges[] has a 16 byte stride");
+
+//Byte range [Begin, End) of a packed buffer
+struct DirtyRange
+{
+  std::size_t Begin;
+  std::size_t End;
+};
+
+/*
+  CPU image of both SSBOs, plus what changed since the last TakeDirty
+
+  Set* compares against what's already packed and only marks the bytes that actually differ, so feeding it every light
+  and edge every frame still only uploads what moved. Nothing in here touches GL.
+*/
+class GPUScenePacker
+{
+public:
+  enum Buffer { LightBuffer = 0, EdgeBuffer = 1, BufferCount = 2 };
+
+  void SetLightCount(std::size_t count) {
+    Resize(LightBuffer, sizeof(light_buffer_header) + count * sizeof(light_stc_data_type));
+    LightCount = count;
+    SetHeader();
+  }
+
+  //Colors go in normalized, as vec4 uniforms do. index has to be below the last SetLightCount
+  void SetLight(std::size_t index, const sf::Color &color, const sf::Vector2f &position, float attenuation, float intensity) {
+    light_stc_data_type packed;
+    packed.light_color = sf::Glsl::Vec4(color);
+    packed.light_position = position;
+    packed.light_attenuation = attenuation;
+    packed.light_intensity = intensity;
+    Write(LightBuffer, sizeof(light_buffer_header) + index * sizeof(light_stc_data_type), &packed, sizeof(packed));
+  }
+
+  void SetEdges(const EdgeSoA &edges) {
+    Resize(EdgeBuffer, edges.Size() * sizeof(shadow_caster_data_type));
+    EdgeCount = edges.Size();
+    SetHeader();
+
+    for (std::size_t i = 0; i < edges.Size(); ++i) {
+      shadow_caster_data_type packed;
+      packed.EdgeStart = edges.Start(i);
+      packed.EdgeEnd = edges.End(i);
+      Write(EdgeBuffer, i * sizeof(packed), &packed, sizeof(packed));
+    }
+  }
+
+  const std::vector<std::uint8_t>& GetBytes(Buffer buffer) const {
+    return Bytes[buffer];
+  }
+
+  std::size_t GetLightCount() const {
+    return LightCount;
+  }
+
+  std::size_t GetEdgeCount() const {
+    return EdgeCount;
+  }
+
+  //Everything written since the last call, sorted, merged and clipped to the current size, and forgets it
+  void TakeDirty(Buffer buffer, std::vector<DirtyRange> &out) {
+    std::vector<DirtyRange> &dirty = Dirty[buffer];
+    std::sort(dirty.begin(), dirty.end(), [](const DirtyRange &a, const DirtyRange &b) { return a.Begin < b.Begin; });
+
+    out.clear();
+    const std::size_t size = Bytes[buffer].size();
+    for (auto range : dirty) {
+      range.End = std::min(range.End, size);
+      if (range.Begin >= range.End)
+        continue;
+      if (!out.empty() && range.Begin <= out.back().End)
+        out.back().End = std::max(out.back().End, range.End);
+      else
+        out.push_back(range);
+    }
+    dirty.clear();
+  }
+
+private:
+  //Grown bytes start zeroed and dirty. Shrinking needs no upload, the counts in the header stop the shader short
+  void Resize(Buffer buffer, std::size_t size) {
+    std::vector<std::uint8_t> &bytes = Bytes[buffer];
+    const std::size_t old = bytes.size();
+    bytes.resize(size, 0);
+    if (size > old)
+      Mark(buffer, old, size);
+  }
+
+  void SetHeader() {
+    light_buffer_header header = {};
+    header.num_lights = static_cast<std::int32_t>(LightCount);
+    header.num_edges = static_cast<std::int32_t>(EdgeCount);
+    if (Bytes[LightBuffer].size() < sizeof(header))
+      Resize(LightBuffer, sizeof(header));
+    Write(LightBuffer, 0, &header, sizeof(header));
+  }
+
+  void Write(Buffer buffer, std::size_t offset, const void *data, std::size_t size) {
+    std::uint8_t *dst = Bytes[buffer].data() + offset;
+    if (std::memcmp(dst, data, size) == 0)
+      return;
+
+    std::memcpy(dst, data, size);
+    Mark(buffer, offset, offset + size);
+  }
+
+  void Mark(Buffer buffer, std::size_t begin, std::size_t end) {
+    std::vector<DirtyRange> &dirty = Dirty[buffer];
+    //Writes mostly come in order, so the common case just stretches the last range
+    if (!dirty.empty() && dirty.back().End == begin)
+      dirty.back().End = end;
+    else
+      dirty.push_back({ begin, end });
+  }
+
+  std::vector<std::uint8_t> Bytes[BufferCount];
+  std::vector<DirtyRange> Dirty[BufferCount];
+  std::size_t LightCount = 0;
+  std::size_t EdgeCount = 0;
+};
@@ -0,0 +1,178 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "GPUPacking.h"
+
+/*
+  The SSBOs SSBOLighting.fsh reads, fed from a GPUScenePacker
+
+  Each buffer is allocated once with glBufferStorage and stays persistently mapped, split into RingSize slots. A frame
+  writes into the slot the GPU finished with RingSize frames ago (each slot is fenced when the next frame moves on), so
+  the CPU never writes under a draw that's still reading. Only the packer's dirty ranges are copied: every range is
+  queued for every slot, and a slot catches up on everything it missed the next time it comes round.
+*/
+class GPUSceneBuffers
+{
+public:
+  static constexpr unsigned RingSize = 3;
+  static constexpr GLuint LightBinding = 2; //binding = 2 in SSBOLighting.fsh
+  static constexpr GLuint EdgeBinding = 3;  //binding = 3
+
+  GPUSceneBuffers() = default;
+  GPUSceneBuffers(const GPUSceneBuffers &) = delete;
+  GPUSceneBuffers& operator=(const GPUSceneBuffers &) = delete;
+
+  ~GPUSceneBuffers() {
+    for (unsigned slot = 0; slot < RingSize; ++slot)
+      DeleteFence(slot);
+    for (auto & buffer : Buffers)
+      Free(buffer);
+  }
+
+  //Copies what changed into the next slot and binds it. Call once a frame, before anything draws with the shader
+  void Upload(GPUScenePacker &packer) {
+    //Everything drawn since the last Upload read the current slot
+    if (Current != NoSlot) {
+      DeleteFence(Current);
+      Fences[Current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    Current = Current == NoSlot ? 0 : (Current + 1) % RingSize;
+
+    UploadedBytes = 0;
+    for (unsigned b = 0; b < GPUScenePacker::BufferCount; ++b) {
+      const auto which = static_cast<GPUScenePacker::Buffer>(b);
+      const std::vector<std::uint8_t> &bytes = packer.GetBytes(which);
+      BufferState &buffer = Buffers[b];
+
+      packer.TakeDirty(which, Ranges);
+      if (bytes.size() > buffer.Capacity)
+        Grow(buffer, bytes.size());
+      else {
+        for (auto & pending : buffer.Pending)
+          pending.insert(pending.end(), Ranges.begin(), Ranges.end());
+      }
+    }
+
+    WaitFor(Current);
+
+    for (unsigned b = 0; b < GPUScenePacker::BufferCount; ++b) {
+      const auto which = static_cast<GPUScenePacker::Buffer>(b);
+      const std::vector<std::uint8_t> &bytes = packer.GetBytes(which);
+      BufferState &buffer = Buffers[b];
+      if (!buffer.Mapped)
+        continue;
+      std::uint8_t *slot = buffer.Mapped + static_cast<std::size_t>(Current) * buffer.SlotStride;
+
+      //Coherent mapping, so a plain memcpy is all the GPU needs to see it
+      Merge(buffer.Pending[Current]);
+      for (auto & range : buffer.Pending[Current]) {
+        const std::size_t end = std::min(range.End, bytes.size());
+        if (range.Begin < end) {
+          std::memcpy(slot + range.Begin, bytes.data() + range.Begin, end - range.Begin);
+          UploadedBytes += end - range.Begin;
+        }
+      }
+      buffer.Pending[Current].clear();
+
+      glBindBufferRange(GL_SHADER_STORAGE_BUFFER, b == GPUScenePacker::LightBuffer ? LightBinding : EdgeBinding, buffer.Name,
+                        static_cast<GLintptr>(Current) * buffer.SlotStride, static_cast<GLsizeiptr>(buffer.Capacity));
+    }
+  }
+
+  //Bytes copied by the last Upload
+  std::size_t GetUploadedBytes() const {
+    return UploadedBytes;
+  }
+
+private:
+  static constexpr unsigned NoSlot = ~0u;
+  static constexpr std::size_t MinCapacity = 4096;
+
+  struct BufferState
+  {
+    GLuint Name = 0;
+    std::uint8_t *Mapped = nullptr;
+    std::size_t Capacity = 0;   //Usable bytes per slot
+    std::size_t SlotStride = 0; //Capacity rounded up to the SSBO offset alignment
+    std::vector<DirtyRange> Pending[RingSize];
+  };
+
+  //Reallocating means every slot is out of date, and nothing in flight can still be reading the old buffer
+  void Grow(BufferState &buffer, std::size_t size) {
+    for (unsigned slot = 0; slot < RingSize; ++slot)
+      WaitFor(slot);
+    Free(buffer);
+
+    GLint alignment = 16;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, 16);
+
+    buffer.Capacity = MinCapacity;
+    while (buffer.Capacity < size)
+      buffer.Capacity *= 2;
+    buffer.SlotStride = (buffer.Capacity + alignment - 1) / alignment * alignment;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr total = static_cast<GLsizeiptr>(buffer.SlotStride * RingSize);
+    glGenBuffers(1, &buffer.Name);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.Name);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, total, nullptr, flags);
+    buffer.Mapped = static_cast<std::uint8_t*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, total, flags));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    for (auto & pending : buffer.Pending)
+      pending.assign(1, DirtyRange{ 0, size });
+  }
+
+  void Free(BufferState &buffer) {
+    if (!buffer.Name)
+      return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.Name);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer.Name);
+    buffer = BufferState();
+  }
+
+  void WaitFor(unsigned slot) {
+    if (!Fences[slot])
+      return;
+
+    //Only ever waits on work from RingSize frames back, so this is normally already signalled
+    while (glClientWaitSync(Fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {}
+    DeleteFence(slot);
+  }
+
+  void DeleteFence(unsigned slot) {
+    if (Fences[slot])
+      glDeleteSync(Fences[slot]);
+    Fences[slot] = nullptr;
+  }
+
+  static void Merge(std::vector<DirtyRange> &ranges) {
+    if (ranges.size() < 2)
+      return;
+
+    std::sort(ranges.begin(), ranges.end(), [](const DirtyRange &a, const DirtyRange &b) { return a.Begin < b.Begin; });
+    std::size_t out = 0;
+    for (std::size_t i = 1; i < ranges.size(); ++i) {
+      if (ranges[i].Begin <= ranges[out].End)
+        ranges[out].End = std::max(ranges[out].End, ranges[i].End);
+      else
+        ranges[++out] = ranges[i];
+    }
+    ranges.resize(out + 1);
+  }
+
+  BufferState Buffers[GPUScenePacker::BufferCount];
+  GLsync Fences[RingSize] = {};
+  unsigned Current = NoSlot;
+  std::vector<DirtyRange> Ranges;
+  std::size_t UploadedBytes = 0;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cmath>
+#include "LightSimd.h"
+
+//What the light buffer is stored as under LightComposite::Accumulate
+enum class LightBufferPrecision
+{
+  RGBA8,  //Plain 8 bit render texture. Each light is rounded on the way in, see LightAccumulation
+  Float16 //GL_RGBA16F, for when many overlapping lights make the rounding show
+};
+
+/*
+  What one light adds to the light buffer under LightComposite::Accumulate.
+
+  MaskShader.fsh scales the scene's color by (1 + L) for every light, L being that light's influence at the pixel, and the
+  8 bit target clamps the result. No factor is below 1, so clamping after every light is the same as clamping once at the
+  end: an opaque pixel ends up at min(color * (1 + L1) * (1 + L2) * ..., 1) whatever the light order. The buffer holds the
+  sum of log(1 + L), which adds up with plain additive blending, and the composite turns it back into the product with one
+  exp.
+
+  An 8 bit buffer only holds [0, 1], so the logs are divided by log(256) first. A gain of 256 already turns any non-black
+  8 bit color white, so the clamp at 1 loses nothing that could show. Each light is rounded to the nearest 1/255 of that
+  on the way in, so its log(1 + L) is off by at most log(256) / 510 = 0.0109, and its factor by at most exp(0.0109).
+  With N lights on a pixel the product is off by at most exp(0.0109 N), so a channel ends up within expm1(0.0109 N) of
+  the per-light result: 0.0109 for one light, 0.0445 for four. RoundingBound gives that. A Float16 buffer stores the
+  logs as they are.
+*/
+struct LightAccumulation
+{
+  static constexpr float LogScale8 = 5.54517744f; //log(256)
+
+  static float LogScale(LightBufferPrecision precision) {
+    return precision == LightBufferPrecision::RGBA8 ? LogScale8 : 1.f;
+  }
+
+  //Largest difference rounding can make in a channel of a pixel that lights reach, for an RGBA8 buffer
+  static float RoundingBound(unsigned lights) {
+    return std::expm1(lights * LogScale8 / 510.f);
+  }
+
+  static SimdF4 Encode(SimdF4 gain, float logScale) {
+    return SimdF4::Log1p(gain) * SimdF4::Set1(1.f / logScale);
+  }
+
+  static SimdF4 Decode(SimdF4 sum, float logScale) {
+    return SimdF4::Exp(sum * SimdF4::Set1(logScale));
+  }
+};
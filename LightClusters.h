@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+//What clustering did in the last UpdateLights
+struct LightClusterStats
+{
+  std::size_t Lights = 0;
+  std::size_t DrawnLights = 0;     //Cluster lights plus lights drawn on their own: what UpdateLights and the render calls go through
+  std::size_t Clusters = 0;        //Cluster lights standing in for more than one light
+  std::size_t ClusteredLights = 0; //Lights drawn through one of them
+};
+
+//What LightClusterTree needs to know about a light
+struct LightClusterInput
+{
+  sf::Vector2f Position;
+  float Attenuation = 0.f;
+  float Radius = 0.f;
+  float Expand = 0.f;
+  float Intensity = 1.f;
+  sf::Color Color;
+};
+
+/*
+  A node of the tree, and the aggregate light that stands in for every light under it: at the intensity weighted
+  centroid, reaching as far as any member does, as bright as all of them together, in their intensity weighted mean color
+*/
+struct LightClusterNode
+{
+  static constexpr std::uint32_t NoNode = 0xFFFFFFFFu;
+
+  sf::Vector2f Position;
+  float Attenuation = 0.f;
+  float Radius = 0.f;
+  float Expand = 0.f;
+  float Intensity = 0.f;
+  float Color[4] = {};
+
+  //How far off the aggregate can be, in world units, see LightClusterTree
+  float Error = 0.f;
+
+  //What Refit combines the children's aggregates from: the centroid's weight, how far any member is from it, and the
+  //range of the members' attenuations and colors. BuiltError is Error as of the last Build
+  float Weight = 0.f;
+  float Spread = 0.f;
+  float MinAttenuation = 0.f, MaxAttenuation = 0.f;
+  float MinColor[4] = {}, MaxColor[4] = {};
+  float BuiltError = 0.f;
+
+  //Members are GetOrder()[First .. First + Count)
+  std::uint32_t First = 0;
+  std::uint32_t Count = 0;
+  std::uint32_t Children[2] = { NoNode, NoNode };
+};
+
+/*
+  Binary tree over the lights, split top-down at the median of whichever dimension is widest: x, y, or one of the color
+  channels scaled so a full 0-255 difference counts as colorDistance world units. So nearby lights of similar color end
+  up under the same node.
+
+  A node's Error adds up how far its members are from the centroid, how much their attenuations differ, and how much
+  their colors differ (in the same colorDistance units). Cut picks the nodes to draw: walking down from the root, a node
+  is taken whole once its Error is within maxError, so every light is drawn by exactly one node and no node that's drawn
+  has an Error over maxError. The leaves are the lights themselves, with an Error of 0.
+
+  The aggregates are built bottom-up from the children's, so the distances are bounds through the child centroids
+  rather than exact. That lets Refit redo them in one pass over the nodes when lights move, keeping the splits. The
+  splits go stale as lights wander, which Refit's return value tells: once it's grown too far, Build again.
+*/
+class LightClusterTree
+{
+public:
+  void Build(const std::vector<LightClusterInput> &lights, float colorDistance) {
+    Nodes.clear();
+    Order.resize(lights.size());
+    for (std::uint32_t i = 0; i < Order.size(); ++i)
+      Order[i] = i;
+    if (lights.empty())
+      return;
+
+    ColorScale = colorDistance / 255.f;
+    Nodes.reserve(lights.size() * 2 - 1);
+    Nodes.emplace_back();
+    Nodes[0].Count = static_cast<std::uint32_t>(lights.size());
+
+    //Nodes are appended as they're split, so a plain index walks the whole tree breadth first
+    for (std::size_t n = 0; n < Nodes.size(); ++n) {
+      if (Nodes[n].Count > 1)
+        Split(n, lights);
+    }
+
+    Refit(lights);
+    for (auto & node : Nodes)
+      node.BuiltError = node.Error;
+  }
+
+  /*
+    Redoes every aggregate and Error for lights at new positions (or with new attenuations, colors and so on), keeping
+    the tree as it was built. lights has to be the same lights in the same order as the last Build. Returns how much the
+    worst node's Error has grown since then, in world units
+  */
+  float Refit(const std::vector<LightClusterInput> &lights) {
+    //Children always come after their parent, so walking backwards has both ready by the time the parent is reached
+    float growth = 0.f;
+    for (std::size_t n = Nodes.size(); n-- > 0;) {
+      LightClusterNode &node = Nodes[n];
+      if (node.Count == 1)
+        Leaf(node, lights[Order[node.First]]);
+      else
+        Combine(node, Nodes[node.Children[0]], Nodes[node.Children[1]]);
+      growth = std::max(growth, node.Error - node.BuiltError);
+    }
+    return growth;
+  }
+
+  //Nodes to draw, see the class comment. Nodes whose aggregate light misses view (if given) are taken whole too, nobody sees them
+  void Cut(float maxError, const sf::FloatRect *view, std::vector<std::uint32_t> &out) const {
+    out.clear();
+    if (Nodes.empty())
+      return;
+
+    Stack.assign(1, 0);
+    while (!Stack.empty()) {
+      const std::uint32_t n = Stack.back();
+      Stack.pop_back();
+      const LightClusterNode &node = Nodes[n];
+      if (node.Count == 1 || node.Error <= maxError || (view && !Touches(node, *view))) {
+        out.push_back(n);
+        continue;
+      }
+      Stack.push_back(node.Children[1]);
+      Stack.push_back(node.Children[0]);
+    }
+  }
+
+  const LightClusterNode& GetNode(std::uint32_t n) const {
+    return Nodes[n];
+  }
+
+  //Light indices, grouped so every node's members are next to each other
+  const std::vector<std::uint32_t>& GetOrder() const {
+    return Order;
+  }
+
+private:
+  static void Leaf(LightClusterNode &node, const LightClusterInput &light) {
+    const float channels[4] = { float(light.Color.r), float(light.Color.g), float(light.Color.b), float(light.Color.a) };
+    node.Position = light.Position;
+    node.Attenuation = node.MinAttenuation = node.MaxAttenuation = light.Attenuation;
+    node.Radius = light.Radius;
+    node.Expand = light.Expand;
+    node.Intensity = light.Intensity;
+    node.Weight = std::max(light.Intensity, 0.f);
+    node.Spread = node.Error = 0.f;
+    for (int c = 0; c < 4; ++c)
+      node.Color[c] = node.MinColor[c] = node.MaxColor[c] = channels[c];
+  }
+
+  void Combine(LightClusterNode &node, const LightClusterNode &a, const LightClusterNode &b) const {
+    //All dark: fall back to the plain mean, so the aggregate still sits among its members
+    float wa = a.Weight, wb = b.Weight;
+    if (wa + wb <= 0.f) {
+      wa = static_cast<float>(a.Count);
+      wb = static_cast<float>(b.Count);
+    }
+    const float weight = wa + wb;
+    node.Position = (a.Position * wa + b.Position * wb) / weight;
+    for (int c = 0; c < 4; ++c)
+      node.Color[c] = (a.Color[c] * wa + b.Color[c] * wb) / weight;
+
+    const float da = Distance(a.Position, node.Position), db = Distance(b.Position, node.Position);
+    node.Spread = std::max(da + a.Spread, db + b.Spread);
+    node.Attenuation = std::max(da + a.Attenuation, db + b.Attenuation);
+    node.Radius = std::max(da + a.Radius, db + b.Radius);
+    node.Expand = std::max(a.Expand, b.Expand);
+    node.Intensity = a.Intensity + b.Intensity;
+    node.Weight = a.Weight + b.Weight;
+
+    node.MinAttenuation = std::min(a.MinAttenuation, b.MinAttenuation);
+    node.MaxAttenuation = std::max(a.MaxAttenuation, b.MaxAttenuation);
+    float colorSpread = 0.f;
+    for (int c = 0; c < 4; ++c) {
+      node.MinColor[c] = std::min(a.MinColor[c], b.MinColor[c]);
+      node.MaxColor[c] = std::max(a.MaxColor[c], b.MaxColor[c]);
+      colorSpread = std::max(colorSpread, node.MaxColor[c] - node.MinColor[c]);
+    }
+    node.Error = node.Spread + (node.MaxAttenuation - node.MinAttenuation) + colorSpread * ColorScale;
+  }
+
+  static float Distance(const sf::Vector2f &a, const sf::Vector2f &b) {
+    const sf::Vector2f d = a - b;
+    return std::sqrt(d.x * d.x + d.y * d.y);
+  }
+
+  void Split(std::size_t n, const std::vector<LightClusterInput> &lights) {
+    const std::uint32_t first = Nodes[n].First, count = Nodes[n].Count;
+
+    //Widest of x, y and the scaled color channels
+    float min[6], max[6];
+    for (int k = 0; k < 6; ++k) {
+      min[k] = Key(lights[Order[first]], k);
+      max[k] = min[k];
+    }
+    for (std::uint32_t i = first + 1; i < first + count; ++i) {
+      for (int k = 0; k < 6; ++k) {
+        const float v = Key(lights[Order[i]], k);
+        min[k] = std::min(min[k], v);
+        max[k] = std::max(max[k], v);
+      }
+    }
+    int axis = 0;
+    for (int k = 1; k < 6; ++k) {
+      if (max[k] - min[k] > max[axis] - min[axis])
+        axis = k;
+    }
+
+    const std::uint32_t half = count / 2;
+    std::nth_element(Order.begin() + first, Order.begin() + first + half, Order.begin() + first + count,
+                     [&](std::uint32_t a, std::uint32_t b) { return Key(lights[a], axis) < Key(lights[b], axis); });
+
+    for (int side = 0; side < 2; ++side) {
+      LightClusterNode child;
+      child.First = side == 0 ? first : first + half;
+      child.Count = side == 0 ? half : count - half;
+      Nodes[n].Children[side] = static_cast<std::uint32_t>(Nodes.size());
+      Nodes.push_back(child);
+    }
+  }
+
+  float Key(const LightClusterInput &light, int k) const {
+    switch (k) {
+      case 0:  return light.Position.x;
+      case 1:  return light.Position.y;
+      case 2:  return light.Color.r * ColorScale;
+      case 3:  return light.Color.g * ColorScale;
+      case 4:  return light.Color.b * ColorScale;
+      default: return light.Color.a * ColorScale;
+    }
+  }
+
+  static bool Touches(const LightClusterNode &node, const sf::FloatRect &view) {
+    //Nearest point of the view to the aggregate light
+    const float x = std::min(std::max(node.Position.x, view.left), view.left + view.width) - node.Position.x;
+    const float y = std::min(std::max(node.Position.y, view.top), view.top + view.height) - node.Position.y;
+    return x * x + y * y <= node.Attenuation * node.Attenuation;
+  }
+
+  float ColorScale = 0.f;
+  std::vector<LightClusterNode> Nodes;
+  std::vector<std::uint32_t> Order;
+  mutable std::vector<std::uint32_t> Stack;
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+struct Edge
+{
+  sf::Vector2f Start;
+  sf::Vector2f End;
+};
+
+//Read-only EdgeSoA over arrays that live somewhere else, like a mapped scene file (see SceneFile.h)
+struct EdgeSoAView
+{
+  const float *StartX = nullptr;
+  const float *StartY = nullptr;
+  const float *EndX = nullptr;
+  const float *EndY = nullptr;
+  std::size_t Count = 0;
+
+  std::size_t Size() const {
+    return Count;
+  }
+
+  bool Empty() const {
+    return Count == 0;
+  }
+
+  sf::Vector2f Start(std::size_t i) const {
+    return { StartX[i], StartY[i] };
+  }
+
+  sf::Vector2f End(std::size_t i) const {
+    return { EndX[i], EndY[i] };
+  }
+};
+
+/*
+  Edges stored as four parallel arrays instead of an array of Edge,
+  so the per-edge math can load 4 or 8 edges' worth of one coordinate at a time
+*/
+struct EdgeSoA
+{
+  std::vector<float> StartX;
+  std::vector<float> StartY;
+  std::vector<float> EndX;
+  std::vector<float> EndY;
+
+  std::size_t Size() const {
+    return StartX.size();
+  }
+
+  bool Empty() const {
+    return StartX.empty();
+  }
+
+  void Clear() {
+    StartX.clear(); StartY.clear(); EndX.clear(); EndY.clear();
+  }
+
+  void Reserve(std::size_t count) {
+    StartX.reserve(count); StartY.reserve(count); EndX.reserve(count); EndY.reserve(count);
+  }
+
+  void Push(const sf::Vector2f &start, const sf::Vector2f &end) {
+    StartX.push_back(start.x); StartY.push_back(start.y);
+    EndX.push_back(end.x); EndY.push_back(end.y);
+  }
+
+  void Append(const std::vector<Edge> &edges) {
+    Reserve(Size() + edges.size());
+    for (auto & edge : edges)
+      Push(edge.Start, edge.End);
+  }
+
+  void Append(const EdgeSoA &edges) {
+    Append(edges.View());
+  }
+
+  void Append(const EdgeSoAView &edges) {
+    StartX.insert(StartX.end(), edges.StartX, edges.StartX + edges.Count);
+    StartY.insert(StartY.end(), edges.StartY, edges.StartY + edges.Count);
+    EndX.insert(EndX.end(), edges.EndX, edges.EndX + edges.Count);
+    EndY.insert(EndY.end(), edges.EndY, edges.EndY + edges.Count);
+  }
+
+  EdgeSoAView View() const {
+    return { StartX.data(), StartY.data(), EndX.data(), EndY.data(), Size() };
+  }
+
+  sf::Vector2f Start(std::size_t i) const {
+    return { StartX[i], StartY[i] };
+  }
+
+  sf::Vector2f End(std::size_t i) const {
+    return { EndX[i], EndY[i] };
+  }
+};
+
+/**
+*  C++ side of the ray/segment math in SSBOLighting.fsh
+*
+*  RA(x2, y2)   * T (x4, y4)        L1: x1 + t * (x2 - x1)
+*      *        |                       y1 + t * (y2 - y1)
+*         *     | L2
+*            *  |                   L2: x3 + v * (x4 - x3)
+*              (*)                      y3 + v * (y4 - y3)
+*               |  * L1
+*               |     *
+*               |        *
+*               B (x3, y3)  * R0 (x1, y1)
+*
+*  Into matrix ==>  [ (x2 - x1)   -(x4 - x3)   |   (x3 - x1) ]  ==>  [ a  b | e ]
+*                   [ (y2 - y1)   -(y4 - y3)   |   (y3 - y1) ]       [ c  d | f ]
+*
+*  The shader version eliminates using "a" as the pivot, which falls over for vertical rays (a == 0),
+*  so this one goes through the determinant instead. Returns false if the lines are parallel.
+*/
+inline bool Solve2x2(float a, float b, float c, float d, float e, float f, float &t, float &v)
+{
+  float det = (a * d) - (b * c);
+  if (std::abs(det) < 1e-9f)
+    return false;
+
+  t = (e * d - b * f) / det;
+  v = (a * f - e * c) / det;
+  return true;
+}
+
+/**
+*  Cast a ray from lPos through mePos against the (infinite) line through edgeStart -> edgeEnd
+*  t is the distance along the ray in units of |mePos - lPos|, v is the parameter along the edge (0 at edgeEnd, 1 at edgeStart)
+*/
+inline bool CastRay(const sf::Vector2f &lPos, const sf::Vector2f &mePos, const sf::Vector2f &edgeStart, const sf::Vector2f &edgeEnd, float &t, float &v)
+{
+  float X21 = mePos.x - lPos.x;
+  float X43 = edgeStart.x - edgeEnd.x;
+  float X31 = edgeEnd.x - lPos.x;
+
+  float Y21 = mePos.y - lPos.y;
+  float Y43 = edgeStart.y - edgeEnd.y;
+  float Y31 = edgeEnd.y - lPos.y;
+
+  return Solve2x2(X21, -X43, Y21, -Y43, X31, Y31, t, v);
+}
+
+struct VisibilitySegment
+{
+  sf::Vector2f Start;
+  sf::Vector2f End;
+};
+
+struct VisibilityEvent
+{
+  float Angle = 0.f;
+  int Segment = 0;
+  bool Opens = false;
+};
+
+//Scratch space for the angular sweep, kept around so we don't reallocate every update
+struct VisibilityScratch
+{
+  std::vector<VisibilitySegment> Segments;
+  std::vector<VisibilityEvent> Events;
+  std::vector<int> Active;
+
+  //Output: pairs of points, each pair (P, Q) is the far side of one fan triangle (Origin, P, Q)
+  std::vector<sf::Vector2f> Fan;
+};
+
+/*
+  Angular sweep around Origin
+
+  Every segment covers some range of angles as seen from the light. Sorting the endpoints by angle splits the circle
+  into intervals where the set of segments under the ray doesn't change, and so the closest segment doesn't change either.
+  Each run of intervals with the same closest segment is exactly one triangle (Origin, P, Q) of the lit region.
+
+  A square of half-size HalfExtent around the origin (the same square LightVerts covers in the quad path) closes the polygon,
+  so every ray always hits something. Edges of overlapping casters can cross, which changes the closest segment partway
+  through an interval. That can only happen where the closest segment itself crosses another one, so only its crossings
+  are looked for, one pass over the active segments per piece of the interval instead of testing every pair.
+*/
+class VisibilityPolygon
+{
+public:
+  static void Begin(VisibilityScratch &scratch) {
+    scratch.Segments.clear();
+  }
+
+  static void AddSegment(VisibilityScratch &scratch, const sf::Vector2f &start, const sf::Vector2f &end) {
+    scratch.Segments.push_back({ start, end });
+  }
+
+  static void Build(VisibilityScratch &scratch, const sf::Vector2f &origin, float halfExtent) {
+    const sf::Vector2f TL = origin + sf::Vector2f(-halfExtent, -halfExtent);
+    const sf::Vector2f TR = origin + sf::Vector2f(halfExtent, -halfExtent);
+    const sf::Vector2f BR = origin + sf::Vector2f(halfExtent, halfExtent);
+    const sf::Vector2f BL = origin + sf::Vector2f(-halfExtent, halfExtent);
+
+    AddSegment(scratch, TL, TR);
+    AddSegment(scratch, TR, BR);
+    AddSegment(scratch, BR, BL);
+    AddSegment(scratch, BL, TL);
+
+    scratch.Events.clear();
+    scratch.Active.clear();
+    scratch.Fan.clear();
+
+    for (int i = 0; i < static_cast<int>(scratch.Segments.size()); ++i)
+      AddEvents(scratch, origin, i);
+
+    std::sort(scratch.Events.begin(), scratch.Events.end(),
+              [](const VisibilityEvent &a, const VisibilityEvent &b) { return a.Angle < b.Angle; });
+
+    int runSegment = -1;
+    float runStart = 0.f;
+    float runEnd = 0.f;
+
+    std::size_t e = 0;
+    const std::size_t count = scratch.Events.size();
+    while (e < count) {
+      //Apply every event sitting on this angle before looking at the interval after it
+      const float angle = scratch.Events[e].Angle;
+      for (; e < count && scratch.Events[e].Angle == angle; ++e) {
+        const VisibilityEvent &ev = scratch.Events[e];
+        if (ev.Opens) {
+          scratch.Active.push_back(ev.Segment);
+        }
+        else {
+          auto it = std::find(scratch.Active.begin(), scratch.Active.end(), ev.Segment);
+          if (it != scratch.Active.end()) {
+            *it = scratch.Active.back();
+            scratch.Active.pop_back();
+          }
+        }
+      }
+
+      if (e == count)
+        break;
+
+      const float next = scratch.Events[e].Angle;
+      for (float from = angle; from < next;) {
+        //Closest in the middle, then cut back to its first crossing until the closest one doesn't cross anything before to
+        float to = next;
+        int nearest = Nearest(scratch, origin, 0.5f * (from + to));
+        for (float cut; nearest >= 0 && (cut = FirstCrossing(scratch, origin, nearest, from, to)) < to;) {
+          to = cut;
+          nearest = Nearest(scratch, origin, 0.5f * (from + to));
+        }
+
+        if (nearest >= 0) {
+          if (nearest != runSegment) {
+            if (runSegment >= 0)
+              EmitRun(scratch, origin, runSegment, runStart, runEnd);
+            runSegment = nearest;
+            runStart = from;
+          }
+          runEnd = to;
+        }
+        from = to;
+      }
+    }
+
+    if (runSegment >= 0)
+      EmitRun(scratch, origin, runSegment, runStart, runEnd);
+  }
+
+private:
+  static constexpr float Pi = 3.14159265f;
+
+  static void AddEvents(VisibilityScratch &scratch, const sf::Vector2f &origin, int index) {
+    const VisibilitySegment &seg = scratch.Segments[index];
+    const sf::Vector2f a = seg.Start - origin;
+    const sf::Vector2f b = seg.End - origin;
+
+    //Segments pointing straight at the light (or touching it) don't block anything
+    const float cross = a.x * b.y - a.y * b.x;
+    if (std::abs(cross) < 1e-6f)
+      return;
+
+    float lo = std::atan2(a.y, a.x);
+    float hi = std::atan2(b.y, b.x);
+    if (cross < 0.f)
+      std::swap(lo, hi);
+
+    if (lo <= hi) {
+      scratch.Events.push_back({ lo, index, true });
+      scratch.Events.push_back({ hi, index, false });
+    }
+    else {
+      //Wraps past +pi, so split it across the seam
+      scratch.Events.push_back({ lo, index, true });
+      scratch.Events.push_back({ Pi, index, false });
+      scratch.Events.push_back({ -Pi, index, true });
+      scratch.Events.push_back({ hi, index, false });
+    }
+  }
+
+  //The smallest angle strictly inside (from, to) where segment crosses another active segment, or to if there's none
+  static float FirstCrossing(const VisibilityScratch &scratch, const sf::Vector2f &origin, int segment, float from, float to) {
+    const VisibilitySegment &a = scratch.Segments[segment];
+    const sf::Vector2f da = a.End - a.Start;
+    for (int index : scratch.Active) {
+      if (index == segment)
+        continue;
+
+      //a.Start + s * (a.End - a.Start) == b.Start + u * (b.End - b.Start)
+      const VisibilitySegment &b = scratch.Segments[index];
+      float s = 0.f, u = 0.f;
+      const sf::Vector2f db = b.End - b.Start;
+      const sf::Vector2f w = b.Start - a.Start;
+      if (!Solve2x2(da.x, -db.x, da.y, -db.y, w.x, w.y, s, u) || s <= 0.f || s >= 1.f || u <= 0.f || u >= 1.f)
+        continue;
+
+      const sf::Vector2f p = a.Start + da * s - origin;
+      const float angle = std::atan2(p.y, p.x);
+      if (angle > from && angle < to)
+        to = angle;
+    }
+    return to;
+  }
+
+  static bool Hit(const VisibilitySegment &seg, const sf::Vector2f &origin, float angle, float &t) {
+    const sf::Vector2f through = origin + sf::Vector2f(std::cos(angle), std::sin(angle));
+    float v = 0.f;
+    return CastRay(origin, through, seg.Start, seg.End, t, v);
+  }
+
+  static int Nearest(const VisibilityScratch &scratch, const sf::Vector2f &origin, float angle) {
+    int best = -1;
+    float bestT = 0.f;
+    float t = 0.f;
+    for (int index : scratch.Active) {
+      if (!Hit(scratch.Segments[index], origin, angle, t) || t <= 0.f)
+        continue;
+
+      //Ties go to the lower index so the result doesn't depend on the order of the active list
+      if (best < 0 || t < bestT || (t == bestT && index < best)) {
+        best = index;
+        bestT = t;
+      }
+    }
+    return best;
+  }
+
+  static void EmitRun(VisibilityScratch &scratch, const sf::Vector2f &origin, int segment, float from, float to) {
+    float t0 = 0.f, t1 = 0.f;
+    const VisibilitySegment &seg = scratch.Segments[segment];
+    if (!Hit(seg, origin, from, t0) || !Hit(seg, origin, to, t1))
+      return;
+
+    scratch.Fan.push_back(origin + sf::Vector2f(std::cos(from), std::sin(from)) * t0);
+    scratch.Fan.push_back(origin + sf::Vector2f(std::cos(to), std::sin(to)) * t1);
+  }
+};
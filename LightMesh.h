@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+/*
+  Indexed triangle list for the light and shadow geometry
+
+  Clear only resets the sizes, so a mesh that gets rebuilt every frame keeps its memory and stops allocating once it
+  has seen its largest frame. Shared corners are stored once: an edge's shadow quad is 4 vertices and 6 indices
+  (104 bytes), or 5 vertices and 9 indices (136 bytes) for the few edges that need a peak. Shadowverts and ShadowRegions
+  used to hold 6 full vertices each, 12 (240 bytes) per edge.
+*/
+struct LightMesh
+{
+  std::vector<sf::Vertex> Vertices;
+  std::vector<std::uint32_t> Indices;
+
+  void Clear() {
+    Vertices.clear();
+    Indices.clear();
+  }
+
+  bool Empty() const {
+    return Indices.empty();
+  }
+
+  std::uint32_t AddVertex(const sf::Vertex &vertex) {
+    Vertices.push_back(vertex);
+    return static_cast<std::uint32_t>(Vertices.size() - 1);
+  }
+
+  void AddTriangle(std::uint32_t a, std::uint32_t b, std::uint32_t c) {
+    Indices.push_back(a);
+    Indices.push_back(b);
+    Indices.push_back(c);
+  }
+
+  std::size_t GetTriangleCount() const {
+    return Indices.size() / 3;
+  }
+
+  //Corner 0, 1 or 2 of triangle tri
+  const sf::Vertex& GetCorner(std::size_t tri, int corner) const {
+    return Vertices[Indices[tri * 3 + corner]];
+  }
+};
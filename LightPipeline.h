@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+  One background thread running one job at a time, so the light update can overlap with rendering
+
+  Kick hands it a job and returns straight away. Wait is the fence: it blocks until that job has finished. Only one job
+  is ever in flight, Kick waits for the previous one first. Whatever the job touches belongs to it from Kick until Wait
+  returns, the caller has to leave it alone until then. The thread is only started by the first Kick.
+*/
+class LightPipeline
+{
+public:
+  LightPipeline() = default;
+  LightPipeline(const LightPipeline &) = delete;
+  LightPipeline& operator=(const LightPipeline &) = delete;
+
+  ~LightPipeline() {
+    Wait();
+    if (!Thread.joinable())
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Quit = true;
+    }
+    Wake.notify_one();
+    Thread.join();
+  }
+
+  void Kick(std::function<void()> job) {
+    Wait();
+    if (!Thread.joinable())
+      Thread = std::thread(&LightPipeline::Loop, this);
+
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Job = std::move(job);
+      Pending = true;
+    }
+    Wake.notify_one();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(Mutex);
+    Idle.wait(lock, [this]() { return !Pending; });
+  }
+
+  bool IsBusy() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Pending;
+  }
+
+private:
+  void Loop() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Wake.wait(lock, [this]() { return Quit || Job; });
+        if (Quit)
+          return;
+        job = std::move(Job);
+        Job = nullptr;
+      }
+
+      job();
+
+      {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Pending = false;
+      }
+      Idle.notify_all();
+    }
+  }
+
+  std::thread Thread;
+  std::mutex Mutex;
+  std::condition_variable Wake;
+  std::condition_variable Idle;
+  std::function<void()> Job;
+  bool Pending = false;
+  bool Quit = false;
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+/*
+  Built-in lighting profiler, only compiled in with LSYS_PROFILE defined. Without it the LSYS_PROFILE_* macros below
+  expand to nothing and LSystem has no profiler member, so there is nothing left to pay for.
+*/
+
+#ifdef LSYS_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//The parts of LSystem that get timed
+enum class LightProfilePhase
+{
+  UpdateLights,    //The calling thread's part, with a pipelined update that's everything but the light rebuilds
+  UpdateLight,     //One light's rebuild, on whichever worker it ran on
+  CreateLightMap,
+  RenderOntoScene,
+  RenderSoftware,
+  Count
+};
+
+enum class LightProfileCounter
+{
+  LightsProcessed, //UpdateLight calls
+  EdgesTested,     //Caster edges the grid queries handed to those calls
+  ShadowTriangles, //Triangles they emitted for the lit and shadow meshes
+  TargetSwitches,  //Times drawing moved to a different render target
+  UniformUploads,  //setUniform calls
+  Count
+};
+
+//Everything from one UpdateLights up to the next. Phase times are summed over every time the phase ran in that frame,
+//so UpdateLightMs adds up every light on every thread and can come out larger than the frame itself
+struct LightFrameProfile
+{
+  std::uint64_t Frame = 0;
+  double UpdateLightsMs = 0.0;
+  double UpdateLightMs = 0.0;
+  double CreateLightMapMs = 0.0;
+  double RenderOntoSceneMs = 0.0;
+  double RenderSoftwareMs = 0.0;
+  std::size_t LightsProcessed = 0;
+  std::size_t EdgesTested = 0;
+  std::size_t ShadowTriangles = 0;
+  std::size_t TargetSwitches = 0;
+  std::size_t UniformUploads = 0;
+};
+
+/*
+  Per-phase timers and counters, summed per frame, plus an optional event log that's written out as Chrome trace_event
+  JSON (load it in chrome://tracing or Perfetto)
+
+  Scopes can be opened on any thread. Totals are relaxed atomics, and trace events go into a buffer per thread, so
+  recording never takes a lock after a thread's first event. Tracing is off until StartTrace, and stops on its own once
+  maxEvents have been recorded, so leaving it on can't eat memory.
+*/
+class LightProfiler
+{
+  using Clock = std::chrono::steady_clock;
+
+public:
+  LightProfiler()
+    : Id(NextId()), Epoch(Clock::now())
+  {
+    for (auto & ns : PhaseNs)
+      ns.store(0, std::memory_order_relaxed);
+    for (auto & count : Counters)
+      count.store(0, std::memory_order_relaxed);
+  }
+
+  LightProfiler(const LightProfiler &) = delete;
+  LightProfiler& operator=(const LightProfiler &) = delete;
+
+  class Scope
+  {
+  public:
+    Scope(LightProfiler &profiler, LightProfilePhase phase)
+      : Profiler(profiler), Phase(phase), Start(Clock::now())
+    { }
+
+    ~Scope() {
+      Profiler.Record(Phase, Start, Clock::now());
+    }
+
+  private:
+    LightProfiler &Profiler;
+    LightProfilePhase Phase;
+    Clock::time_point Start;
+  };
+
+  void Add(LightProfileCounter counter, std::size_t amount) {
+    Counters[static_cast<int>(counter)].fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  //Closes the running frame (its totals become GetLastFrame) and starts frame. Nothing may be recording while this runs
+  void BeginFrame(std::uint64_t frame) {
+    LightFrameProfile &last = Last;
+    last.Frame = CurrentFrame;
+    last.UpdateLightsMs = TakeMs(LightProfilePhase::UpdateLights);
+    last.UpdateLightMs = TakeMs(LightProfilePhase::UpdateLight);
+    last.CreateLightMapMs = TakeMs(LightProfilePhase::CreateLightMap);
+    last.RenderOntoSceneMs = TakeMs(LightProfilePhase::RenderOntoScene);
+    last.RenderSoftwareMs = TakeMs(LightProfilePhase::RenderSoftware);
+    last.LightsProcessed = Take(LightProfileCounter::LightsProcessed);
+    last.EdgesTested = Take(LightProfileCounter::EdgesTested);
+    last.ShadowTriangles = Take(LightProfileCounter::ShadowTriangles);
+    last.TargetSwitches = Take(LightProfileCounter::TargetSwitches);
+    last.UniformUploads = Take(LightProfileCounter::UniformUploads);
+
+    //The counters go into the trace too, as counter tracks, stamped where the frame ended
+    if (Tracing.load(std::memory_order_relaxed) && CurrentFrame != 0) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      FrameEvent event;
+      event.Stats = last;
+      event.Time = Microseconds(Clock::now());
+      FrameEvents.push_back(event);
+    }
+    CurrentFrame = frame;
+  }
+
+  const LightFrameProfile& GetLastFrame() const {
+    return Last;
+  }
+
+  //Drops whatever was recorded before and starts recording events, up to maxEvents of them. Nothing may be recording while this runs
+  void StartTrace(std::size_t maxEvents = 1 << 20) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    for (auto & buffer : Buffers)
+      buffer->Events.clear();
+    FrameEvents.clear();
+    EventBudget.store(static_cast<std::int64_t>(maxEvents), std::memory_order_relaxed);
+    Tracing.store(true, std::memory_order_relaxed);
+  }
+
+  void StopTrace() {
+    Tracing.store(false, std::memory_order_relaxed);
+  }
+
+  bool IsTracing() const {
+    return Tracing.load(std::memory_order_relaxed);
+  }
+
+  //Writes everything recorded since StartTrace. Nothing may be recording while this runs
+  bool WriteTrace(const std::string &path) const {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+      return false;
+
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    std::fprintf(file, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"LSystem\"}}");
+    for (auto & buffer : Buffers) {
+      std::fprintf(file, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"lighting %u\"}}",
+                   buffer->Thread, buffer->Thread);
+      for (auto & event : buffer->Events) {
+        std::fprintf(file, ",\n  {\"name\": \"%s\", \"cat\": \"lighting\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                           "\"args\": {\"frame\": %llu}}",
+                     PhaseName(event.Phase), buffer->Thread, event.Start, event.Duration,
+                     static_cast<unsigned long long>(event.Frame));
+      }
+    }
+    for (auto & frame : FrameEvents) {
+      const LightFrameProfile &s = frame.Stats;
+      std::fprintf(file, ",\n  {\"name\": \"lighting\", \"ph\": \"C\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f, \"args\": "
+                         "{\"lights\": %zu, \"edges\": %zu, \"shadow_triangles\": %zu, \"target_switches\": %zu, \"uniforms\": %zu}}",
+                   frame.Time, s.LightsProcessed, s.EdgesTested, s.ShadowTriangles, s.TargetSwitches, s.UniformUploads);
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+  }
+
+  static const char* PhaseName(LightProfilePhase phase) {
+    switch (phase) {
+      case LightProfilePhase::UpdateLights:    return "UpdateLights";
+      case LightProfilePhase::UpdateLight:     return "UpdateLight";
+      case LightProfilePhase::CreateLightMap:  return "CreateLightMap";
+      case LightProfilePhase::RenderOntoScene: return "RenderOntoScene";
+      case LightProfilePhase::RenderSoftware:  return "RenderSoftware";
+      default:                                 return "?";
+    }
+  }
+
+private:
+  struct Event
+  {
+    LightProfilePhase Phase;
+    std::uint64_t Frame;
+    double Start;    //Microseconds since the profiler was made
+    double Duration;
+  };
+
+  //Only ever appended to by its own thread
+  struct ThreadBuffer
+  {
+    unsigned Thread = 0;
+    std::vector<Event> Events;
+  };
+
+  struct FrameEvent
+  {
+    LightFrameProfile Stats;
+    double Time = 0.0;
+  };
+
+  static std::uint64_t NextId() {
+    static std::atomic<std::uint64_t> next{ 1 };
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Record(LightProfilePhase phase, Clock::time_point start, Clock::time_point end) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    PhaseNs[static_cast<int>(phase)].fetch_add(ns, std::memory_order_relaxed);
+
+    if (!Tracing.load(std::memory_order_relaxed))
+      return;
+    if (EventBudget.fetch_sub(1, std::memory_order_relaxed) <= 0) {
+      Tracing.store(false, std::memory_order_relaxed);
+      return;
+    }
+    LocalBuffer().Events.push_back({ phase, CurrentFrame, Microseconds(start), ns / 1000.0 });
+  }
+
+  //This thread's buffer, registered on its first event. The cache is keyed by Id so a profiler made at the address of
+  //a dead one never picks up the old one's buffer
+  ThreadBuffer& LocalBuffer() {
+    thread_local std::uint64_t cachedId = 0;
+    thread_local ThreadBuffer *cached = nullptr;
+    if (cachedId == Id)
+      return *cached;
+
+    std::lock_guard<std::mutex> lock(Mutex);
+    Buffers.push_back(std::make_unique<ThreadBuffer>());
+    Buffers.back()->Thread = static_cast<unsigned>(Buffers.size() - 1);
+    cachedId = Id;
+    cached = Buffers.back().get();
+    return *cached;
+  }
+
+  double Microseconds(Clock::time_point t) const {
+    return std::chrono::duration<double, std::micro>(t - Epoch).count();
+  }
+
+  double TakeMs(LightProfilePhase phase) {
+    return PhaseNs[static_cast<int>(phase)].exchange(0, std::memory_order_relaxed) / 1e6;
+  }
+
+  std::size_t Take(LightProfileCounter counter) {
+    return Counters[static_cast<int>(counter)].exchange(0, std::memory_order_relaxed);
+  }
+
+  const std::uint64_t Id;
+  const Clock::time_point Epoch;
+  std::uint64_t CurrentFrame = 0;
+  LightFrameProfile Last;
+
+  std::atomic<std::int64_t> PhaseNs[static_cast<int>(LightProfilePhase::Count)];
+  std::atomic<std::size_t> Counters[static_cast<int>(LightProfileCounter::Count)];
+
+  std::atomic<bool> Tracing{ false };
+  std::atomic<std::int64_t> EventBudget{ 0 };
+  mutable std::mutex Mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+  std::vector<FrameEvent> FrameEvents;
+};
+
+//Only usable inside LSystem, they go through its Profiler member
+#define LSYS_PROFILE_JOIN2(a, b) a##b
+#define LSYS_PROFILE_JOIN(a, b) LSYS_PROFILE_JOIN2(a, b)
+#define LSYS_PROFILE_SCOPE(phase) LightProfiler::Scope LSYS_PROFILE_JOIN(profileScope, __LINE__)(Profiler, LightProfilePhase::phase)
+#define LSYS_PROFILE_COUNT(counter, amount) Profiler.Add(LightProfileCounter::counter, (amount))
+#define LSYS_PROFILE_FRAME(frame) Profiler.BeginFrame(frame)
+
+#else
+
+#define LSYS_PROFILE_SCOPE(phase) ((void)0)
+//sizeof never evaluates its operand, it only keeps whatever the amount mentions from looking unused
+#define LSYS_PROFILE_COUNT(counter, amount) ((void)sizeof(amount))
+#define LSYS_PROFILE_FRAME(frame) ((void)0)
+
+#endif
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/*
+  4-wide float helpers for the CPU lighting paths
+
+  Uses SSE2 when the compiler targets it (always true on x64) and plain arrays otherwise, so the
+  kernels are written once. Comparisons return all-ones / all-zeros lanes, like the intrinsics do.
+*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LSYS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+struct SimdF4
+{
+#ifdef LSYS_SSE2
+  __m128 v;
+
+  static SimdF4 Load(const float *p) { return { _mm_loadu_ps(p) }; }
+  static SimdF4 Set1(float f) { return { _mm_set1_ps(f) }; }
+  static SimdF4 Set(float a, float b, float c, float d) { return { _mm_setr_ps(a, b, c, d) }; }
+  void Store(float *p) const { _mm_storeu_ps(p, v); }
+
+  friend SimdF4 operator+(SimdF4 a, SimdF4 b) { return { _mm_add_ps(a.v, b.v) }; }
+  friend SimdF4 operator-(SimdF4 a, SimdF4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+  friend SimdF4 operator*(SimdF4 a, SimdF4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+  friend SimdF4 operator/(SimdF4 a, SimdF4 b) { return { _mm_div_ps(a.v, b.v) }; }
+  friend SimdF4 operator&(SimdF4 a, SimdF4 b) { return { _mm_and_ps(a.v, b.v) }; }
+  friend SimdF4 operator|(SimdF4 a, SimdF4 b) { return { _mm_or_ps(a.v, b.v) }; }
+
+  static SimdF4 Min(SimdF4 a, SimdF4 b) { return { _mm_min_ps(a.v, b.v) }; }
+  static SimdF4 Max(SimdF4 a, SimdF4 b) { return { _mm_max_ps(a.v, b.v) }; }
+  static SimdF4 Sqrt(SimdF4 a) { return { _mm_sqrt_ps(a.v) }; }
+  static SimdF4 Greater(SimdF4 a, SimdF4 b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+  static SimdF4 GreaterEqual(SimdF4 a, SimdF4 b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+  static SimdF4 Less(SimdF4 a, SimdF4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+  static SimdF4 LessEqual(SimdF4 a, SimdF4 b) { return { _mm_cmple_ps(a.v, b.v) }; }
+  static SimdF4 AndNot(SimdF4 mask, SimdF4 a) { return { _mm_andnot_ps(mask.v, a.v) }; }
+
+  //mask ? a : b
+  static SimdF4 Select(SimdF4 mask, SimdF4 a, SimdF4 b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+  static int MoveMask(SimdF4 mask) { return _mm_movemask_ps(mask.v); }
+
+  //Nearest integer, for lanes well inside int range
+  static SimdF4 Round(SimdF4 a) { return { _mm_cvtepi32_ps(_mm_cvtps_epi32(a.v)) }; }
+
+  //a = mantissa * 2^exponent with the mantissa in [1, 2), for positive normal a
+  static SimdF4 Split(SimdF4 a, SimdF4 &exponent) {
+    const __m128i bits = _mm_castps_si128(a.v);
+    exponent.v = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    return { _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000))) };
+  }
+
+  //2^n for integral n in [-126, 127]
+  static SimdF4 Pow2(SimdF4 n) { return { _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127)), 23)) }; }
+#else
+  float v[4];
+
+  static SimdF4 Load(const float *p) { SimdF4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+  static SimdF4 Set1(float f) { return { { f, f, f, f } }; }
+  static SimdF4 Set(float a, float b, float c, float d) { return { { a, b, c, d } }; }
+  void Store(float *p) const { std::memcpy(p, v, sizeof(v)); }
+
+  friend SimdF4 operator+(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+  friend SimdF4 operator-(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+  friend SimdF4 operator*(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+  friend SimdF4 operator/(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] /= b.v[i]; return a; }
+  friend SimdF4 operator&(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = Bits(ToBits(a.v[i]) & ToBits(b.v[i])); return a; }
+  friend SimdF4 operator|(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = Bits(ToBits(a.v[i]) | ToBits(b.v[i])); return a; }
+
+  static SimdF4 Min(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }
+  static SimdF4 Max(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+  static SimdF4 Sqrt(SimdF4 a) { for (int i = 0; i < 4; ++i) a.v[i] = std::sqrt(a.v[i]); return a; }
+  static SimdF4 Greater(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = Mask(a.v[i] > b.v[i]); return a; }
+  static SimdF4 GreaterEqual(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = Mask(a.v[i] >= b.v[i]); return a; }
+  static SimdF4 Less(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = Mask(a.v[i] < b.v[i]); return a; }
+  static SimdF4 LessEqual(SimdF4 a, SimdF4 b) { for (int i = 0; i < 4; ++i) a.v[i] = Mask(a.v[i] <= b.v[i]); return a; }
+  static SimdF4 AndNot(SimdF4 mask, SimdF4 a) { for (int i = 0; i < 4; ++i) a.v[i] = Bits(~ToBits(mask.v[i]) & ToBits(a.v[i])); return a; }
+
+  static SimdF4 Select(SimdF4 mask, SimdF4 a, SimdF4 b) { return (mask & a) | AndNot(mask, b); }
+  static int MoveMask(SimdF4 mask) { int m = 0; for (int i = 0; i < 4; ++i) m |= (ToBits(mask.v[i]) >> 31) << i; return m; }
+
+  static SimdF4 Round(SimdF4 a) { for (int i = 0; i < 4; ++i) a.v[i] = std::floor(a.v[i] + 0.5f); return a; }
+  static SimdF4 Split(SimdF4 a, SimdF4 &exponent) {
+    for (int i = 0; i < 4; ++i) {
+      int e;
+      a.v[i] = 2.f * std::frexp(a.v[i], &e);
+      exponent.v[i] = static_cast<float>(e - 1);
+    }
+    return a;
+  }
+  static SimdF4 Pow2(SimdF4 n) { for (int i = 0; i < 4; ++i) n.v[i] = std::ldexp(1.f, static_cast<int>(n.v[i])); return n; }
+
+private:
+  static std::uint32_t ToBits(float f) { std::uint32_t u; std::memcpy(&u, &f, 4); return u; }
+  static float Bits(std::uint32_t u) { float f; std::memcpy(&f, &u, 4); return f; }
+  static float Mask(bool b) { return Bits(b ? 0xFFFFFFFFu : 0u); }
+#endif
+
+public:
+  //Natural log of positive normal lanes, to within a couple of float ulps (the cephes logf polynomial)
+  static SimdF4 Log(SimdF4 a) {
+    SimdF4 e;
+    SimdF4 m = Split(a, e);
+
+    //Keep the mantissa in [sqrt(1/2), sqrt(2)) so the polynomial only has to cover |f| < 0.42
+    const SimdF4 high = Greater(m, Set1(1.41421356f));
+    m = Select(high, m * Set1(0.5f), m);
+    e = e + (high & Set1(1.f));
+
+    const SimdF4 f = m - Set1(1.f);
+    const SimdF4 f2 = f * f;
+    SimdF4 p = Set1(7.0376836292e-2f);
+    p = p * f + Set1(-1.1514610310e-1f);
+    p = p * f + Set1(1.1676998740e-1f);
+    p = p * f + Set1(-1.2420140846e-1f);
+    p = p * f + Set1(1.4249322787e-1f);
+    p = p * f + Set1(-1.6668057665e-1f);
+    p = p * f + Set1(2.0000714765e-1f);
+    p = p * f + Set1(-2.4999993993e-1f);
+    p = p * f + Set1(3.3333331174e-1f);
+    const SimdF4 tail = p * f * f2 + e * Set1(-2.12194440e-4f) - f2 * Set1(0.5f);
+    return f + tail + e * Set1(0.693359375f);
+  }
+
+  //log(1 + a) for a >= 0, without losing the small lanes to the rounding of 1 + a
+  static SimdF4 Log1p(SimdF4 a) {
+    //Whatever rounding took off 1 + a goes back in to first order, which leaves an error of at most (1 + a) / 2^24
+    const SimdF4 one = Set1(1.f);
+    const SimdF4 u = a + one;
+    return Log(u) + (a - (u - one));
+  }
+
+  //e^a, lanes clamped to what a float can hold (the cephes expf polynomial)
+  static SimdF4 Exp(SimdF4 a) {
+    a = Min(Max(a, Set1(-87.3f)), Set1(88.3f));
+    const SimdF4 n = Round(a * Set1(1.44269504f));
+    const SimdF4 r = a - n * Set1(0.693359375f) - n * Set1(-2.12194440e-4f);
+
+    SimdF4 p = Set1(1.9875691500e-4f);
+    p = p * r + Set1(1.3981999507e-3f);
+    p = p * r + Set1(8.3334519073e-3f);
+    p = p * r + Set1(4.1665795894e-2f);
+    p = p * r + Set1(1.6666665459e-1f);
+    p = p * r + Set1(5.0000001201e-1f);
+    return (p * r * r + r + Set1(1.f)) * Pow2(n);
+  }
+};
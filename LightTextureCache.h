@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+//What LightTextureCache is holding on to, in bytes of RGBA8 texture memory
+struct LightTextureStats
+{
+  std::size_t FalloffTextures = 0; //Cached radial falloffs, shared between lights
+  std::size_t FalloffBytes = 0;
+  std::size_t FalloffShared = 0;   //Lights using a falloff another light made first
+  std::size_t LightMaps = 0;       //Pooled light map targets
+  std::size_t LightMapsInUse = 0;
+  std::size_t LightMapBytes = 0;
+  std::size_t TotalBytes = 0;
+  std::size_t Budget = 0;
+  std::size_t Evictions = 0;       //Unused textures freed to get back under budget
+  std::size_t OverBudget = 0;      //Times something had to be created past the budget because nothing was free to evict
+};
+
+/*
+  Every render target the OpenGL lights draw through
+
+  Falloffs: the radial gradient from SuperBright.fsh only depends on the light's attenuation and the color baked into it,
+  so lights with the same pair share one texture, just big enough for the attenuation circle. Lights keep a shared_ptr;
+  a falloff nobody holds any more stays cached (in case the light comes back) until the budget needs the room.
+
+  Light maps: only needed while a light is composited, so they're borrowed for that and handed straight back. Sizes are
+  rounded up to Granularity so lights of similar size reuse the same targets.
+
+  When creating something would go past the budget, unused textures are freed first, least recently used first. If that
+  isn't enough the texture is created anyway (a light has to draw through something) and counted in OverBudget.
+*/
+class LightTextureCache
+{
+public:
+  static constexpr unsigned Granularity = 64;
+
+  void SetBudget(std::size_t bytes) {
+    Budget = bytes;
+    Trim(0);
+  }
+
+  //draw(target, attenuation, color) renders the falloff into a freshly created, cleared target
+  template <typename Draw>
+  std::shared_ptr<sf::RenderTexture> GetFalloff(float attenuation, const sf::Color &color, Draw &&draw) {
+    const FalloffKey key{ std::lround(attenuation * 16.f), color.toInteger() };
+    auto found = Falloffs.find(key);
+    if (found != Falloffs.end()) {
+      found->second.LastUsed = ++Clock;
+      Shared++;
+      return found->second.Texture;
+    }
+
+    const unsigned size = FalloffSize(attenuation);
+    Trim(Bytes(size, size));
+
+    FalloffEntry entry;
+    entry.Texture = std::make_shared<sf::RenderTexture>();
+    entry.Texture->create(size, size);
+    entry.Texture->clear(sf::Color::Transparent);
+    draw(*entry.Texture, attenuation, color);
+    entry.Texture->display();
+    entry.LastUsed = ++Clock;
+    return Falloffs.emplace(key, std::move(entry)).first->second.Texture;
+  }
+
+  //Smallest texture that holds the attenuation circle, with a transparent border so clamped lookups past it stay dark
+  static unsigned FalloffSize(float attenuation) {
+    return 2 * static_cast<unsigned>(std::ceil(std::max(attenuation, 0.f))) + 2;
+  }
+
+  //A target at least width x height. Hand it back with ReleaseLightMap once whatever reads it has been drawn
+  sf::RenderTexture* AcquireLightMap(unsigned width, unsigned height) {
+    width = RoundUp(std::max(width, 1u));
+    height = RoundUp(std::max(height, 1u));
+
+    PooledTarget *best = nullptr;
+    for (auto & pooled : LightMaps) {
+      const sf::Vector2u size = pooled.Target->getSize();
+      if (pooled.InUse || size.x < width || size.y < height)
+        continue;
+      if (!best || Area(size) < Area(best->Target->getSize()))
+        best = &pooled;
+    }
+
+    if (!best) {
+      Trim(Bytes(width, height));
+      LightMaps.push_back({});
+      best = &LightMaps.back();
+      best->Target = std::make_unique<sf::RenderTexture>();
+      best->Target->create(width, height);
+    }
+
+    best->InUse = true;
+    best->LastUsed = ++Clock;
+    return best->Target.get();
+  }
+
+  void ReleaseLightMap(sf::RenderTexture *target) {
+    for (auto & pooled : LightMaps) {
+      if (pooled.Target.get() == target) {
+        pooled.InUse = false;
+        pooled.LastUsed = ++Clock;
+        return;
+      }
+    }
+  }
+
+  LightTextureStats GetStats() const {
+    LightTextureStats stats;
+    for (auto & falloff : Falloffs) {
+      stats.FalloffTextures++;
+      stats.FalloffBytes += Bytes(falloff.second.Texture->getSize());
+    }
+    for (auto & pooled : LightMaps) {
+      stats.LightMaps++;
+      stats.LightMapsInUse += pooled.InUse ? 1 : 0;
+      stats.LightMapBytes += Bytes(pooled.Target->getSize());
+    }
+    stats.FalloffShared = Shared;
+    stats.TotalBytes = stats.FalloffBytes + stats.LightMapBytes;
+    stats.Budget = Budget;
+    stats.Evictions = Evictions;
+    stats.OverBudget = OverBudget;
+    return stats;
+  }
+
+private:
+  using FalloffKey = std::pair<long, std::uint32_t>;
+
+  struct FalloffEntry
+  {
+    std::shared_ptr<sf::RenderTexture> Texture;
+    std::uint64_t LastUsed = 0;
+  };
+
+  struct PooledTarget
+  {
+    std::unique_ptr<sf::RenderTexture> Target;
+    bool InUse = false;
+    std::uint64_t LastUsed = 0;
+  };
+
+  static unsigned RoundUp(unsigned v) {
+    return (v + Granularity - 1) / Granularity * Granularity;
+  }
+
+  static std::size_t Area(const sf::Vector2u &size) {
+    return static_cast<std::size_t>(size.x) * size.y;
+  }
+
+  static std::size_t Bytes(unsigned width, unsigned height) {
+    return static_cast<std::size_t>(width) * height * 4;
+  }
+
+  static std::size_t Bytes(const sf::Vector2u &size) {
+    return Bytes(size.x, size.y);
+  }
+
+  std::size_t TotalBytes() const {
+    std::size_t total = 0;
+    for (auto & falloff : Falloffs)
+      total += Bytes(falloff.second.Texture->getSize());
+    for (auto & pooled : LightMaps)
+      total += Bytes(pooled.Target->getSize());
+    return total;
+  }
+
+  //Frees unused textures, oldest first, until incoming more bytes fit in the budget
+  void Trim(std::size_t incoming) {
+    std::size_t total = TotalBytes();
+    while (total + incoming > Budget) {
+      //Oldest falloff no light is holding, and oldest light map nobody borrowed
+      auto falloff = Falloffs.end();
+      for (auto it = Falloffs.begin(); it != Falloffs.end(); ++it) {
+        if (it->second.Texture.use_count() == 1 && (falloff == Falloffs.end() || it->second.LastUsed < falloff->second.LastUsed))
+          falloff = it;
+      }
+      auto map = LightMaps.end();
+      for (auto it = LightMaps.begin(); it != LightMaps.end(); ++it) {
+        if (!it->InUse && (map == LightMaps.end() || it->LastUsed < map->LastUsed))
+          map = it;
+      }
+
+      const bool takeFalloff = falloff != Falloffs.end() && (map == LightMaps.end() || falloff->second.LastUsed < map->LastUsed);
+      if (takeFalloff) {
+        total -= Bytes(falloff->second.Texture->getSize());
+        Falloffs.erase(falloff);
+      }
+      else if (map != LightMaps.end()) {
+        total -= Bytes(map->Target->getSize());
+        LightMaps.erase(map);
+      }
+      else {
+        if (incoming)
+          OverBudget++;
+        return;
+      }
+      Evictions++;
+    }
+  }
+
+  std::map<FalloffKey, FalloffEntry> Falloffs;
+  std::vector<PooledTarget> LightMaps;
+  std::uint64_t Clock = 0;
+  std::size_t Budget = 64 * 1024 * 1024;
+  std::size_t Shared = 0;
+  std::size_t Evictions = 0;
+  std::size_t OverBudget = 0;
+};
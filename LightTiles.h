@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+//A light as far as binning is concerned: nothing outside Radius of Center gets any of its light
+struct LightCircle
+{
+  sf::Vector2f Center;
+  float Radius = 0.f;
+};
+
+/*
+  Screen cut into TileSize x TileSize tiles, each with the list of lights whose circle touches it
+
+  Stored flat like EdgeGrid: TileStart[t] .. TileStart[t + 1] indexes into TileLights, which holds indices into the
+  circle list handed to Build. Each tile's list is in ascending light order, so anything that blends lights one after
+  the other gets the same result as walking every light.
+*/
+class LightTileGrid
+{
+public:
+  void Build(unsigned width, unsigned height, unsigned tileSize, const std::vector<LightCircle> &lights) {
+    Width = width;
+    Height = height;
+    TileSize = std::max(tileSize, 1u);
+    Columns = (width + TileSize - 1) / TileSize;
+    Rows = (height + TileSize - 1) / TileSize;
+    TileStart.assign(static_cast<std::size_t>(Columns) * Rows + 1, 0);
+    TileLights.clear();
+    if (Columns == 0 || Rows == 0)
+      return;
+
+    //Count, prefix sum, then fill. Going through the lights in order on the fill pass keeps every list sorted
+    for (std::uint32_t i = 0; i < lights.size(); ++i) {
+      ForEachTile(lights[i], [&](std::size_t tile) { TileStart[tile + 1]++; });
+    }
+
+    for (std::size_t t = 1; t < TileStart.size(); ++t)
+      TileStart[t] += TileStart[t - 1];
+
+    TileLights.resize(TileStart.back());
+    Fill.assign(TileStart.begin(), TileStart.end() - 1);
+    for (std::uint32_t i = 0; i < lights.size(); ++i) {
+      ForEachTile(lights[i], [&](std::size_t tile) { TileLights[Fill[tile]++] = i; });
+    }
+  }
+
+  unsigned GetTileSize() const { return TileSize; }
+  unsigned GetColumns() const { return Columns; }
+  unsigned GetRows() const { return Rows; }
+  unsigned GetWidth() const { return Width; }
+  unsigned GetHeight() const { return Height; }
+
+  std::size_t GetTileCount() const {
+    return static_cast<std::size_t>(Columns) * Rows;
+  }
+
+  //Sum of every tile's list, i.e. how many light/tile pairs a per-tile pass ends up shading
+  std::size_t GetEntryCount() const {
+    return TileLights.size();
+  }
+
+  const std::uint32_t* TileBegin(std::size_t tile) const {
+    return TileLights.data() + TileStart[tile];
+  }
+
+  const std::uint32_t* TileEnd(std::size_t tile) const {
+    return TileLights.data() + TileStart[tile + 1];
+  }
+
+  //Pixel bounds of a tile, clipped to the screen
+  sf::IntRect GetTileRect(std::size_t tile) const {
+    const unsigned x = static_cast<unsigned>(tile % Columns) * TileSize;
+    const unsigned y = static_cast<unsigned>(tile / Columns) * TileSize;
+    return { static_cast<int>(x), static_cast<int>(y), static_cast<int>(std::min(TileSize, Width - x)),
+             static_cast<int>(std::min(TileSize, Height - y)) };
+  }
+
+  //Same test Build uses: the closest point of the (clipped) tile is within the light's radius
+  static bool Touches(const LightCircle &light, float x0, float y0, float x1, float y1) {
+    const float cx = std::min(std::max(light.Center.x, x0), x1) - light.Center.x;
+    const float cy = std::min(std::max(light.Center.y, y0), y1) - light.Center.y;
+    return cx * cx + cy * cy <= light.Radius * light.Radius;
+  }
+
+private:
+  template <typename Visit>
+  void ForEachTile(const LightCircle &light, Visit &&visit) const {
+    if (!(light.Radius > 0.f))
+      return;
+
+    const int tx0 = std::max(ToTile(light.Center.x - light.Radius), 0);
+    const int ty0 = std::max(ToTile(light.Center.y - light.Radius), 0);
+    const int tx1 = std::min(ToTile(light.Center.x + light.Radius), static_cast<int>(Columns) - 1);
+    const int ty1 = std::min(ToTile(light.Center.y + light.Radius), static_cast<int>(Rows) - 1);
+
+    for (int y = ty0; y <= ty1; ++y) {
+      const float y0 = static_cast<float>(y * TileSize);
+      const float y1 = std::min(y0 + TileSize, static_cast<float>(Height));
+      for (int x = tx0; x <= tx1; ++x) {
+        const float x0 = static_cast<float>(x * TileSize);
+        const float x1 = std::min(x0 + TileSize, static_cast<float>(Width));
+        if (Touches(light, x0, y0, x1, y1))
+          visit(static_cast<std::size_t>(y) * Columns + x);
+      }
+    }
+  }
+
+  int ToTile(float v) const {
+    //Clamped before the cast so a light far off screen can't overflow it
+    const float t = std::floor(v / static_cast<float>(TileSize));
+    return static_cast<int>(std::min(std::max(t, -1.f), static_cast<float>(std::max(Columns, Rows))));
+  }
+
+  unsigned Width = 0;
+  unsigned Height = 0;
+  unsigned TileSize = 32;
+  unsigned Columns = 0;
+  unsigned Rows = 0;
+
+  std::vector<std::uint32_t> TileStart;
+  std::vector<std::uint32_t> TileLights;
+  std::vector<std::uint32_t> Fill;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  Small persistent worker pool for spreading per-light work across cores
+
+  Run(count, job) calls job(index, worker) once for every index in [0, count) and returns when they're all done.
+  The calling thread joins in as worker 0, so with a thread count of 1 (the default) nothing is ever spawned.
+  "worker" is always < GetThreadCount(), so callers can keep one scratch buffer per worker and never share them.
+*/
+class LightWorkerPool
+{
+public:
+  LightWorkerPool() = default;
+  LightWorkerPool(const LightWorkerPool &) = delete;
+  LightWorkerPool& operator=(const LightWorkerPool &) = delete;
+
+  ~LightWorkerPool() {
+    Stop();
+  }
+
+  //0 picks one worker per hardware thread
+  void SetThreadCount(unsigned count) {
+    if (count == 0)
+      count = std::max(1u, std::thread::hardware_concurrency());
+
+    if (count == GetThreadCount())
+      return;
+
+    Stop();
+    for (unsigned worker = 1; worker < count; ++worker)
+      Threads.emplace_back(&LightWorkerPool::WorkerLoop, this, worker);
+  }
+
+  unsigned GetThreadCount() const {
+    return static_cast<unsigned>(Threads.size()) + 1;
+  }
+
+  void Run(std::size_t count, const std::function<void(std::size_t, unsigned)> &job) {
+    if (Threads.empty() || count < 2) {
+      for (std::size_t i = 0; i < count; ++i)
+        job(i, 0);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Job = &job;
+      Count = count;
+      Next = 0;
+      Busy = static_cast<unsigned>(Threads.size());
+      ++Generation;
+    }
+    Wake.notify_all();
+
+    Work(0);
+
+    std::unique_lock<std::mutex> lock(Mutex);
+    Done.wait(lock, [this]() { return Busy == 0; });
+    Job = nullptr;
+  }
+
+private:
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Quit = true;
+    }
+    Wake.notify_all();
+
+    for (auto & thread : Threads)
+      thread.join();
+    Threads.clear();
+    Quit = false;
+  }
+
+  void WorkerLoop(unsigned worker) {
+    unsigned seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Wake.wait(lock, [&]() { return Quit || Generation != seen; });
+        if (Quit)
+          return;
+        seen = Generation;
+      }
+
+      Work(worker);
+
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (--Busy == 0)
+        Done.notify_one();
+    }
+  }
+
+  void Work(unsigned worker) {
+    for (;;) {
+      const std::size_t index = Next.fetch_add(1);
+      if (index >= Count)
+        return;
+      (*Job)(index, worker);
+    }
+  }
+
+  std::vector<std::thread> Threads;
+  std::mutex Mutex;
+  std::condition_variable Wake;
+  std::condition_variable Done;
+
+  const std::function<void(std::size_t, unsigned)> *Job = nullptr;
+  std::size_t Count = 0;
+  std::atomic<std::size_t> Next{ 0 };
+  unsigned Busy = 0;
+  unsigned Generation = 0;
+  bool Quit = false;
+};
@@ -0,0 +1,1272 @@
+/*
+  Headless benchmark for the lighting update
+
+  Build it instead of main.cpp (it has its own main). Everything runs on the Software backend, so no window or GL context
+  is created. Each scenario generates a scene, then times:
+
+    ingest    AddShadowCaster for every caster (or AddTileLayer for the walls) plus the first UpdateLights (edge preprocessing + grid build)
+    cull      the grid query and silhouette filter for every light, nothing else
+    light     UpdateLight for every light, serially
+    update    UpdateLights with every light dirty, on the configured number of threads
+    query     QueryVisibility for a batch of random points, on the configured number of threads
+    move      SetCasterTransform on every dynamic caster, then UpdateLights with the lights left where they are
+    load      LoadScene into a fresh system of the lights and static casters saved with SaveScene. Unlike ingest this
+              leaves out the first UpdateLights, which costs the same as any update with every light dirty
+    render    RenderSoftware of a 512 x 512 scene over an opaque background, composited as --composite says. The scene
+              starts at the view rect's top left with --view, at the world's otherwise
+
+  With --view, a WxH screen's worth of the world (divided by --zoom, in screen pixels per world unit) around the middle
+  of the world is handed to SetViewRect, and "culled" / "lod" count the lights it skipped and downgraded. "untiled" counts
+  the visible lights that reach the part of the world the render scene shows but that no screen tile lists, so they'd
+  be skipped when drawn. Anything but 0 makes the exit code 1.
+  With --cluster E the lights are clustered with SetClusterError(E), and "drawn" counts the cluster lights plus the lights
+  left on their own. The cull, light and query stages then go through those, like UpdateLights and the render calls do.
+  "allocs" is the heap allocations per update frame. Every scratch buffer has grown to size by then, so anything but 0 makes
+  the exit code 1.
+  "relit" is how many lights the move stage rebuilt per frame, i.e. how many the moved casters' bounds reached.
+  Besides timings, "miss %" is how many of the (point, light) pairs the edge test finds lit come out different in
+  QueryVisibility, as a percentage. Only the polar shadow map is approximate, the other modes are always 0.
+  In --mode penumbra, "soft err" is the mean difference between what the penumbra geometry leaves of a light and the
+  share of 64 copies of it spread over its --expand radius that can see the point, over (point, light) pairs in reach.
+  With --composite accumulate or accumulate16, "accum err" is the largest difference in any channel of any pixel between
+  the render and the same frame rendered with LightComposite::PerLight.
+
+  Usage:
+    LightingBenchmark [--lights N] [--radius R] [--density D] [--sides N] [--walls N] [--tile-layer 0|1] [--movers N]
+                      [--world W] [--view WxH] [--zoom Z] [--cluster E] [--expand R] [--intensity I]
+                      [--composite perlight|accumulate|accumulate16]
+                      [--mode quads|visibility|polar|penumbra] [--points N] [--threads N] [--frames N] [--seed N]
+                      [--json FILE] [--csv FILE] [--trace PREFIX] [--gl 0|1]
+
+  --trace only works in a build with LSYS_PROFILE defined. It writes a Chrome trace of each scenario's timed frames to
+  PREFIX<scenario>-<mode>.json.
+
+  With none of the scene options given, a fixed set of scenarios runs, so results can be compared between commits.
+
+  Before any scenario, ShadowExtrusion::Extrude is run against ExtrudeScalar on random batches, including counts that
+  leave a tail past the last full 4 or 8 wide step. Their output has to match bit for bit, or the benchmark exits with 1.
+  Both are then timed on one large batch.
+
+  Loops are then checked for lights inside them: rooms drawn as one closed caster have to keep their lights in, or the
+  benchmark exits with 1.
+
+  LightComposite::Accumulate is rendered against LightComposite::PerLight with 1 to 8 lights covering a small scene. An
+  RGBA8 light buffer further off than LightAccumulation::RoundingBound also makes the exit code 1.
+
+  After the timed stages every light is rebuilt once on 1 worker and once on max(--threads, 4), and "mt diff" counts
+  the lights whose LightVerts or Shadowverts don't match byte for byte. Anything but 0 also makes the exit code 1.
+
+  --gl 1 also checks LightTextureCache (falloff sharing, light map reuse, least recently used eviction under the budget)
+  through real render textures. That needs a GL context, so it's off by default. Mesa's llvmpipe under xvfb-run will do.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NewLightSystem.h"
+
+//Every heap allocation in the process goes through here, so a stage's allocation count is just the difference before and after
+static std::atomic<std::size_t> AllocationCount{ 0 };
+
+void* operator new(std::size_t size)
+{
+  AllocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+struct BenchmarkScenario
+{
+  std::string Name = "custom";
+  unsigned Lights = 64;
+  float Radius = 200.f;         //Attenuation of every light
+  float CasterDensity = 1.f;    //Casters per 100 x 100 pixels
+  unsigned EdgesPerCaster = 4;  //Sides of each (convex) caster
+  unsigned WallTiles = 0;       //32 pixel tiles laid out as walls, to give the edge preprocessing something to merge
+  bool TileLayer = false;       //Hand the walls over as one AddTileLayer grid instead of a caster per tile
+  unsigned Movers = 0;          //Dynamic casters (AddDynamicCaster) on top of the static ones, all moved every move frame
+  float WorldSize = 2048.f;
+  sf::Vector2f View;            //Screen size for SetViewRect, 0 x 0 for no view rect
+  float Zoom = 1.f;             //Screen pixels per world unit
+  float ClusterError = 0.f;     //SetClusterError, 0 to draw every light on its own
+  float Expand = 0.f;           //Light::Expand of every light, what ShadowMode::Penumbra softens with
+  float Intensity = 1.f;        //Of every (white) light. At 1 a light alone already saturates most of what it reaches
+  LightComposite Composite = LightComposite::PerLight;
+  LightBufferPrecision Precision = LightBufferPrecision::RGBA8; //Light buffer under LightComposite::Accumulate
+  unsigned Points = 16384;      //Points handed to QueryVisibility
+  ShadowMode Mode = ShadowMode::EdgeQuads;
+  unsigned Threads = 1;
+  unsigned Frames = 30;
+  unsigned Seed = 1;
+};
+
+struct BenchmarkResult
+{
+  BenchmarkScenario Scenario;
+  std::size_t Casters = 0;
+  std::size_t RawEdges = 0;        //Edges handed to AddShadowCaster
+  std::size_t WorldEdges = 0;      //Edges left after preprocessing
+  std::size_t CandidateEdges = 0;  //Summed over every light, per frame
+  std::size_t BackFacingEdges = 0;
+  std::size_t Triangles = 0;       //Light + shadow triangles emitted per frame
+  double IngestMs = 0.0;
+  double SceneLoadMs = 0.0;        //LoadScene of the saved lights and static casters
+  double CullMs = 0.0;
+  double LightMs = 0.0;
+  double UpdateMs = 0.0;
+  double UpdateNsPerEdge = 0.0;
+  double UpdateAllocationsPerFrame = 0.0;
+  std::size_t IngestAllocations = 0;
+  std::size_t LitPairs = 0;        //(point, light) pairs the query found lit
+  std::size_t MismatchedPairs = 0; //Pairs where that differs from the exact edge test
+  double MismatchPercent = 0.0;
+  double QueryMs = 0.0;
+  double QueryNsPerPoint = 0.0;
+  double MoveMs = 0.0;
+  double RelitLights = 0.0;        //Lights rebuilt per move frame
+  std::size_t CulledLights = 0;    //Lights outside the view rect
+  std::size_t LodLights = 0;       //Lights drawn unshadowed
+  std::size_t DrawnLights = 0;     //Cluster lights plus unclustered lights
+  double PenumbraError = 0.0;      //Mean difference from the sampled reference, ShadowMode::Penumbra only
+  double RenderMs = 0.0;
+  std::size_t UntiledLights = 0;   //Visible lights on screen that no screen tile lists
+  double CompositeError = 0.0;     //Largest difference from the LightComposite::PerLight render, Accumulate only
+  std::size_t ParallelMismatches = 0; //Lights whose geometry came out different on 1 worker and on several
+};
+
+//Reaches into LSystem's internals to time the stages UpdateLights strings together
+class BenchmarkSystem : public LSystem
+{
+public:
+  BenchmarkSystem()
+    : LSystem(LightBackend::Software)
+  { }
+
+  void CullAllLights() {
+    ForEachDrawnLight([this](Light &light) { GatherCasterEdges(light, BenchScratch); });
+  }
+
+  //Every drawn light, view rect or not. Occluders are kept like RunLightUpdates keeps them, so QueryExact sees the same edges
+  void UpdateAllLights() {
+    ForEachDrawnLight([this](Light &light) {
+      UpdateLight(light, BenchScratch);
+      light.Occluders = BenchScratch.Batch;
+    });
+  }
+
+  std::size_t CountTriangles() {
+    std::size_t triangles = 0;
+    ForEachDrawnLight([&](Light &light) {
+      triangles += light.LightVerts.GetTriangleCount() + light.Shadowverts.GetTriangleCount();
+    });
+    return triangles;
+  }
+
+  //Visible lights whose circle reaches the world under a width x height scene (worked out from the view rect, not the tiles)
+  //but that no screen tile lists
+  std::size_t CountUntiledLights(unsigned width, unsigned height) {
+    BuildScreenTiles(width, height, SoftwareLightRenderer::TileSize);
+    std::vector<std::uint8_t> tiled(DrawLights.size(), 0);
+    for (std::size_t tile = 0; tile < ScreenTiles.GetTileCount(); ++tile) {
+      for (const std::uint32_t *it = ScreenTiles.TileBegin(tile); it != ScreenTiles.TileEnd(tile); ++it)
+        tiled[*it] = 1;
+    }
+
+    const sf::Vector2f min = HasView ? sf::Vector2f(View.left, View.top) : sf::Vector2f();
+    const sf::Vector2f max = min + sf::Vector2f(static_cast<float>(width), static_cast<float>(height)) / ScreenScale();
+    std::size_t untiled = 0;
+    for (std::size_t i = 0; i < DrawLights.size(); ++i) {
+      const Light &light = *DrawLights[i];
+      if (light.Visible && !tiled[i] && CircleTouchesBox(light.Position, light.Attenuation, min, max))
+        ++untiled;
+    }
+    return untiled;
+  }
+
+  std::size_t CountWorldEdges() const {
+    return WorldEdges.Size();
+  }
+
+  //QueryVisibility against every light's occluders, whatever the shadow mode, as the reference for the polar map
+  void QueryExact(const std::vector<sf::Vector2f> &points, PointVisibilityResult &out) {
+    ExactLights.clear();
+    ForEachDrawnLight([this](Light &light) {
+      ExactLights.push_back({ light.Position, light.Attenuation, light.Intensity, &light.Occluders });
+    });
+    ExactQuery.Run(points, ExactLights, Workers, out);
+  }
+
+  /*
+    Mean difference between PenumbraReference's two answers, over (point, light) pairs where the point is inside the
+    light's radius, stopping after maxPairs. Both look at the edges the light was last shadowed with
+  */
+  double PenumbraError(const std::vector<sf::Vector2f> &points, unsigned samples, std::size_t maxPairs) {
+    double error = 0.0;
+    std::size_t pairs = 0;
+    ForEachDrawnLight([&](Light &light) {
+      if (light.Lod != LightLod::Full)
+        return;
+
+      for (auto & point : points) {
+        const sf::Vector2f d = point - light.Position;
+        if (pairs == maxPairs || d.x * d.x + d.y * d.y > light.Attenuation * light.Attenuation)
+          continue;
+
+        const float sampled = PenumbraReference::SampleVisibility(light.Occluders, light.Position, light.Expand, point, samples);
+        error += std::abs(PenumbraReference::MeshVisibility(light.Shadowverts, point) - sampled);
+        ++pairs;
+      }
+    });
+    return pairs ? error / pairs : 0.0;
+  }
+
+  //Every drawn light rebuilt by UpdateLights on threads workers, then its geometry copied out byte for byte
+  void RebuildAll(unsigned threads, std::vector<std::vector<unsigned char>> &geometry) {
+    SetUpdateThreads(threads);
+    ForEachDrawnLight([](Light &light) { light.Dirty = true; });
+    UpdateLights();
+    FinishUpdate();
+
+    geometry.clear();
+    ForEachDrawnLight([&](Light &light) {
+      geometry.emplace_back();
+      for (const LightMesh *mesh : { &light.LightVerts, &light.Shadowverts }) {
+        const unsigned char *vertices = reinterpret_cast<const unsigned char*>(mesh->Vertices.data());
+        const unsigned char *indices = reinterpret_cast<const unsigned char*>(mesh->Indices.data());
+        geometry.back().insert(geometry.back().end(), vertices, vertices + mesh->Vertices.size() * sizeof(sf::Vertex));
+        geometry.back().insert(geometry.back().end(), indices, indices + mesh->Indices.size() * sizeof(std::uint32_t));
+      }
+    });
+  }
+
+private:
+  LightUpdateScratch BenchScratch;
+  PointVisibilityQuery ExactQuery;
+  std::vector<VisibilityQueryLight> ExactLights;
+};
+
+using BenchClock = std::chrono::steady_clock;
+
+static double Milliseconds(BenchClock::time_point start, BenchClock::time_point end)
+{
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static double Median(std::vector<double> samples)
+{
+  if (samples.empty())
+    return 0.0;
+
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+//Convex, roughly regular polygon, wound clockwise on screen
+static std::vector<Edge> MakeCaster(std::mt19937 &rng, const sf::Vector2f &center, unsigned sides)
+{
+  std::uniform_real_distribution<float> size(8.f, 40.f);
+  std::uniform_real_distribution<float> turn(0.f, 6.2831853f);
+
+  const float radius = size(rng);
+  const float rotation = turn(rng);
+  sides = std::max(sides, 3u);
+
+  std::vector<Edge> edges(sides);
+  for (unsigned i = 0; i < sides; ++i) {
+    const float a0 = rotation + 6.2831853f * i / sides;
+    const float a1 = rotation + 6.2831853f * (i + 1) / sides;
+    edges[i].Start = center + sf::Vector2f(std::cos(a0), std::sin(a0)) * radius;
+    edges[i].End = center + sf::Vector2f(std::cos(a1), std::sin(a1)) * radius;
+  }
+  return edges;
+}
+
+static std::vector<Edge> MakeTile(float x, float y)
+{
+  const float s = 32.f;
+  return { { { x, y }, { x + s, y } }, { { x + s, y }, { x + s, y + s } }, { { x + s, y + s }, { x, y + s } }, { { x, y + s }, { x, y } } };
+}
+
+static void GenerateScene(const BenchmarkScenario &scenario, std::vector<std::vector<Edge>> &casters, std::vector<std::uint8_t> &tiles,
+                          std::vector<sf::Vector2f> &lights, std::vector<sf::Vector2f> &points,
+                          std::vector<std::vector<Edge>> &movers, std::vector<sf::Vector2f> &moverPositions)
+{
+  std::mt19937 rng(scenario.Seed);
+  std::uniform_real_distribution<float> coord(0.f, scenario.WorldSize);
+
+  const std::size_t count = static_cast<std::size_t>(scenario.CasterDensity * (scenario.WorldSize / 100.f) * (scenario.WorldSize / 100.f));
+  for (std::size_t i = 0; i < count; ++i)
+    casters.push_back(MakeCaster(rng, { coord(rng), coord(rng) }, scenario.EdgesPerCaster));
+
+  //Straight runs of tiles, horizontal or vertical, snapped to the tile grid
+  const int side = std::max(1, static_cast<int>(scenario.WorldSize / 32.f));
+  std::uniform_int_distribution<int> cells(0, side - 1);
+  std::uniform_int_distribution<int> length(4, 24);
+  tiles.assign(static_cast<std::size_t>(side) * side, 0);
+  unsigned placed = 0;
+  while (placed < scenario.WallTiles) {
+    const int x = cells(rng), y = cells(rng), run = length(rng);
+    const bool horizontal = (rng() & 1) != 0;
+    for (int i = 0; i < run && placed < scenario.WallTiles; ++i, ++placed) {
+      const int tx = horizontal ? x + i : x, ty = horizontal ? y : y + i;
+      if (scenario.TileLayer && tx < side && ty < side)
+        tiles[static_cast<std::size_t>(ty) * side + tx] = 1;
+      else if (!scenario.TileLayer)
+        casters.push_back(MakeTile(32.f * tx, 32.f * ty));
+    }
+  }
+
+  for (unsigned i = 0; i < scenario.Lights; ++i)
+    lights.push_back({ coord(rng), coord(rng) });
+
+  for (unsigned i = 0; i < scenario.Points; ++i)
+    points.push_back({ coord(rng), coord(rng) });
+
+  //Last, so scenes without movers come out the same as before. Edges are around the mover's own origin
+  for (unsigned i = 0; i < scenario.Movers; ++i) {
+    movers.push_back(MakeCaster(rng, {}, scenario.EdgesPerCaster));
+    moverPositions.push_back({ coord(rng), coord(rng) });
+  }
+}
+
+static const char* ModeName(ShadowMode mode);
+
+static BenchmarkResult RunScenario(const BenchmarkScenario &scenario, const std::string &trace)
+{
+  BenchmarkResult result;
+  result.Scenario = scenario;
+
+  std::vector<std::vector<Edge>> casters;
+  std::vector<sf::Vector2f> positions;
+  std::vector<sf::Vector2f> points;
+  std::vector<std::uint8_t> tiles;
+  std::vector<std::vector<Edge>> movers;
+  std::vector<sf::Vector2f> moverPositions;
+  GenerateScene(scenario, casters, tiles, positions, points, movers, moverPositions);
+
+  BenchmarkSystem system;
+  system.SetShadowMode(scenario.Mode);
+  system.SetCasterGridCellSize(scenario.Radius);
+  system.SetUpdateThreads(scenario.Threads);
+  if (scenario.View.x > 0.f && scenario.View.y > 0.f) {
+    const sf::Vector2f size = scenario.View / scenario.Zoom;
+    const sf::Vector2f center(scenario.WorldSize / 2.f, scenario.WorldSize / 2.f);
+    system.SetViewRect(sf::FloatRect(center - size / 2.f, size), scenario.Zoom);
+  }
+  system.SetClusterError(scenario.ClusterError);
+
+  std::vector<LightHandle> lights;
+  for (auto & position : positions)
+    lights.push_back(system.AddLight(position, scenario.Intensity, sf::Color::White, scenario.Radius, scenario.Expand, scenario.Radius));
+
+  result.Casters = casters.size() + movers.size();
+  for (auto & caster : casters)
+    result.RawEdges += caster.size();
+  for (auto & mover : movers)
+    result.RawEdges += mover.size();
+
+  std::size_t allocations = AllocationCount.load();
+  auto start = BenchClock::now();
+  for (auto & caster : casters)
+    system.AddShadowCaster(caster);
+  if (scenario.TileLayer) {
+    const unsigned side = static_cast<unsigned>(std::sqrt(static_cast<double>(tiles.size())));
+    system.AddTileLayer(tiles, side, side, 32.f);
+  }
+  std::vector<DynamicCasterHandle> dynamic;
+  for (std::size_t i = 0; i < movers.size(); ++i)
+    dynamic.push_back(system.AddDynamicCaster(movers[i], sf::Transform().translate(moverPositions[i])));
+  system.UpdateLights();
+  result.IngestMs = Milliseconds(start, BenchClock::now());
+  result.IngestAllocations = AllocationCount.load() - allocations;
+  result.WorldEdges = system.CountWorldEdges();
+
+  //The same lights and static casters again, saved as a scene file and mapped into a fresh system
+  const std::string scenePath = "LightingBenchmark.scene";
+  if (system.SaveScene(scenePath)) {
+    LSystem loaded(LightBackend::Software);
+    start = BenchClock::now();
+    loaded.LoadScene(scenePath);
+    result.SceneLoadMs = Milliseconds(start, BenchClock::now());
+  }
+  std::remove(scenePath.c_str());
+
+  //Nudge every light back and forth, so they all rebuild every frame but the scene stays the same
+  auto nudge = [&](unsigned frame) {
+    for (std::size_t i = 0; i < lights.size(); ++i)
+      system.MoveLight(lights[i], positions[i] + sf::Vector2f((frame & 1) ? 0.5f : 0.f, 0.f));
+  };
+
+  //Untimed passes over both positions, so every scratch buffer and mesh has grown to size
+  system.CullAllLights();
+  system.UpdateAllLights();
+  for (unsigned frame = 0; frame < 2; ++frame) {
+    nudge(frame + 1);
+    system.UpdateLights();
+  }
+
+#ifdef LSYS_PROFILE
+  if (!trace.empty())
+    system.StartProfileTrace();
+#else
+  (void)trace;
+#endif
+
+  std::vector<double> cull, light, update;
+  cull.reserve(scenario.Frames);
+  light.reserve(scenario.Frames);
+  update.reserve(scenario.Frames);
+  std::size_t updateAllocations = 0;
+  for (unsigned frame = 0; frame < scenario.Frames; ++frame) {
+    start = BenchClock::now();
+    system.CullAllLights();
+    cull.push_back(Milliseconds(start, BenchClock::now()));
+
+    start = BenchClock::now();
+    system.UpdateAllLights();
+    light.push_back(Milliseconds(start, BenchClock::now()));
+
+    nudge(frame);
+    allocations = AllocationCount.load();
+    start = BenchClock::now();
+    system.UpdateLights();
+    const auto end = BenchClock::now();
+    updateAllocations += AllocationCount.load() - allocations;
+    update.push_back(Milliseconds(start, end));
+  }
+
+  PointVisibilityResult visibility;
+  system.QueryVisibility(points, visibility);
+  std::vector<double> query;
+  query.reserve(scenario.Frames);
+  for (unsigned frame = 0; frame < scenario.Frames; ++frame) {
+    start = BenchClock::now();
+    system.QueryVisibility(points, visibility);
+    query.push_back(Milliseconds(start, BenchClock::now()));
+  }
+  for (auto word : visibility.LitBy)
+    result.LitPairs += std::bitset<64>(word).count();
+
+  PointVisibilityResult exact;
+  std::size_t exactPairs = 0;
+  system.QueryExact(points, exact);
+  for (std::size_t i = 0; i < exact.LitBy.size(); ++i) {
+    exactPairs += std::bitset<64>(exact.LitBy[i]).count();
+    result.MismatchedPairs += std::bitset<64>(exact.LitBy[i] ^ visibility.LitBy[i]).count();
+  }
+  result.MismatchPercent = exactPairs ? 100.0 * result.MismatchedPairs / exactPairs : 0.0;
+
+  result.CulledLights = system.GetViewStats().Culled;
+  result.LodLights = system.GetViewStats().Downgraded;
+  result.DrawnLights = system.GetClusterStats().DrawnLights;
+  if (scenario.Mode == ShadowMode::Penumbra)
+    result.PenumbraError = system.PenumbraError(points, 64, 4096);
+
+  //Opaque, and dark enough that most pixels don't end up clamped, so the two composites have something to disagree on
+  SoftwareLightTarget scene;
+  scene.Create(512, 512);
+  for (unsigned y = 0; y < scene.Height; ++y) {
+    for (unsigned x = 0; x < scene.Width; ++x) {
+      float *pixel = &scene.Pixels[(static_cast<std::size_t>(y) * scene.Width + x) * 4];
+      pixel[0] = 0.5f * x / scene.Width;
+      pixel[1] = 0.5f * y / scene.Height;
+      pixel[2] = 0.1f;
+      pixel[3] = 1.f;
+    }
+  }
+
+  system.SetLightComposite(scenario.Composite, scenario.Precision);
+  SoftwareLightTarget rendered;
+  std::vector<double> render;
+  render.reserve(scenario.Frames);
+  for (unsigned frame = 0; frame < scenario.Frames; ++frame) {
+    rendered = scene;
+    start = BenchClock::now();
+    system.RenderSoftware(rendered);
+    render.push_back(Milliseconds(start, BenchClock::now()));
+  }
+  result.RenderMs = Median(render);
+  result.UntiledLights = system.CountUntiledLights(scene.Width, scene.Height);
+
+  if (scenario.Composite != LightComposite::PerLight) {
+    SoftwareLightTarget reference = scene;
+    system.SetLightComposite(LightComposite::PerLight);
+    system.RenderSoftware(reference);
+    for (std::size_t i = 0; i < reference.Pixels.size(); ++i)
+      result.CompositeError = std::max(result.CompositeError, static_cast<double>(std::abs(rendered.Pixels[i] - reference.Pixels[i])));
+  }
+
+  const CasterCullStats &stats = system.GetCullStats();
+  result.CandidateEdges = stats.CandidateEdges;
+  result.BackFacingEdges = stats.BackFacingEdges;
+  result.Triangles = system.CountTriangles();
+  result.CullMs = Median(cull);
+  result.LightMs = Median(light);
+  result.UpdateMs = Median(update);
+  result.UpdateNsPerEdge = stats.CandidateEdges ? result.UpdateMs * 1e6 / stats.CandidateEdges : 0.0;
+  result.UpdateAllocationsPerFrame = static_cast<double>(updateAllocations) / scenario.Frames;
+  result.QueryMs = Median(query);
+  result.QueryNsPerPoint = points.empty() ? 0.0 : result.QueryMs * 1e6 / points.size();
+
+  //Every mover drifts and spins a little each frame, the lights stay put
+  if (!dynamic.empty()) {
+    std::vector<double> move;
+    move.reserve(scenario.Frames);
+    std::size_t relit = 0;
+    for (unsigned frame = 0; frame < scenario.Frames; ++frame) {
+      start = BenchClock::now();
+      for (std::size_t i = 0; i < dynamic.size(); ++i) {
+        const float t = static_cast<float>(frame + 1);
+        system.SetCasterTransform(dynamic[i], sf::Transform().translate(moverPositions[i] + sf::Vector2f(t, 0.5f * t)).rotate(3.f * t));
+      }
+      system.UpdateLights();
+      move.push_back(Milliseconds(start, BenchClock::now()));
+      relit += system.GetCullStats().Lights;
+    }
+    result.MoveMs = Median(move);
+    result.RelitLights = static_cast<double>(relit) / scenario.Frames;
+  }
+
+  //The same frame built serially and in parallel has to come out identical
+  std::vector<std::vector<unsigned char>> serial, parallel;
+  system.RebuildAll(1, serial);
+  system.RebuildAll(std::max(scenario.Threads, 4u), parallel);
+  system.SetUpdateThreads(scenario.Threads);
+  for (std::size_t i = 0; i < serial.size(); ++i) {
+    if (i >= parallel.size() || serial[i] != parallel[i])
+      ++result.ParallelMismatches;
+  }
+
+#ifdef LSYS_PROFILE
+  const std::string path = trace + scenario.Name + "-" + ModeName(scenario.Mode) + ".json";
+  if (!trace.empty() && !system.WriteProfileTrace(path))
+    std::fprintf(stderr, "Couldn't write %s\n", path.c_str());
+#endif
+  return result;
+}
+
+static const char* ModeName(ShadowMode mode)
+{
+  switch (mode) {
+    case ShadowMode::VisibilityPolygon: return "visibility";
+    case ShadowMode::PolarMap:          return "polar";
+    case ShadowMode::Penumbra:          return "penumbra";
+    default:                            return "quads";
+  }
+}
+
+static const char* CompositeName(LightComposite composite, LightBufferPrecision precision)
+{
+  if (composite == LightComposite::PerLight)
+    return "perlight";
+  return precision == LightBufferPrecision::Float16 ? "accumulate16" : "accumulate";
+}
+
+/*
+  One column of the results. The table and the JSON and CSV files are all written from ResultFields, so a new column is
+  one entry there. Numbers get Decimals digits after the point, or %g when Decimals is negative.
+*/
+struct BenchmarkField
+{
+  const char *Key;    //JSON key and CSV column
+  const char *Header; //Table column, nullptr to leave it out of the table
+  int Width;          //Table column width, negative to left align
+  int Decimals;
+  std::function<double(const BenchmarkResult&)> Number;
+  std::function<std::string(const BenchmarkResult&)> Text; //Instead of Number
+  bool Flag;          //Number is 0 or 1, written as true/false in JSON
+};
+
+static BenchmarkField TextField(const char *key, const char *header, int width, std::function<std::string(const BenchmarkResult&)> text)
+{
+  return { key, header, width, 0, nullptr, std::move(text), false };
+}
+
+static BenchmarkField NumberField(const char *key, const char *header, int width, int decimals, std::function<double(const BenchmarkResult&)> number)
+{
+  return { key, header, width, decimals, std::move(number), nullptr, false };
+}
+
+static BenchmarkField FlagField(const char *key, std::function<double(const BenchmarkResult&)> flag)
+{
+  return { key, nullptr, 0, 0, std::move(flag), nullptr, true };
+}
+
+static const std::vector<BenchmarkField>& ResultFields()
+{
+  using R = const BenchmarkResult &;
+  static const std::vector<BenchmarkField> fields = {
+    TextField("scenario", "scenario", -18, [](R r) { return r.Scenario.Name; }),
+    TextField("mode", "mode", -10, [](R r) { return std::string(ModeName(r.Scenario.Mode)); }),
+    NumberField("lights", "lights", 7, 0, [](R r) { return r.Scenario.Lights; }),
+    NumberField("radius", nullptr, 0, -1, [](R r) { return r.Scenario.Radius; }),
+    NumberField("density", nullptr, 0, -1, [](R r) { return r.Scenario.CasterDensity; }),
+    NumberField("sides", nullptr, 0, 0, [](R r) { return r.Scenario.EdgesPerCaster; }),
+    NumberField("wall_tiles", nullptr, 0, 0, [](R r) { return r.Scenario.WallTiles; }),
+    FlagField("tile_layer", [](R r) { return r.Scenario.TileLayer; }),
+    NumberField("movers", nullptr, 0, 0, [](R r) { return r.Scenario.Movers; }),
+    NumberField("world", nullptr, 0, -1, [](R r) { return r.Scenario.WorldSize; }),
+    NumberField("view_width", nullptr, 0, -1, [](R r) { return r.Scenario.View.x; }),
+    NumberField("view_height", nullptr, 0, -1, [](R r) { return r.Scenario.View.y; }),
+    NumberField("zoom", nullptr, 0, -1, [](R r) { return r.Scenario.Zoom; }),
+    NumberField("cluster_error", nullptr, 0, -1, [](R r) { return r.Scenario.ClusterError; }),
+    NumberField("expand", nullptr, 0, -1, [](R r) { return r.Scenario.Expand; }),
+    NumberField("intensity", nullptr, 0, -1, [](R r) { return r.Scenario.Intensity; }),
+    TextField("composite", nullptr, 0, [](R r) { return std::string(CompositeName(r.Scenario.Composite, r.Scenario.Precision)); }),
+    NumberField("threads", nullptr, 0, 0, [](R r) { return r.Scenario.Threads; }),
+    NumberField("frames", nullptr, 0, 0, [](R r) { return r.Scenario.Frames; }),
+    NumberField("seed", nullptr, 0, 0, [](R r) { return r.Scenario.Seed; }),
+    NumberField("casters", nullptr, 0, 0, [](R r) { return r.Casters; }),
+    NumberField("raw_edges", "edges", 8, 0, [](R r) { return r.RawEdges; }),
+    NumberField("world_edges", "world", 8, 0, [](R r) { return r.WorldEdges; }),
+    NumberField("candidate_edges", "cand", 9, 0, [](R r) { return r.CandidateEdges; }),
+    NumberField("back_facing_edges", nullptr, 0, 0, [](R r) { return r.BackFacingEdges; }),
+    NumberField("triangles", "tris", 9, 0, [](R r) { return r.Triangles; }),
+    NumberField("ingest_ms", nullptr, 0, 4, [](R r) { return r.IngestMs; }),
+    NumberField("ingest_allocations", nullptr, 0, 0, [](R r) { return r.IngestAllocations; }),
+    NumberField("scene_load_ms", "load ms", 9, 4, [](R r) { return r.SceneLoadMs; }),
+    NumberField("cull_ms", "cull ms", 9, 4, [](R r) { return r.CullMs; }),
+    NumberField("light_ms", "light ms", 9, 4, [](R r) { return r.LightMs; }),
+    NumberField("update_ms", "update ms", 9, 4, [](R r) { return r.UpdateMs; }),
+    NumberField("update_ns_per_edge", "ns/edge", 9, 3, [](R r) { return r.UpdateNsPerEdge; }),
+    NumberField("update_allocations_per_frame", "allocs", 8, 2, [](R r) { return r.UpdateAllocationsPerFrame; }),
+    NumberField("points", nullptr, 0, 0, [](R r) { return r.Scenario.Points; }),
+    NumberField("lit_pairs", nullptr, 0, 0, [](R r) { return r.LitPairs; }),
+    NumberField("query_ms", "query ms", 9, 4, [](R r) { return r.QueryMs; }),
+    NumberField("query_ns_per_point", "ns/point", 9, 2, [](R r) { return r.QueryNsPerPoint; }),
+    NumberField("mismatched_pairs", nullptr, 0, 0, [](R r) { return r.MismatchedPairs; }),
+    NumberField("mismatch_percent", "miss %", 8, 4, [](R r) { return r.MismatchPercent; }),
+    NumberField("move_ms", "move ms", 9, 4, [](R r) { return r.MoveMs; }),
+    NumberField("relit_lights", "relit", 7, 2, [](R r) { return r.RelitLights; }),
+    NumberField("culled_lights", "culled", 7, 0, [](R r) { return r.CulledLights; }),
+    NumberField("lod_lights", "lod", 7, 0, [](R r) { return r.LodLights; }),
+    NumberField("drawn_lights", "drawn", 7, 0, [](R r) { return r.DrawnLights; }),
+    NumberField("penumbra_error", "soft err", 9, 5, [](R r) { return r.PenumbraError; }),
+    NumberField("render_ms", "render ms", 9, 4, [](R r) { return r.RenderMs; }),
+    NumberField("untiled_lights", "untiled", 8, 0, [](R r) { return r.UntiledLights; }),
+    NumberField("composite_error", "accum err", 9, 6, [](R r) { return r.CompositeError; }),
+    NumberField("parallel_mismatches", "mt diff", 7, 0, [](R r) { return r.ParallelMismatches; })
+  };
+  return fields;
+}
+
+//A field's value as it goes into the JSON and CSV files, or into the table when width isn't 0
+static std::string FormatField(const BenchmarkField &field, const BenchmarkResult &result, int width = 0, bool json = false)
+{
+  char buffer[128];
+  if (field.Text) {
+    const std::string text = field.Text(result);
+    if (json)
+      return "\"" + text + "\"";
+    std::snprintf(buffer, sizeof(buffer), "%*s", width, text.c_str());
+  }
+  else if (field.Flag)
+    std::snprintf(buffer, sizeof(buffer), "%s", field.Number(result) != 0.0 ? (json ? "true" : "1") : (json ? "false" : "0"));
+  else if (field.Decimals < 0)
+    std::snprintf(buffer, sizeof(buffer), "%*g", width, field.Number(result));
+  else
+    std::snprintf(buffer, sizeof(buffer), "%*.*f", width, field.Decimals, field.Number(result));
+  return buffer;
+}
+
+static void PrintTable(const std::vector<BenchmarkResult> &results)
+{
+  std::string header;
+  for (auto & field : ResultFields()) {
+    if (!field.Header)
+      continue;
+    char cell[64];
+    std::snprintf(cell, sizeof(cell), "%s%*s", header.empty() ? "" : " ", field.Width, field.Header);
+    header += cell;
+  }
+  std::printf("%s\n", header.c_str());
+
+  for (auto & r : results) {
+    std::string row;
+    for (auto & field : ResultFields()) {
+      if (field.Header)
+        row += (row.empty() ? "" : " ") + FormatField(field, r, field.Width);
+    }
+    std::printf("%s\n", row.c_str());
+  }
+}
+
+static bool WriteJson(const std::string &path, const std::vector<BenchmarkResult> &results)
+{
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  std::fprintf(file, "{\n  \"benchmark\": \"lighting\",\n  \"results\": [\n");
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    std::string row;
+    for (auto & field : ResultFields())
+      row += std::string(row.empty() ? "{" : ", ") + "\"" + field.Key + "\": " + FormatField(field, results[i], 0, true);
+    std::fprintf(file, "    %s}%s\n", row.c_str(), i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(file, "  ]\n}\n");
+  std::fclose(file);
+  return true;
+}
+
+static bool WriteCsv(const std::string &path, const std::vector<BenchmarkResult> &results)
+{
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  std::string header;
+  for (auto & field : ResultFields())
+    header += std::string(header.empty() ? "" : ",") + field.Key;
+  std::fprintf(file, "%s\n", header.c_str());
+
+  for (auto & r : results) {
+    std::string row;
+    for (auto & field : ResultFields())
+      row += (row.empty() ? "" : ",") + FormatField(field, r);
+    std::fprintf(file, "%s\n", row.c_str());
+  }
+  std::fclose(file);
+  return true;
+}
+
+/*
+  Extrude against ExtrudeScalar: equal output on every batch size, then the time per edge of both on 64k edges. Returns
+  false if any output differs
+*/
+static bool RunExtrusionCheck(unsigned seed, unsigned frames)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> coordinate(-4096.f, 4096.f);
+  const sf::Vector2f light(coordinate(rng), coordinate(rng));
+  const float distance = 1.4142f * 250.f;
+
+  auto makeBatch = [&](std::size_t count, EdgeSoA &edges) {
+    edges.Clear();
+    for (std::size_t i = 0; i < count; ++i)
+      edges.Push({ coordinate(rng), coordinate(rng) }, { coordinate(rng), coordinate(rng) });
+  };
+  auto same = [](const std::vector<float> &a, const std::vector<float> &b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0);
+  };
+
+  EdgeSoA edges;
+  ExtrudedEdges simd, scalar;
+  std::size_t mismatches = 0, batches = 0;
+  for (std::size_t count : { 0, 1, 2, 3, 4, 5, 7, 8, 9, 12, 15, 16, 17, 31, 33, 1000, 4099 }) {
+    makeBatch(count, edges);
+    ShadowExtrusion::Extrude(edges, light, distance, simd);
+    ShadowExtrusion::ExtrudeScalar(edges, light, distance, scalar);
+    if (!same(simd.StartX, scalar.StartX) || !same(simd.StartY, scalar.StartY) || !same(simd.EndX, scalar.EndX) || !same(simd.EndY, scalar.EndY)) {
+      std::fprintf(stderr, "Extrude and ExtrudeScalar differ on a batch of %zu edges\n", count);
+      ++mismatches;
+    }
+    ++batches;
+  }
+
+  makeBatch(65536, edges);
+  std::vector<double> simdMs, scalarMs;
+  for (unsigned frame = 0; frame < frames; ++frame) {
+    auto start = BenchClock::now();
+    ShadowExtrusion::Extrude(edges, light, distance, simd);
+    simdMs.push_back(Milliseconds(start, BenchClock::now()));
+
+    start = BenchClock::now();
+    ShadowExtrusion::ExtrudeScalar(edges, light, distance, scalar);
+    scalarMs.push_back(Milliseconds(start, BenchClock::now()));
+  }
+  const double simdNs = Median(simdMs) * 1e6 / edges.Size();
+  const double scalarNs = Median(scalarMs) * 1e6 / edges.Size();
+
+  std::printf("extrusion: %zu of %zu batches identical, simd %.3f ns/edge, scalar %.3f ns/edge, %.2fx\n\n",
+              batches - mismatches, batches, simdNs, scalarNs, simdNs > 0.0 ? scalarNs / simdNs : 0.0);
+  return mismatches == 0;
+}
+
+static std::vector<Edge> MakeLoop(const std::vector<sf::Vector2f> &corners)
+{
+  std::vector<Edge> edges;
+  for (std::size_t i = 0; i < corners.size(); ++i)
+    edges.push_back({ corners[i], corners[(i + 1) % corners.size()] });
+  return edges;
+}
+
+/*
+  Back face culling around closed loops: a light inside a room drawn as one loop (square, L-shaped, with a crate in it)
+  has to stay in the room, and a light outside a box still skips the box's far edges. Returns false if any check fails
+*/
+static bool RunEnclosureCheck()
+{
+  struct Probe { sf::Vector2f Point; bool Lit; };
+  std::size_t checks = 0, passed = 0;
+  auto check = [&](const char *name, const std::vector<std::vector<Edge>> &casters, const sf::Vector2f &light,
+                   const std::vector<Probe> &probes, std::size_t backFacing) {
+    BenchmarkSystem system;
+    system.AddLight(light, 1.f, sf::Color::White, 400.f, 0.f, 400.f);
+    for (auto & caster : casters)
+      system.AddShadowCaster(caster);
+    system.UpdateLights();
+    system.FinishUpdate();
+
+    std::vector<sf::Vector2f> points;
+    for (auto & probe : probes)
+      points.push_back(probe.Point);
+    PointVisibilityResult visibility;
+    system.QueryExact(points, visibility);
+    for (std::size_t i = 0; i < probes.size(); ++i) {
+      ++checks;
+      if (visibility.IsLit(i) == probes[i].Lit)
+        ++passed;
+      else
+        std::fprintf(stderr, "%s: (%g, %g) should be %s\n", name, probes[i].Point.x, probes[i].Point.y, probes[i].Lit ? "lit" : "dark");
+    }
+
+    ++checks;
+    if (system.GetCullStats().BackFacingEdges == backFacing)
+      ++passed;
+    else
+      std::fprintf(stderr, "%s: %zu edges skipped as facing away, expected %zu\n", name, system.GetCullStats().BackFacingEdges, backFacing);
+  };
+
+  const std::vector<Edge> room = MakeLoop({ { 0.f, 0.f }, { 200.f, 0.f }, { 200.f, 200.f }, { 0.f, 200.f } });
+  const std::vector<Edge> crate = MakeLoop({ { 140.f, 90.f }, { 160.f, 90.f }, { 160.f, 110.f }, { 140.f, 110.f } });
+  const std::vector<Edge> corner = MakeLoop({ { 0.f, 0.f }, { 200.f, 0.f }, { 200.f, 100.f }, { 100.f, 100.f }, { 100.f, 200.f }, { 0.f, 200.f } });
+
+  check("room", { room }, { 100.f, 100.f }, { { { 100.f, 150.f }, true }, { { 300.f, 100.f }, false }, { { 100.f, -50.f }, false } }, 0);
+  check("room with a crate", { room, crate }, { 100.f, 100.f },
+        { { { 60.f, 100.f }, true }, { { 150.f, 150.f }, true }, { { 180.f, 100.f }, false }, { { 300.f, 100.f }, false }, { { 100.f, 300.f }, false } }, 3);
+  check("L-shaped room", { corner }, { 50.f, 50.f },
+        { { { 50.f, 150.f }, true }, { { 150.f, 50.f }, true }, { { 150.f, 150.f }, false }, { { 250.f, 50.f }, false } }, 0);
+  check("box", { crate }, { 0.f, 0.f }, { { { 300.f, 200.f }, false }, { { 200.f, 0.f }, true } }, 2);
+
+  std::printf("enclosure: %zu of %zu checks passed\n\n", passed, checks);
+  return passed == checks;
+}
+
+/*
+  LightComposite::Accumulate against the per-light render with 1, 2, 4 and 8 lights over every pixel of a small scene: an
+  RGBA8 buffer within LightAccumulation::RoundingBound of it, a Float16 one within float error. Returns false if any check
+  fails
+*/
+static bool RunAccumulationCheck()
+{
+  std::size_t checks = 0, passed = 0;
+  SoftwareLightTarget scene;
+  scene.Create(128, 128);
+  for (unsigned y = 0; y < scene.Height; ++y) {
+    for (unsigned x = 0; x < scene.Width; ++x) {
+      float *pixel = &scene.Pixels[(static_cast<std::size_t>(y) * scene.Width + x) * 4];
+      pixel[0] = 0.5f * x / scene.Width;
+      pixel[1] = 0.5f * y / scene.Height;
+      pixel[2] = 0.1f;
+      pixel[3] = 1.f;
+    }
+  }
+
+  for (unsigned lights : { 1u, 2u, 4u, 8u }) {
+    BenchmarkSystem system;
+    for (unsigned i = 0; i < lights; ++i)
+      system.AddLight(sf::Vector2f(40.f + 6.f * i, 60.f + 4.f * i), 0.005f, sf::Color::White, 400.f, 0.f, 400.f);
+    system.UpdateLights();
+    system.FinishUpdate();
+
+    SoftwareLightTarget reference = scene;
+    system.RenderSoftware(reference);
+    const struct { LightBufferPrecision Precision; float Bound; } buffers[] = {
+      { LightBufferPrecision::RGBA8, LightAccumulation::RoundingBound(lights) },
+      { LightBufferPrecision::Float16, 1e-4f }
+    };
+    for (auto & buffer : buffers) {
+      SoftwareLightTarget rendered = scene;
+      system.SetLightComposite(LightComposite::Accumulate, buffer.Precision);
+      system.RenderSoftware(rendered);
+      system.SetLightComposite(LightComposite::PerLight);
+
+      float error = 0.f;
+      for (std::size_t i = 0; i < reference.Pixels.size(); ++i)
+        error = std::max(error, std::abs(rendered.Pixels[i] - reference.Pixels[i]));
+      ++checks;
+      if (error <= buffer.Bound)
+        ++passed;
+      else
+        std::fprintf(stderr, "%u lights, %s buffer: off by %g, bound %g\n", lights,
+                     buffer.Precision == LightBufferPrecision::RGBA8 ? "RGBA8" : "Float16", error, buffer.Bound);
+    }
+  }
+
+  std::printf("accumulation: %zu of %zu checks passed\n\n", passed, checks);
+  return passed == checks;
+}
+
+/*
+  GPUScenePacker against the std430 layout SSBOLighting.fsh reads, at the offsets GPUPacking.h's static_asserts pin down
+  (written out again here rather than taken from offsetof), then its dirty ranges after one light moves. Returns false if
+  any check fails
+*/
+static bool RunPackingCheck()
+{
+  std::size_t passed = 0, failed = 0;
+  auto check = [&](bool ok, const char *what) {
+    if (ok)
+      ++passed;
+    else {
+      std::fprintf(stderr, "Packing: %s\n", what);
+      ++failed;
+    }
+  };
+  auto read = [](const std::vector<std::uint8_t> &bytes, std::size_t offset, auto value) {
+    if (offset + sizeof(value) <= bytes.size())
+      std::memcpy(&value, bytes.data() + offset, sizeof(value));
+    return value;
+  };
+
+  struct PackedLight { sf::Color Color; sf::Vector2f Position; float Attenuation, Intensity; };
+  const PackedLight lights[] = {
+    { sf::Color(255, 0, 0, 255), { 10.f, 20.f }, 100.f, 1.f },
+    { sf::Color(0, 255, 51, 128), { -30.f, 40.5f }, 250.f, 2.5f },
+    { sf::Color(17, 34, 255, 0), { 1000.f, -7.f }, 64.f, 0.25f }
+  };
+  EdgeSoA edges;
+  edges.Push({ 0.f, 0.f }, { 10.f, 0.f });
+  edges.Push({ 10.f, 0.f }, { 10.f, -5.5f });
+
+  GPUScenePacker packer;
+  packer.SetLightCount(3);
+  for (std::size_t i = 0; i < 3; ++i)
+    packer.SetLight(i, lights[i].Color, lights[i].Position, lights[i].Attenuation, lights[i].Intensity);
+  packer.SetEdges(edges);
+
+  //light_shader_data: the two counts, padding up to 16, then 32 bytes per light_data
+  const std::vector<std::uint8_t> &lightBytes = packer.GetBytes(GPUScenePacker::LightBuffer);
+  check(lightBytes.size() == 16 + 3 * 32, "light buffer isn't 16 + 32 bytes a light");
+  check(read(lightBytes, 0, std::int32_t()) == 3 && read(lightBytes, 4, std::int32_t()) == 2, "num_lights / num_edges aren't at 0 / 4");
+  bool lightsMatch = true;
+  for (std::size_t i = 0; i < 3; ++i) {
+    const std::size_t base = 16 + i * 32;
+    const PackedLight &l = lights[i];
+    lightsMatch &= read(lightBytes, base + 0, float()) == l.Color.r / 255.f && read(lightBytes, base + 4, float()) == l.Color.g / 255.f &&
+                   read(lightBytes, base + 8, float()) == l.Color.b / 255.f && read(lightBytes, base + 12, float()) == l.Color.a / 255.f;
+    lightsMatch &= read(lightBytes, base + 16, float()) == l.Position.x && read(lightBytes, base + 20, float()) == l.Position.y;
+    lightsMatch &= read(lightBytes, base + 24, float()) == l.Attenuation && read(lightBytes, base + 28, float()) == l.Intensity;
+  }
+  check(lightsMatch, "light_data fields aren't at 0 (color), 16 (position), 24 (attenuation), 28 (intensity)");
+
+  //edge_shader_data: one vec4 per edge, start in xy and end in zw
+  const std::vector<std::uint8_t> &edgeBytes = packer.GetBytes(GPUScenePacker::EdgeBuffer);
+  check(edgeBytes.size() == 2 * 16, "edge buffer isn't 16 bytes an edge");
+  bool edgesMatch = true;
+  for (std::size_t i = 0; i < 2; ++i) {
+    edgesMatch &= read(edgeBytes, i * 16 + 0, float()) == edges.Start(i).x && read(edgeBytes, i * 16 + 4, float()) == edges.Start(i).y;
+    edgesMatch &= read(edgeBytes, i * 16 + 8, float()) == edges.End(i).x && read(edgeBytes, i * 16 + 12, float()) == edges.End(i).y;
+  }
+  check(edgesMatch, "Edges[] isn't start.xy, end.zw at a 16 byte stride");
+
+  //The first pack is dirty from end to end
+  std::vector<DirtyRange> dirty;
+  packer.TakeDirty(GPUScenePacker::LightBuffer, dirty);
+  check(dirty.size() == 1 && dirty[0].Begin == 0 && dirty[0].End == lightBytes.size(), "a fresh light buffer isn't dirty as one whole range");
+  packer.TakeDirty(GPUScenePacker::EdgeBuffer, dirty);
+  check(dirty.size() == 1 && dirty[0].Begin == 0 && dirty[0].End == edgeBytes.size(), "a fresh edge buffer isn't dirty as one whole range");
+
+  //Everything packed again as it was, with only the middle light moved: just that light's record goes up
+  for (std::size_t i = 0; i < 3; ++i) {
+    const sf::Vector2f position = i == 1 ? lights[i].Position + sf::Vector2f(5.f, 0.f) : lights[i].Position;
+    packer.SetLight(i, lights[i].Color, position, lights[i].Attenuation, lights[i].Intensity);
+  }
+  packer.SetEdges(edges);
+  packer.TakeDirty(GPUScenePacker::LightBuffer, dirty);
+  check(dirty.size() == 1 && dirty[0].Begin == 16 + 32 && dirty[0].End == 16 + 2 * 32, "moving one light didn't dirty exactly its record");
+  check(read(lightBytes, 16 + 32 + 16, float()) == lights[1].Position.x + 5.f, "the moved light's position wasn't repacked");
+  packer.TakeDirty(GPUScenePacker::EdgeBuffer, dirty);
+  check(dirty.empty(), "repacking the same edges dirtied the edge buffer");
+
+  std::printf("packing: %zu of %zu checks passed\n\n", passed, passed + failed);
+  return failed == 0;
+}
+
+//LightTextureCache on its own, with a falloff draw that does nothing past the cache's own clear. Returns false if any check fails
+static bool RunTextureCacheCheck()
+{
+  sf::Context context;
+  std::size_t passed = 0, failed = 0;
+  auto check = [&](bool ok, const char *what) {
+    if (ok)
+      ++passed;
+    else {
+      std::fprintf(stderr, "Texture cache: %s\n", what);
+      ++failed;
+    }
+  };
+  auto draw = [](sf::RenderTexture&, float, const sf::Color&) {};
+  const std::size_t mapBytes = 128 * 128 * 4;
+
+  LightTextureCache cache;
+
+  //Falloffs are shared by (attenuation, color) and nothing else
+  auto white = cache.GetFalloff(100.f, sf::Color::White, draw);
+  auto whiteAgain = cache.GetFalloff(100.f, sf::Color::White, draw);
+  auto red = cache.GetFalloff(100.f, sf::Color::Red, draw);
+  auto wide = cache.GetFalloff(200.f, sf::Color::White, draw);
+  check(white == whiteAgain, "same attenuation and color didn't share a falloff");
+  check(white != red && white != wide, "different falloffs came back shared");
+  check(cache.GetStats().FalloffTextures == 3 && cache.GetStats().FalloffShared == 1, "falloff counts are off");
+  check(white->getSize().x == LightTextureCache::FalloffSize(100.f), "falloff isn't sized to its attenuation");
+
+  //Light maps round up to Granularity, and a returned one is handed out again for anything that fits
+  sf::RenderTexture *first = cache.AcquireLightMap(100, 100);
+  check(first->getSize() == sf::Vector2u(128, 128), "light map wasn't rounded up to Granularity");
+  sf::RenderTexture *second = cache.AcquireLightMap(100, 100);
+  check(first != second, "a light map in use was handed out twice");
+  cache.ReleaseLightMap(first);
+  check(cache.AcquireLightMap(90, 120) == first, "a released light map wasn't reused");
+  check(cache.GetStats().LightMaps == 2 && cache.GetStats().LightMapsInUse == 2, "light map counts are off");
+  cache.ReleaseLightMap(first);
+  cache.ReleaseLightMap(second);
+
+  //Budget: unused textures go oldest first, held falloffs never do
+  red.reset();
+  wide.reset();
+  const std::size_t whiteBytes = LightTextureCache::FalloffSize(100.f) * LightTextureCache::FalloffSize(100.f) * 4;
+  cache.SetBudget(whiteBytes + mapBytes);
+  LightTextureStats stats = cache.GetStats();
+  check(stats.FalloffTextures == 1 && stats.LightMaps == 1, "trimming to the budget kept the wrong textures");
+  check(stats.Evictions == 3 && stats.TotalBytes <= stats.Budget, "trimming didn't get under the budget");
+  check(cache.AcquireLightMap(64, 64) == second, "the most recently released light map was evicted first");
+
+  //Nothing left to evict: created anyway, and counted
+  sf::RenderTexture *extra = cache.AcquireLightMap(64, 64);
+  check(extra != second && cache.GetStats().OverBudget == 1, "going over budget with nothing to evict wasn't counted");
+  cache.ReleaseLightMap(extra);
+  cache.ReleaseLightMap(second);
+
+  std::printf("texture cache: %zu of %zu checks passed\n\n", passed, passed + failed);
+  return failed == 0;
+}
+
+//The fixed set that runs when no scene options are given
+static std::vector<BenchmarkScenario> DefaultScenarios(const BenchmarkScenario &base)
+{
+  std::vector<BenchmarkScenario> scenarios;
+  auto add = [&](const char *name, unsigned lights, float radius, float density, unsigned sides, unsigned walls, bool layer = false,
+                 unsigned movers = 0) {
+    for (ShadowMode mode : { ShadowMode::EdgeQuads, ShadowMode::VisibilityPolygon, ShadowMode::PolarMap }) {
+      BenchmarkScenario s = base;
+      s.Name = name;
+      s.Lights = lights;
+      s.Radius = radius;
+      s.CasterDensity = density;
+      s.EdgesPerCaster = sides;
+      s.WallTiles = walls;
+      s.TileLayer = layer;
+      s.Movers = movers;
+      s.Mode = mode;
+      scenarios.push_back(s);
+    }
+  };
+
+  add("small", 16, 200.f, 0.5f, 4, 0);
+  add("medium", 64, 250.f, 1.f, 4, 0);
+  add("large", 256, 250.f, 2.f, 6, 0);
+  add("wide-lights", 32, 600.f, 1.f, 4, 0);
+  add("tile-walls", 64, 250.f, 0.25f, 4, 2000);
+  add("tile-layer", 64, 250.f, 0.25f, 4, 2000, true);
+  add("movers", 64, 250.f, 0.5f, 4, 0, false, 300);
+
+  //Roughly 1k, 10k and 50k edges, where the polar map's fixed per-light cost should start paying off
+  add("dense-1k", 64, 250.f, 0.6f, 4, 0);
+  add("dense-10k", 64, 250.f, 4.f, 6, 0);
+  add("dense-50k", 64, 250.f, 20.f, 6, 0);
+
+  //A level far bigger than the screen: a 1920 x 1080 view in the middle, then zoomed out until the lights are specks
+  for (float zoom : { 1.f, 0.02f }) {
+    add(zoom == 1.f ? "big-level" : "big-level-far", 256, 250.f, 1.f, 4, 0);
+    for (std::size_t i = scenarios.size() - 3; i < scenarios.size(); ++i) {
+      scenarios[i].WorldSize = 8192.f;
+      scenarios[i].View = { 1920.f, 1080.f };
+      scenarios[i].Zoom = zoom;
+    }
+  }
+
+  //Particle effects: thousands of small lights, drawn one by one and then clustered to within 24 world units. They're
+  //about 32 apart, so a budget much under that hardly groups any
+  for (float error : { 0.f, 24.f }) {
+    add(error == 0.f ? "particles" : "particles-clustered", 4096, 40.f, 0.5f, 4, 0);
+    for (std::size_t i = scenarios.size() - 3; i < scenarios.size(); ++i)
+      scenarios[i].ClusterError = error;
+  }
+
+  //Lights 24 units across, with hard shadows and then with penumbrae
+  for (ShadowMode mode : { ShadowMode::EdgeQuads, ShadowMode::Penumbra }) {
+    BenchmarkScenario s = base;
+    s.Name = "soft";
+    s.Lights = 64;
+    s.Radius = 250.f;
+    s.Expand = 12.f;
+    s.Mode = mode;
+    scenarios.push_back(s);
+  }
+
+  //Many overlapping lights composited one at a time, then summed into an 8 bit and a half float light buffer
+  struct CompositeScenario { const char *Name; LightComposite Composite; LightBufferPrecision Precision; };
+  const CompositeScenario composites[] = {
+    { "composite", LightComposite::PerLight, LightBufferPrecision::RGBA8 },
+    { "composite-accum8", LightComposite::Accumulate, LightBufferPrecision::RGBA8 },
+    { "composite-accum16", LightComposite::Accumulate, LightBufferPrecision::Float16 }
+  };
+  for (auto & composite : composites) {
+    BenchmarkScenario s = base;
+    s.Name = composite.Name;
+    s.Lights = 256;
+    s.Radius = 250.f;
+    s.Intensity = 0.002f;
+    s.Composite = composite.Composite;
+    s.Precision = composite.Precision;
+    scenarios.push_back(s);
+  }
+  return scenarios;
+}
+
+int main(int argc, char **argv)
+{
+  BenchmarkScenario scenario;
+  bool custom = false;
+  std::string json, csv, trace;
+  bool checkGL = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+      return 1;
+    }
+    ++i;
+
+    if (arg == "--lights")        { scenario.Lights = std::atoi(value); custom = true; }
+    else if (arg == "--radius")   { scenario.Radius = static_cast<float>(std::atof(value)); custom = true; }
+    else if (arg == "--density")  { scenario.CasterDensity = static_cast<float>(std::atof(value)); custom = true; }
+    else if (arg == "--sides")    { scenario.EdgesPerCaster = std::atoi(value); custom = true; }
+    else if (arg == "--walls")    { scenario.WallTiles = std::atoi(value); custom = true; }
+    else if (arg == "--tile-layer") { scenario.TileLayer = std::atoi(value) != 0; custom = true; }
+    else if (arg == "--movers")   { scenario.Movers = std::atoi(value); custom = true; }
+    else if (arg == "--world")    { scenario.WorldSize = static_cast<float>(std::atof(value)); custom = true; }
+    else if (arg == "--view") {
+      float w = 0.f, h = 0.f;
+      if (std::sscanf(value, "%fx%f", &w, &h) != 2) {
+        std::fprintf(stderr, "--view takes WxH, e.g. 1920x1080\n");
+        return 1;
+      }
+      scenario.View = { w, h };
+      custom = true;
+    }
+    else if (arg == "--zoom")     { scenario.Zoom = std::max(static_cast<float>(std::atof(value)), 1e-3f); custom = true; }
+    else if (arg == "--cluster")  { scenario.ClusterError = static_cast<float>(std::atof(value)); custom = true; }
+    else if (arg == "--expand")   { scenario.Expand = std::max(static_cast<float>(std::atof(value)), 0.f); custom = true; }
+    else if (arg == "--intensity") { scenario.Intensity = std::max(static_cast<float>(std::atof(value)), 0.f); custom = true; }
+    else if (arg == "--composite") {
+      scenario.Composite = std::strcmp(value, "perlight") == 0 ? LightComposite::PerLight : LightComposite::Accumulate;
+      scenario.Precision = std::strcmp(value, "accumulate16") == 0 ? LightBufferPrecision::Float16 : LightBufferPrecision::RGBA8;
+      custom = true;
+    }
+    else if (arg == "--mode") {
+      scenario.Mode = std::strcmp(value, "visibility") == 0 ? ShadowMode::VisibilityPolygon :
+                      std::strcmp(value, "polar") == 0 ? ShadowMode::PolarMap :
+                      std::strcmp(value, "penumbra") == 0 ? ShadowMode::Penumbra : ShadowMode::EdgeQuads;
+      custom = true;
+    }
+    else if (arg == "--points")   { scenario.Points = std::atoi(value); custom = true; }
+    else if (arg == "--threads")  { scenario.Threads = std::atoi(value); }
+    else if (arg == "--frames")   { scenario.Frames = std::max(1, std::atoi(value)); }
+    else if (arg == "--seed")     { scenario.Seed = std::atoi(value); }
+    else if (arg == "--json")     { json = value; }
+    else if (arg == "--csv")      { csv = value; }
+    else if (arg == "--trace")    { trace = value; }
+    else if (arg == "--gl")       { checkGL = std::atoi(value) != 0; }
+    else {
+      std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+      return 1;
+    }
+  }
+
+#ifndef LSYS_PROFILE
+  if (!trace.empty()) {
+    std::fprintf(stderr, "--trace needs a build with LSYS_PROFILE defined\n");
+    return 1;
+  }
+#endif
+
+  const bool extrusionMatches = RunExtrusionCheck(scenario.Seed, scenario.Frames);
+  const bool enclosurePasses = RunEnclosureCheck();
+  const bool accumulationPasses = RunAccumulationCheck();
+  const bool packingPasses = RunPackingCheck();
+  const bool texturesPass = !checkGL || RunTextureCacheCheck();
+
+  std::vector<BenchmarkScenario> scenarios = custom ? std::vector<BenchmarkScenario>{ scenario } : DefaultScenarios(scenario);
+
+  std::vector<BenchmarkResult> results;
+  for (auto & s : scenarios)
+    results.push_back(RunScenario(s, trace));
+
+  PrintTable(results);
+
+  if (!json.empty() && !WriteJson(json, results)) {
+    std::fprintf(stderr, "Couldn't write %s\n", json.c_str());
+    return 1;
+  }
+  if (!csv.empty() && !WriteCsv(csv, results)) {
+    std::fprintf(stderr, "Couldn't write %s\n", csv.c_str());
+    return 1;
+  }
+  for (auto & r : results) {
+    if (r.UpdateAllocationsPerFrame > 0.0) {
+      std::fprintf(stderr, "%s: UpdateLights allocated %.2f times a frame after warming up\n", r.Scenario.Name.c_str(), r.UpdateAllocationsPerFrame);
+      return 1;
+    }
+    if (r.UntiledLights) {
+      std::fprintf(stderr, "%s: %zu visible lights got no screen tiles\n", r.Scenario.Name.c_str(), r.UntiledLights);
+      return 1;
+    }
+    if (r.ParallelMismatches) {
+      std::fprintf(stderr, "%s: %zu lights came out different on one worker and on several\n", r.Scenario.Name.c_str(), r.ParallelMismatches);
+      return 1;
+    }
+  }
+  return extrusionMatches && enclosurePasses && accumulationPasses && packingPasses && texturesPass ? 0 : 1;
+}
@@ -1,10 +1,34 @@
 #pragma once
 #include <GL/glew.h>
 
+#include <cstddef>
 #include <iostream>
+#include <memory>
 #include <SFML\Graphics.hpp>
 #include <SFML\OpenGL.hpp>
 
+#include "LightGeometry.h"
+#include "CasterEdges.h"
+#include "LightMesh.h"
+#include "EdgeGrid.h"
+#include "LightWorkerPool.h"
+#include "SoftwareLightRenderer.h"
+#include "SlotMap.h"
+#include "ShadowExtrusion.h"
+#include "FrameCapture.h"
+#include "LightTiles.h"
+#include "LightTextureCache.h"
+#include "LightAccumulation.h"
+#include "GPUSceneBuffers.h"
+#include "PointVisibility.h"
+#include "PolarShadowMap.h"
+#include "PenumbraShadows.h"
+#include "LightPipeline.h"
+#include "TileCasters.h"
+#include "SceneFile.h"
+#include "LightClusters.h"
+#include "LightProfiler.h"
+
 void normalize(sf::Vector2f &v)
 {
   float mag = (v.x * v.x) + (v.y * v.y);
@@ -12,207 +36,981 @@ void normalize(sf::Vector2f &v)
   v = sf::Vector2f(v.x / mag, v.y / mag);
 }
 
-struct Edge
-{
-  sf::Vector2f Start;
-  sf::Vector2f End;
-
-  //Polar form
-  float r = 0.f;
-  float mag = 0.f;
-};
+class Light;
+struct LightObject;
 
-struct light_stc_data_type
+//How much work a light gets, picked every UpdateLights from how big it is on screen (see SetViewRect)
+enum class LightLod
 {
-  sf::Glsl::Vec4 light_color;
-  sf::Glsl::Vec2 light_position;
-  float light_attenuation;
-  float light_intensity;
+  Full,       //Shadowed as ShadowMode says
+  Unshadowed  //Too small on screen for its shadows to show: just the lit square, no casters are looked at
 };
+struct DynamicCaster;
 
-struct edge_data_type
-{
-  sf::Glsl::Vec4 *Edges;
-};
-
-struct shadow_caster_data_type
-{
-  sf::Glsl::Vec2 EdgeStart;
-  sf::Glsl::Vec2 EdgeEnd;
-};
+using LightHandle = SlotHandle<Light>;
+using CasterHandle = SlotHandle<LightObject>;
+using DynamicCasterHandle = SlotHandle<DynamicCaster>;
 
 class Light {
 public:
-  Light() = default;
-  Light(const Light &other)
-    :
-    Position(other.Position),
-    Radius(other.Radius),
-    Color(other.Color),
-    Expand(other.Expand)
-  {}
-
   float Attenuation = 0.f;
   sf::Vector2f Position;
   float Radius = 0.f;
   sf::Color Color;
+
+  //Radius of the light itself. ShadowMode::Penumbra softens the shadows' edges by it, 0 keeps them hard
   float Expand = 0.f;
-  int ID = 0;
+  LightHandle Handle;
   float Intensity = 1.f;
   sf::CircleShape Circle;
 
-  sf::VertexArray LightVerts;
-  sf::VertexArray Shadowverts;
+  //Rebuilt in place every update, so they keep their capacity from frame to frame
+  LightMesh LightVerts;
+  LightMesh Shadowverts;
+
+  //The caster edges the last update shadowed this light with, kept for QueryVisibility
+  EdgeSoA Occluders;
+
+  //ShadowMode::PolarMap only. ShadowBins of 0 picks a bin count from Radius
+  unsigned ShadowBins = 0;
+  PolarShadowMap ShadowMap;
+
+  //Size of the radial falloff texture LightVerts' texCoords point into, just big enough for the attenuation circle
+  sf::Vector2u TextureSize;
+
+  //Set when something the light can reach changed, UpdateLights only rebuilds dirty lights
+  bool Dirty = true;
+
+  //Whether the attenuation circle touches the view rect, and the level of detail the geometry was last built at
+  bool Visible = true;
+  LightLod Lod = LightLod::Full;
+
+  //Drawn through a cluster light instead of on its own, as of the last UpdateLights (see SetClusterError)
+  bool Clustered = false;
+
+  //Only set on LSystem's own cluster lights, which have no handle: their entry in ClusterLights
+  static constexpr std::uint32_t NoCluster = 0xFFFFFFFFu;
+  std::uint32_t Cluster = NoCluster;
+
+  //Only created with the OpenGL backend. Shared with every other light that has the same attenuation
+  std::shared_ptr<sf::RenderTexture> Falloff;
+};
+
+//How UpdateLight turns casters into shadows
+enum class ShadowMode
+{
+  EdgeQuads,        //Extrude a black quad per edge (peaked on the far side when it has to be) and draw them over the light
+  VisibilityPolygon, //Sweep around the light and only emit the lit region as a triangle fan in LightVerts
+  PolarMap,          //Rasterize the edges into a 1D polar shadow map, emit one fan triangle per angular bin in LightVerts
+  Penumbra           //EdgeQuads with soft edges: narrower umbra quads plus a penumbra wedge per silhouette endpoint (see PenumbraBuilder)
+};
+
+//Where the light maps get drawn
+enum class LightBackend
+{
+  OpenGL,  //Render textures and shaders, needs a GL context
+  Software //No GL at all, lights are composited on the CPU through RenderSoftware
+};
+
+//How RenderOntoScene (and RenderSoftware) put the lights on the scene
+enum class LightComposite
+{
+  PerLight,  //Each light blended into SceneTexture on its own through MaskShader.fsh: a full screen pass per light, plus one
+  Accumulate //Every light summed into GlobalLightMap, then the scene composited once into NewSceneTexture: two passes
+};
+
+//What the view rect did to the lights in the last UpdateLights
+struct LightViewStats
+{
+  std::size_t Lights = 0;
+  std::size_t Culled = 0;     //Attenuation circle entirely outside the view: not updated or drawn
+  std::size_t Downgraded = 0; //On screen, but drawn at LightLod::Unshadowed
+};
+
+//Everything one UpdateLight call scribbles on, one per worker so lights can update in parallel
+struct LightUpdateScratch
+{
+  std::vector<std::uint32_t> CandidateEdges;
+  EdgeSoA Batch;          //The candidate edges, copied out of WorldEdges so the kernels can stream through them
+  std::vector<CasterEdgeBuilder::LoopEdge> LoopEdges; //The loop candidates, grouped by loop to find the ones around the light
+  ExtrudedEdges Extruded;
+  VisibilityScratch Sweep;
+  PenumbraBuilder Penumbra;
+  CasterCullStats CullStats;
 };
 
 struct LightObject {
+  //As they were handed to AddShadowCaster. WorldEdges is built from these
   std::vector<Edge> Edges;
+
+  //A chunk of a tile layer's outline: already wound, and not closed loops on their own (see CasterEdgeBuilder::AddOutline)
+  bool Outline = false;
+
+  //Bounds of Edges
+  sf::Vector2f Min;
+  sf::Vector2f Max;
+};
+
+/*
+  A caster that moves, added through AddDynamicCaster. Its edges stay in local space, already run through
+  CasterEdgeBuilder on their own, and are only pushed through Transform again when SetCasterTransform changed it.
+  Dynamic casters don't take part in the static merge, so moving one never rebuilds WorldEdges.
+*/
+struct DynamicCaster {
+  EdgeSoA LocalEdges;
+  std::vector<std::uint8_t> TwoSided;
+  std::vector<std::uint32_t> Loops;
+  std::uint32_t LoopCount = 0;
+  sf::Transform Transform;
+
+  //LocalEdges through Transform, and their bounds. Only valid once Placed
+  EdgeSoA Edges;
+  sf::Vector2f Min;
+  sf::Vector2f Max;
+  bool Placed = false;
+
+  //Transform changed since Edges was built, and the caster is queued in LSystem::MovedCasters
+  bool Moved = false;
 };
 
 class LSystem
 {
 public:
-  LSystem()
+  LSystem(LightBackend backend = LightBackend::OpenGL)
+    : Backend(backend)
   {
-    ShadowingShader.loadFromFile("ShadowingShader.fsh", sf::Shader::Fragment);
-    BlendShader.loadFromFile("MaskShader.fsh", sf::Shader::Fragment);
-    LightShader.loadFromFile("SuperBright.fsh", sf::Shader::Fragment);
-    ShadowRegions = sf::VertexArray(sf::Triangles);
+    if (Backend == LightBackend::OpenGL) {
+      InitGLEW();
+      ShadowingShader.loadFromFile("ShadowingShader.fsh", sf::Shader::Fragment);
+      BlendShader.loadFromFile("MaskShader.fsh", sf::Shader::Fragment);
+      LightShader.loadFromFile("SuperBright.fsh", sf::Shader::Fragment);
+      PenumbraShader.loadFromFile("PenumbraShader.fsh", sf::Shader::Fragment);
+      AccumulateShader.loadFromFile("AccumulateShader.fsh", sf::Shader::Fragment);
+      CompositeShader.loadFromFile("CompositeShader.fsh", sf::Shader::Fragment);
+    }
   }
 
   void CreateGlobalLightMap(int height, int width) {
     GlobalLightMap.create(width, height);
+    LightBufferSize = { static_cast<unsigned>(width), static_cast<unsigned>(height) };
+    LightBufferMade = LightBufferPrecision::RGBA8;
 
     GLint size = 0;
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
     std::cout << "Max textue size: " << size << std::endl;
   }
 
-  int AddLight(const sf::Vector2f &position, float intensity, const sf::Color &color, float attenuation, float expand, float radius) {
-    static int lights_int = 0;
-    lights_int++;
+  LightHandle AddLight(const sf::Vector2f &position, float intensity, const sf::Color &color, float attenuation, float expand, float radius) {
+    Light light;
+    light.Intensity = intensity;
+    light.Attenuation = attenuation;
+    light.Color = color;
+    light.Expand = expand;
+    light.Position = position;
+    light.Radius = radius;
+    const unsigned falloffSize = LightTextureCache::FalloffSize(attenuation);
+    light.TextureSize = { falloffSize, falloffSize };
+
+    const LightHandle handle = Lights.Insert(std::move(light));
+    ClusterTreeDirty = true;
+    Light &added = *Lights.Get(handle);
+    added.Handle = handle;
+    if (Backend == LightBackend::OpenGL)
+      CreateLightTexture(added);
+
+    return handle;
+  }
+
+  //Returns false if the handle is stale (the light was already removed)
+  bool RemoveLight(const LightHandle &handle) {
+    if (!Lights.Remove(handle))
+      return false;
+
+    ClusterTreeDirty = true;
+    return true;
+  }
+
+  bool MoveLight(const LightHandle &handle, const sf::Vector2f &NewPos) {
+    Light *light = Lights.Get(handle);
+    if (!light)
+      return false;
+
+    if (light->Position != NewPos) {
+      light->Position = NewPos;
+      light->Dirty = true;
+      ClusterRefit = true;
+    }
+    return true;
+  }
+
+  bool IsValid(const LightHandle &handle) const {
+    return Lights.Contains(handle);
+  }
 
-    Lights[lights_int] = {};
-    Lights[lights_int].Intensity = intensity;
-    Lights[lights_int].Attenuation = attenuation;
-    Lights[lights_int].Color = color;
-    Lights[lights_int].Expand = expand;
-    Lights[lights_int].Position = position;
-    Lights[lights_int].Radius = radius;
-    Lights[lights_int].ID = lights_int;
-    Lights[lights_int].LightVerts = sf::VertexArray(sf::Triangles);
-    Lights[lights_int].Shadowverts = sf::VertexArray(sf::Triangles);
-    CreateLightTexture(Lights[lights_int]);
-    return lights_int;
+  bool IsValid(const CasterHandle &handle) const {
+    return Casters.Contains(handle);
   }
 
-  void RemoveLight() {
+  //Angular resolution of the light's polar shadow map (ShadowMode::PolarMap), 0 to derive it from the light's radius
+  bool SetLightShadowBins(const LightHandle &handle, unsigned bins) {
+    Light *light = Lights.Get(handle);
+    if (!light)
+      return false;
 
+    if (light->ShadowBins != bins) {
+      light->ShadowBins = bins;
+      light->Dirty = light->Dirty || Mode == ShadowMode::PolarMap;
+    }
+    return true;
+  }
+
+  //Size of the light itself, which ShadowMode::Penumbra's shadows soften with
+  bool SetLightExpand(const LightHandle &handle, float expand) {
+    Light *light = Lights.Get(handle);
+    if (!light)
+      return false;
+
+    expand = std::max(expand, 0.f);
+    if (light->Expand != expand) {
+      light->Expand = expand;
+      light->Dirty = light->Dirty || Mode == ShadowMode::Penumbra;
+      ClusterRefit = true;
+    }
+    return true;
   }
 
-  void MoveLight(int index, const sf::Vector2f &NewPos) {
-    auto light = Lights.find(index);
-    if (light != Lights.end())
-      light->second.Position = NewPos;
+  //nullptr for stale handles. Don't hold on to it, adding or removing lights moves them
+  const Light* GetLight(const LightHandle &handle) const {
+    return Lights.Get(handle);
   }
 
+  /*
+    Only lights that moved, or that a new or moved caster landed near, get rebuilt.
+    Everyone else keeps last frame's LightVerts/Shadowverts.
+
+    With an update latency of 1 (see SetUpdateLatency) this publishes the geometry the previous call started, then
+    hands this frame's dirty lights to the background thread and returns without waiting for them.
+  */
   void UpdateLights() {
-    //For each light, update it
-    ShadowRegions.clear();
-    
-    for (auto & light : Lights)
-      UpdateLight(light.second);
+    FinishUpdate();
+    LSYS_PROFILE_FRAME(FrameNumber + 1);
+    LSYS_PROFILE_SCOPE(UpdateLights);
+    TestTriangles.clear();
+
+    if (Capture) {
+      Capture->EndFrame(FrameNumber);
+      Capture->Poll();
+    }
+    FrameNumber++;
+
+    if (CasterEdgesDirty) {
+      RebuildWorldEdges();
+      CasterEdgesDirty = false;
+    }
+
+    if (CasterGridDirty) {
+      CasterGrid.Build(WorldEdges);
+      CasterGridDirty = false;
+    }
+
+    if (DynamicEdgesDirty || !MovedCasters.empty())
+      RefitDynamicCasters();
+
+    if (SceneStreamDirty) {
+      BakedScene.Stream(HasStreamRegion ? &StreamRegion : nullptr, ChangedBounds);
+      SceneStreamDirty = false;
+      GPUEdgesDirty = true;
+    }
+
+    if (!ChangedBounds.empty())
+      DirtyLightsNear(ChangedBounds);
+
+    BuildLightClusters();
+
+    //Off-screen lights stay dirty, so they're brought up to date as soon as they come into view
+    ClassifyLights();
+
+    UpdateOrder.clear();
+    if (Latency == 0) {
+      ForEachDrawnLight([this](Light &light) {
+        if (light.Dirty && light.Visible)
+          UpdateOrder.push_back(&light);
+      });
+
+      RunLightUpdates(Workers);
+      for (auto light : UpdateOrder)
+        light->Dirty = false;
+      SumCullStats();
+      return;
+    }
+
+    //The background thread only ever sees these copies, so lights can be moved, added and removed while it runs
+    std::size_t staged = 0;
+    ForEachDrawnLight([&](Light &light) {
+      if (!light.Dirty || !light.Visible)
+        return;
+
+      if (Staged.size() == staged)
+        Staged.emplace_back();
+      StageLight(light, Staged[staged++]);
+      light.Dirty = false;
+    });
+    for (std::size_t i = 0; i < staged; ++i)
+      UpdateOrder.push_back(&Staged[i]);
+
+    UpdateInFlight = true;
+    Pipeline.Kick([this]() { RunLightUpdates(PipelineWorkers); });
+  }
+
+  /*
+    The fence for pipelined updates: blocks until the update the last UpdateLights started is done, then swaps its
+    geometry into the lights (lights removed in the meantime are skipped). Does nothing when nothing is in flight,
+    which is always the case with a latency of 0.
+
+    While an update is in flight the background thread owns its staged copies of the dirty lights, the world edges, the
+    caster grids and the loaded scene's resident chunks; the lights themselves stay with the caller, and rendering draws whatever was last published.
+    Anything that changes what the background thread reads (SetShadowMode, SetCasterGridCellSize, SetUpdateThreads,
+    SetUpdateLatency) calls this first.
+  */
+  void FinishUpdate() {
+    if (!UpdateInFlight)
+      return;
+
+    Pipeline.Wait();
+    UpdateInFlight = false;
+
+    for (auto staged : UpdateOrder) {
+      Light *light = staged->Cluster != Light::NoCluster ? &ClusterLights[staged->Cluster] : Lights.Get(staged->Handle);
+      if (!light)
+        continue;
+
+      //Swapped, not copied, so both sides keep their capacity for the next round
+      std::swap(light->LightVerts, staged->LightVerts);
+      std::swap(light->Shadowverts, staged->Shadowverts);
+      std::swap(light->Occluders, staged->Occluders);
+      std::swap(light->ShadowMap, staged->ShadowMap);
+    }
+    SumCullStats();
+  }
+
+  bool IsUpdatePending() const {
+    return UpdateInFlight;
+  }
+
+  /*
+    How many frames what's drawn may lag behind the last UpdateLights. 0 (the default) rebuilds every dirty light before
+    UpdateLights returns. 1 rebuilds them on a background thread while the frame is rendered, taking the geometry work
+    off the render thread, and the next UpdateLights (or FinishUpdate) picks the result up. Anything above 1 is treated
+    as 1.
+  */
+  void SetUpdateLatency(unsigned frames) {
+    FinishUpdate();
+    Latency = std::min(frames, 1u);
+    if (Latency)
+      PipelineWorkers.SetThreadCount(UpdateThreads);
+  }
+
+  unsigned GetUpdateLatency() const {
+    return Latency;
+  }
+
+  //How many threads UpdateLights spreads the lights over, including the calling thread. 1 (the default) is fully serial, 0 uses every core
+  void SetUpdateThreads(unsigned count) {
+    FinishUpdate();
+    UpdateThreads = count;
+    Workers.SetThreadCount(count);
+    if (Latency)
+      PipelineWorkers.SetThreadCount(count);
+  }
+
+  CasterHandle AddShadowCaster(const std::vector<Edge> &Edges) {
+    LightObject caster;
+    caster.Edges = Edges;
+    return InsertCaster(std::move(caster));
+  }
+
+  //Takes the edges over instead of copying them
+  CasterHandle AddShadowCaster(std::vector<Edge> &&Edges) {
+    LightObject caster;
+    caster.Edges = std::move(Edges);
+    return InsertCaster(std::move(caster));
+  }
+
+  /*
+    Walls straight from a tile layer, instead of four edges per tile through AddShadowCaster. solid is width x height,
+    row-major, nonzero for a solid tile, and tile (x, y) covers origin + (x, y) * tileSize. Only the outline of each
+    solid region is kept (see TileOutlineTracer), and the layer goes in as one caster per chunkSize x chunkSize chunk so
+    RefreshTiles only has to retrace the chunks a change touches.
+  */
+  TileLayerCasters AddTileLayer(const std::vector<std::uint8_t> &solid, unsigned width, unsigned height, float tileSize,
+                                const sf::Vector2f &origin = {}, unsigned chunkSize = 64) {
+    TileLayerCasters layer;
+    layer.Width = width;
+    layer.Height = height;
+    layer.TileSize = tileSize;
+    layer.Origin = origin;
+    layer.ChunkSize = std::max(chunkSize, 1u);
+    layer.ChunkColumns = (width + layer.ChunkSize - 1) / layer.ChunkSize;
+    layer.ChunkRows = (height + layer.ChunkSize - 1) / layer.ChunkSize;
+    layer.Chunks.resize(static_cast<std::size_t>(layer.ChunkColumns) * layer.ChunkRows);
+    if (solid.size() < static_cast<std::size_t>(width) * height)
+      return layer;
+
+    for (unsigned cy = 0; cy < layer.ChunkRows; ++cy) {
+      for (unsigned cx = 0; cx < layer.ChunkColumns; ++cx)
+        TraceChunk(layer, solid, cx, cy);
+    }
+    return layer;
+  }
+
+  //Tiles [x0, x1) x [y0, y1) of the layer changed in solid. Retraces every chunk that owns a boundary of them
+  void RefreshTiles(TileLayerCasters &layer, const std::vector<std::uint8_t> &solid, unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+    if (layer.Chunks.empty() || solid.size() < static_cast<std::size_t>(layer.Width) * layer.Height || x0 >= x1 || y0 >= y1)
+      return;
+
+    //A tile's bottom and right sides belong to the chunk below/right of it when it's the last row/column of its own
+    const unsigned cx0 = std::min(x0, layer.Width - 1) / layer.ChunkSize;
+    const unsigned cy0 = std::min(y0, layer.Height - 1) / layer.ChunkSize;
+    const unsigned cx1 = std::min(std::min(x1, layer.Width) / layer.ChunkSize, layer.ChunkColumns - 1);
+    const unsigned cy1 = std::min(std::min(y1, layer.Height) / layer.ChunkSize, layer.ChunkRows - 1);
+    for (unsigned cy = cy0; cy <= cy1; ++cy) {
+      for (unsigned cx = cx0; cx <= cx1; ++cx)
+        TraceChunk(layer, solid, cx, cy);
+    }
   }
 
-  void AddShadowCaster(const std::vector<Edge> Edges) {
-    static int caster_id = 0;
-    caster_id++;
-    Casters[caster_id] = {};
-    for (auto & edge : Edges) {
-      Casters[caster_id].Edges.push_back({});
-      Casters[caster_id].Edges.back().Start = edge.Start;
-      Casters[caster_id].Edges.back().End = edge.End;
+  void RemoveTileLayer(TileLayerCasters &layer) {
+    for (auto & chunk : layer.Chunks) {
+      if (!chunk.IsNull())
+        RemoveShadowCaster(chunk);
+      chunk = CasterHandle();
     }
   }
 
+  bool RemoveShadowCaster(const CasterHandle &handle) {
+    if (!Casters.Remove(handle))
+      return false;
+
+    CasterEdgesDirty = true;
+    return true;
+  }
+
+  /*
+    A caster that moves, like a door or a crate. edges are in the caster's own space, transform puts them in the world,
+    and SetCasterTransform moves it from then on without handing the edges over again. Loops, shared edges and collinear
+    runs are worked out here, once, within this caster only.
+  */
+  DynamicCasterHandle AddDynamicCaster(const std::vector<Edge> &edges, const sf::Transform &transform = sf::Transform::Identity) {
+    DynamicCaster caster;
+    EdgeBuilder.Begin();
+    EdgeBuilder.AddCaster(edges);
+    EdgeBuilder.Finish(caster.LocalEdges, caster.TwoSided, caster.Loops);
+    for (auto loop : caster.Loops) {
+      if (loop != CasterEdgeBuilder::NoLoop)
+        caster.LoopCount = std::max(caster.LoopCount, loop + 1);
+    }
+    caster.Transform = transform;
+    caster.Moved = true;
+
+    const DynamicCasterHandle handle = DynamicCasters.Insert(std::move(caster));
+    MovedCasters.push_back(handle);
+    return handle;
+  }
+
+  /*
+    Takes effect on the next UpdateLights, which transforms the edges once however many times this was called, and only
+    rebuilds the lights that reach where the caster was or where it is now
+  */
+  bool SetCasterTransform(const DynamicCasterHandle &handle, const sf::Transform &transform) {
+    DynamicCaster *caster = DynamicCasters.Get(handle);
+    if (!caster)
+      return false;
+
+    caster->Transform = transform;
+    if (!caster->Moved) {
+      caster->Moved = true;
+      MovedCasters.push_back(handle);
+    }
+    return true;
+  }
+
+  bool RemoveShadowCaster(const DynamicCasterHandle &handle) {
+    const DynamicCaster *caster = DynamicCasters.Get(handle);
+    if (!caster)
+      return false;
+
+    if (caster->Placed)
+      ChangedBounds.push_back({ caster->Min, caster->Max - caster->Min });
+    DynamicCasters.Remove(handle);
+    DynamicEdgesDirty = true;
+    return true;
+  }
+
+  bool IsValid(const DynamicCasterHandle &handle) const {
+    return DynamicCasters.Contains(handle);
+  }
+
+  /*
+    Writes every light and every static edge to a scene file (see SceneFile.h): the casters' edges as CasterEdgeBuilder
+    left them, plus the loaded scene's. Dynamic casters aren't saved. The edges are cut into chunkSize x chunkSize
+    regions for SetStreamRegion, each with a grid of the current caster grid cell size.
+  */
+  bool SaveScene(const std::string &path, float chunkSize = 1024.f) {
+    FinishUpdate();
+    if (CasterEdgesDirty) {
+      RebuildWorldEdges();
+      CasterEdgesDirty = false;
+    }
+
+    std::vector<SceneFileLight> lights;
+    lights.reserve(Lights.Size());
+    for (auto & light : Lights) {
+      lights.push_back({ light.Position.x, light.Position.y, light.Intensity, light.Attenuation, light.Expand, light.Radius,
+                         light.Color.r, light.Color.g, light.Color.b, light.Color.a, light.ShadowBins });
+    }
+
+    SceneFileWriter writer;
+    if (!BakedScene.IsOpen())
+      return writer.Write(path, lights, WorldEdges, WorldEdgeTwoSided, WorldEdgeLoops, chunkSize, CasterGrid.GetCellSize());
+
+    //The scene's loops are numbered after the casters'
+    EdgeSoA edges = WorldEdges;
+    std::vector<std::uint8_t> twoSided = WorldEdgeTwoSided;
+    std::vector<std::uint32_t> loops = WorldEdgeLoops;
+    std::uint32_t loopBase = 0;
+    for (auto loop : WorldEdgeLoops) {
+      if (loop != CasterEdgeBuilder::NoLoop)
+        loopBase = std::max(loopBase, loop + 1);
+    }
+    for (std::size_t c = 0; c < BakedScene.GetChunkCount(); ++c) {
+      const SceneChunkView &chunk = BakedScene.GetChunk(c);
+      edges.Append(chunk.Edges);
+      twoSided.insert(twoSided.end(), chunk.TwoSided, chunk.TwoSided + chunk.Edges.Size());
+      for (std::size_t i = 0; i < chunk.Edges.Size(); ++i)
+        loops.push_back(chunk.Loops[i] == CasterEdgeBuilder::NoLoop ? CasterEdgeBuilder::NoLoop : chunk.Loops[i] + loopBase);
+    }
+    return writer.Write(path, lights, edges, twoSided, loops, chunkSize, CasterGrid.GetCellSize());
+  }
+
+  /*
+    Maps a scene file SaveScene wrote and adds its lights, with their handles appended to lights if it's given. The
+    edges stay in the file: lights query the chunks' grids inside the mapping, so loading costs the same however many
+    edges there are. Casters added afterwards are merged with each other as usual, but not with the scene's edges.
+    A scene that was already loaded is unloaded first, the lights it added stay.
+  */
+  bool LoadScene(const std::string &path, std::vector<LightHandle> *lights = nullptr) {
+    FinishUpdate();
+    UnloadScene();
+    if (!BakedScene.Open(path)) {
+      std::cerr << "Can't load scene " << path << ": " << BakedScene.GetError() << std::endl;
+      return false;
+    }
+
+    for (std::size_t i = 0; i < BakedScene.GetLightCount(); ++i) {
+      const SceneFileLight l = BakedScene.GetLight(i);
+      const LightHandle handle = AddLight({ l.X, l.Y }, l.Intensity, sf::Color(l.R, l.G, l.B, l.A), l.Attenuation, l.Expand, l.Radius);
+      SetLightShadowBins(handle, l.ShadowBins);
+      if (lights)
+        lights->push_back(handle);
+    }
+    SceneStreamDirty = true;
+    return true;
+  }
+
+  //Drops the loaded scene's edges and unmaps the file. Its lights stay
+  void UnloadScene() {
+    if (!BakedScene.IsOpen())
+      return;
+
+    FinishUpdate();
+    for (auto index : BakedScene.GetResident()) {
+      const SceneChunkView &chunk = BakedScene.GetChunk(index);
+      ChangedBounds.push_back({ chunk.Min, chunk.Max - chunk.Min });
+    }
+    BakedScene.Close();
+    GPUEdgesDirty = true;
+  }
+
+  /*
+    Streams the loaded scene: from the next UpdateLights on, only the chunks whose bounds touch region are handed to the
+    lights, and the OS is told the others' pages can go. A light only sees resident chunks, so region should be what's
+    on screen padded by the largest light radius. Only lights near a chunk that came or went are rebuilt.
+    Without a region (the default) the whole scene is resident.
+  */
+  void SetStreamRegion(const sf::FloatRect &region) {
+    if (HasStreamRegion && region == StreamRegion)
+      return;
+
+    HasStreamRegion = true;
+    StreamRegion = region;
+    SceneStreamDirty = true;
+  }
+
+  void ClearStreamRegion() {
+    SceneStreamDirty = SceneStreamDirty || HasStreamRegion;
+    HasStreamRegion = false;
+  }
+
+  //As of the last UpdateLights
+  SceneStreamStats GetSceneStats() const {
+    return BakedScene.GetStats();
+  }
+
+  //Size of a caster grid cell, in pixels. Roughly the radius of a typical light works well
+  void SetCasterGridCellSize(float size) {
+    FinishUpdate();
+    CasterGrid.SetCellSize(size);
+    CasterGridDirty = true;
+    DynamicEdgesDirty = true;
+  }
+
+  /*
+    The part of the world that's on screen, in the same coordinates as the lights, and how many screen pixels one unit
+    of it takes up. From the next UpdateLights on, lights whose attenuation circle misses rect are neither updated nor
+    drawn, and lights whose radius comes out under the LOD radius in pixels are drawn unshadowed (see LightLod).
+    RenderOntoScene and RenderSoftware put rect's top left at the scene's top left pixel.
+    Without a view rect (the default) every light is processed in full, and the scene's pixels are world units.
+  */
+  void SetViewRect(const sf::FloatRect &rect, float pixelsPerUnit = 1.f) {
+    HasView = true;
+    View = rect;
+    PixelsPerUnit = pixelsPerUnit;
+  }
+
+  void ClearViewRect() {
+    HasView = false;
+  }
+
+  //On-screen radius, in pixels, below which a light drops to LightLod::Unshadowed. 0 never downgrades
+  void SetLodRadius(float pixels) {
+    LodRadius = pixels;
+  }
+
+  const LightViewStats& GetViewStats() const {
+    return ViewStats;
+  }
+
+  /*
+    Light clustering, for thousands of small lights (particles and the like). From the next UpdateLights on, lights are
+    grouped by position and color (see LightClusterTree), and every frame the groups are cut down to ones that stay within
+    maxError screen pixels (see SetViewRect; world units without a view rect). Each group is drawn as one cluster light
+    with its own shadows: one UpdateLight, one light map and one blend for the whole group. colorDistance is how many
+    world units a full 0-255 difference in a color channel counts as. A maxError of 0 (the default) turns it off.
+
+    Light indices in GetScreenTiles, GetLightAt and QueryVisibility count the cluster lights, not the lights inside them.
+    A cluster's brightness is its members' summed, which is what they'd add up to if they didn't saturate.
+  */
+  void SetClusterError(float maxError, float colorDistance = 64.f) {
+    ClusterError = std::max(maxError, 0.f);
+    ClusterColorDistance = std::max(colorDistance, 0.f);
+    ClusterTreeDirty = true;
+  }
+
+  const LightClusterStats& GetClusterStats() const {
+    return ClusterStats;
+  }
+
+#ifdef LSYS_PROFILE
+  //Timings and counters from the frame before the last UpdateLights (from one UpdateLights up to the next)
+  const LightFrameProfile& GetFrameProfile() const {
+    return Profiler.GetLastFrame();
+  }
+
+  //Records every profiled scope from here on, until maxEvents of them, for WriteProfileTrace
+  void StartProfileTrace(std::size_t maxEvents = 1 << 20) {
+    FinishUpdate();
+    Profiler.StartTrace(maxEvents);
+  }
+
+  //Chrome trace_event JSON of everything since StartProfileTrace. Tracing carries on afterwards
+  bool WriteProfileTrace(const std::string &path) {
+    FinishUpdate();
+    return Profiler.WriteTrace(path);
+  }
+#endif
+
+  //Edge culling counters from the last UpdateLights, only counting the lights it actually rebuilt
+  const CasterCullStats& GetCullStats() const {
+    return CullStats;
+  }
+
+  /*
+    Frame capture, for debugging what the lights actually drew. Off by default, and while it's off nothing is queued,
+    read back or written. Captures never stall the frame: readbacks go through a ring of ringSize buffers and are encoded
+    to PNG on a background thread, and a request that finds the ring full is dropped (and counted in GetCaptureStats).
+    Files are written as prefix + "frame<N>_scene.png", "frame<N>_combined.png", "frame<N>_software.png" and
+    "light<index>.<generation>_frame<N>.png".
+  */
+  void EnableCapture(const std::string &prefix = "capture_", unsigned ringSize = 4) {
+    if (!InitGLEW()) {
+      std::cerr << "Frame capture needs GLEW's pixel buffer and sync functions" << std::endl;
+      return;
+    }
+    Capture.reset();
+    Capture = std::make_unique<FrameCapture>(prefix, ringSize);
+  }
+
+  //Waits for anything still in flight, then shuts the capture thread down
+  void DisableCapture() {
+    if (Capture)
+      Capture->Flush();
+    Capture.reset();
+  }
+
+  //Captures every target rendered after the frame-th UpdateLights (see GetFrameNumber)
+  bool CaptureFrame(std::uint64_t frame) {
+    if (!Capture || frame <= FrameNumber)
+      return false;
+    Capture->RequestFrame(frame);
+    return true;
+  }
+
+  //Captures the light's LightMap the next time RenderOntoScene draws it. Only the OpenGL backend has per-light maps
+  bool CaptureLight(const LightHandle &handle) {
+    if (!Capture || Backend != LightBackend::OpenGL || !Lights.Contains(handle))
+      return false;
+    Capture->RequestLight(CaptureKey(handle));
+    return true;
+  }
+
+  //Blocks until every queued capture has been written
+  void FlushCaptures() {
+    if (Capture)
+      Capture->Flush();
+  }
+
+  CaptureStats GetCaptureStats() const {
+    return Capture ? Capture->GetStats() : CaptureStats{};
+  }
+
+  /*
+    Gameplay query: which lights reach each of points (bit per light in out.LitBy, light indices being the positions
+    GetLightAt takes) and the total SuperBright.fsh falloff they get, in out.Intensity. Casters block the same edges
+    that shadow the lights, so call it after UpdateLights. Spread over the same threads as UpdateLights.
+    In ShadowMode::PolarMap each test is a lookup in the light's shadow map instead, so it agrees with what's drawn.
+    Lights culled by the view rect answer with the geometry from when they were last in view.
+  */
+  void QueryVisibility(const std::vector<sf::Vector2f> &points, PointVisibilityResult &out) {
+    CollectDrawLights();
+    QueryLights.clear();
+    for (auto drawn : DrawLights) {
+      const Light &light = *drawn;
+      QueryLights.push_back({ light.Position, light.Attenuation, light.Intensity, &light.Occluders });
+      //A light that hasn't been through an update yet has no map to look in
+      if (Mode == ShadowMode::PolarMap && light.Lod == LightLod::Full && light.ShadowMap.GetBinCount() > 0)
+        QueryLights.back().ShadowMap = &light.ShadowMap;
+    }
+
+    PointQuery.Run(points, QueryLights, Workers, out);
+  }
+
+  /*
+    Per screen tile light lists from the last RenderOntoScene/RenderSoftware. Light indices are positions in the order
+    the lights were drawn in: every light not inside a cluster, in dense order, then the cluster lights. Anything else shading pixels on the CPU can walk these to only
+    evaluate the lights that reach a pixel.
+  */
+  const LightTileGrid& GetScreenTiles() const {
+    return ScreenTiles;
+  }
+
+  //Light at a position in GetScreenTiles' lists (or QueryVisibility's bits), as of the render call or query that made them
+  const Light& GetLightAt(std::size_t index) const {
+    return *DrawLights[index];
+  }
+
+  /*
+    Falloff textures and pooled light maps together are kept under bytes where possible. Textures no light is using are
+    freed to make room; ones still in use never are.
+  */
+  void SetTextureBudget(std::size_t bytes) {
+    Textures.SetBudget(bytes);
+  }
+
+  LightTextureStats GetTextureStats() const {
+    return Textures.GetStats();
+  }
+
+  //How many times UpdateLights has run
+  std::uint64_t GetFrameNumber() const {
+    return FrameNumber;
+  }
+
+  /*
+    Under LightComposite::PerLight the lit scene ends up in SceneTexture. Under Accumulate SceneTexture is only read and the
+    lit scene is written to NewSceneTexture, which has to be the same size.
+  */
   void RenderOntoScene(sf::RenderTexture &SceneTexture, sf::RenderTexture &NewSceneTexture) {
+    LSYS_PROFILE_SCOPE(RenderOntoScene);
+    if (Composite == LightComposite::Accumulate) {
+      AccumulateOntoScene(SceneTexture, NewSceneTexture);
+      return;
+    }
+
     //We should have the light map ready to go, so all we should have to do is blend it
-    sf::RectangleShape rect;
+    sf::RectangleShape &rect = SceneQuad;
     rect.setSize(static_cast<sf::Vector2f>(NewSceneTexture.getSize()));
     sf::RenderStates state;
 
     state.blendMode = sf::BlendAdd;
     state.shader = &BlendShader;
     rect.setTexture(&SceneTexture.getTexture());
-    //rect.setTexture(&LightMaps[light.second.ID].getTexture());
+    //rect.setTexture(&light.Targets->LightMap.getTexture());
     //Now plow it through
     SceneTexture.draw(rect, state);
+    LSYS_PROFILE_COUNT(TargetSwitches, 1);
 
-    //For each light that we have in this system, render a big 'ol quad and push it through the fragment shader
-    for (auto & light : Lights) {
-      CreateLightMap(light.second);
+    //Each light only gets pushed through the fragment shader over the screen tiles its attenuation circle reaches
+    BuildScreenTiles(NewSceneTexture.getSize().x, NewSceneTexture.getSize().y, ScreenTileSize);
+    const sf::Vector2u sceneSize = SceneTexture.getSize();
+    BuildTileQuads({ sceneSize.x / rect.getSize().x, sceneSize.y / rect.getSize().y });
+
+    for (std::size_t i = 0; i < DrawLights.size(); ++i) {
+      if (TileQuads[i].Empty())
+        continue;
+
+      Light &light = *DrawLights[i];
+      sf::FloatRect mapBounds;
+      sf::RenderTexture *lightMap = CreateLightMap(light, mapBounds);
+      CaptureLightMap(light, *lightMap);
 
       //Now that we have the maps, we need to blend it with the scene
-      BlendShader.setUniform("MaskTexture", LightMaps[light.second.ID].getTexture());
+      BlendShader.setUniform("MaskTexture", lightMap->getTexture());
+      BlendShader.setUniform("MaskRect", ScreenMaskRect(mapBounds));
+      BlendShader.setUniform("SceneHeight", static_cast<float>(sceneSize.y));
       BlendShader.setUniform("SceneTexture", SceneTexture.getTexture());
       BlendShader.setUniform("MinimumIntensity", 1.0f);
-      BlendShader.setUniform("LightHue", sf::Glsl::Vec4(light.second.Color.r, light.second.Color.g, light.second.Color.b, light.second.Color.a));
-      BlendShader.setUniform("HueIntensity", light.second.Intensity);
+      BlendShader.setUniform("LightHue", sf::Glsl::Vec4(light.Color.r, light.Color.g, light.Color.b, light.Color.a));
+      BlendShader.setUniform("HueIntensity", light.Intensity);
       BlendShader.setUniform("MaximumIntensity", 5.f);
       BlendShader.setUniform("AmbientColor", sf::Glsl::Vec4(255, 255, 255, 0));
       BlendShader.setUniform("AmbientIntensity", 0.1f);
+      LSYS_PROFILE_COUNT(UniformUploads, 10);
 
       state.blendMode = sf::BlendAlpha;
       state.shader = &BlendShader;
-      rect.setTexture(&SceneTexture.getTexture());
-      //rect.setTexture(&LightMaps[light.second.ID].getTexture());
-      //Now plow it through
-      SceneTexture.draw(rect, state);
+      state.texture = &SceneTexture.getTexture();
+      DrawMesh(SceneTexture, TileQuads[i], state);
+      LSYS_PROFILE_COUNT(TargetSwitches, 1);
+
+      //Already drawn from, so the next light can reuse it
+      Textures.ReleaseLightMap(lightMap);
+    }
+
+    if (Capture && Capture->IsFrameRequested(FrameNumber))
+      Capture->ReadBack(SceneTexture, "frame" + std::to_string(FrameNumber) + "_scene.png");
+  }
+
+  /*
+    Same result as RenderOntoScene, but done on the CPU into a float RGBA image, so it works without a GL context.
+    Works with either backend, as long as UpdateLights has been run.
+  */
+  void RenderSoftware(SoftwareLightTarget &Scene) {
+    LSYS_PROFILE_SCOPE(RenderSoftware);
+    BuildScreenTiles(Scene.Width, Scene.Height, SoftwareLightRenderer::TileSize);
+
+    SoftwareInputs.clear();
+    for (auto drawn : DrawLights) {
+      const Light &light = *drawn;
+      SoftwareLight input;
+      input.Position = light.Position;
+      input.Attenuation = light.Attenuation;
+      input.Color = light.Color;
+      input.Intensity = light.Intensity;
+      //Culled lights have no tiles anyway, this just keeps their triangles from being set up
+      input.LitRegion = light.Visible ? &light.LightVerts : &NoGeometry;
+      input.ShadowRegion = light.Visible ? &light.Shadowverts : &NoGeometry;
+      SoftwareInputs.push_back(input);
     }
 
+    Software.SetViewTransform(HasView ? sf::Vector2f(View.left, View.top) : sf::Vector2f(), ScreenScale());
+    Software.Render(Scene, SoftwareInputs, ScreenTiles, Workers);
+
+    if (Capture && Capture->IsFrameRequested(FrameNumber))
+      Capture->Capture(Scene, "frame" + std::to_string(FrameNumber) + "_software.png");
   }
 
-  void GPUInit(sf::RenderWindow &CurrentWindow)
+  //The window only has to have made its context current, nothing is read from it
+  void GPUInit(sf::RenderWindow &/*CurrentWindow*/)
   {
+    if (!InitGLEW())
+      return;
+
     auto settings = sf::Context::getActiveContext()->getSettings();
     if (settings.majorVersion < 4 || (settings.majorVersion == 4 && settings.minorVersion < 3)) {
       std::cerr << "Incompatable context version made. A 4.3+ context is required" << std::endl;
       return;
     }
 
-    light_stc_data_type light_alloc;
-    light_alloc.light_attenuation = 0.f;
-    light_alloc.light_color = sf::Glsl::Vec4(0.f, 0.f, 0.f, 0.f);
-    light_alloc.light_position = sf::Glsl::Vec2(0.f, 0.f);
-
-    edge_data_type edge_alloc;
-    edge_alloc.Edges = new sf::Glsl::Vec4[1];
-
-    //Generate the buffers for the SSBO
-    glGenBuffers(1, &LightSSBOBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, LightSSBOBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(light_stc_data_type), &light_alloc, GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, LightSSBOBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    //The scene buffers stay persistently mapped, which needs buffer storage (core in 4.4)
+    if (settings.majorVersion == 4 && settings.minorVersion < 4 && !GLEW_ARB_buffer_storage) {
+      std::cerr << "GL_ARB_buffer_storage is required for the GPU path" << std::endl;
+      return;
+    }
 
-    glGenBuffers(1, &EdgeSSBOBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, EdgeSSBOBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(sf::Glsl::Vec4), &edge_alloc, GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, EdgeSSBOBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    delete[] edge_alloc.Edges;
+    //The buffers themselves are created on the first GPURender, once there's something to put in them
+    GPUBuffers = std::make_unique<GPUSceneBuffers>();
+    GPUEdgesDirty = true;
+    UseGPU = true;
   }
 
+  /*
+    Packs every light (and the caster edges, when they've changed) for SSBOLighting.fsh and uploads whatever differs
+    from last frame. Leaves the blocks bound at GPUSceneBuffers::LightBinding/EdgeBinding for the draw that follows.
+  */
   void GPURender()
   {
-    //Oh god, here we go
-    
-    //update light data
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, LightSSBOBuffer);
-    GLvoid *p = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-    memcpy(p, &TestGPULight, sizeof(light_stc_data_type));
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-    
+    if (!GPUBuffers)
+      return;
+
+    CollectDrawLights();
+    GPUPacker.SetLightCount(DrawLights.size());
+    for (std::size_t i = 0; i < DrawLights.size(); ++i) {
+      const Light &light = *DrawLights[i];
+      GPUPacker.SetLight(i, light.Color, light.Position, light.Attenuation, light.Intensity);
+    }
+
+    if (GPUEdgesDirty) {
+      if (DynamicEdges.Empty() && BakedScene.GetResident().empty())
+        GPUPacker.SetEdges(WorldEdges);
+      else {
+        GPUEdges = WorldEdges;
+        GPUEdges.Append(DynamicEdges);
+        for (auto index : BakedScene.GetResident())
+          GPUEdges.Append(BakedScene.GetChunk(index).Edges);
+        GPUPacker.SetEdges(GPUEdges);
+      }
+      GPUEdgesDirty = false;
+    }
+
+    GPUBuffers->Upload(GPUPacker);
+  }
+
+  /*
+    How RenderOntoScene puts the lights on the scene, see LightComposite. precision is what GlobalLightMap is kept as under
+    Accumulate; it's remade at the scene's size on the next RenderOntoScene when either changes. RenderSoftware follows
+    the same setting, so its two modes can be checked against each other without a GL context.
+  */
+  void SetLightComposite(LightComposite composite, LightBufferPrecision precision = LightBufferPrecision::RGBA8) {
+    Composite = composite;
+    BufferPrecision = precision;
+    Software.SetAccumulate(composite == LightComposite::Accumulate, precision);
+  }
+
+  LightComposite GetLightComposite() const {
+    return Composite;
+  }
+
+  void SetShadowMode(ShadowMode mode) {
+    if (Mode == mode)
+      return;
+
+    FinishUpdate();
+    Mode = mode;
+    ForEachDrawnLight([](Light &light) { light.Dirty = true; });
+  }
+
+  ShadowMode GetShadowMode() const {
+    return Mode;
   }
 
   void SetWindowHeight(float h) {
@@ -229,102 +1027,598 @@ public:
   }
   
 protected:
-  void CreateLightTexture(const Light &light) {
-    LightShader.setUniform("LightColor", sf::Glsl::Vec3(255, 255, 255));
-    LightShader.setUniform("LightOrigin", light.Position);
-    LightShader.setUniform("Attenuation", light.Attenuation);
-    LightShader.setUniform("ScreenResolution", sf::Glsl::Vec2(WindowHeight, WindowHeight));
-
-    LightTextures[light.ID].create(800, 800);
-    LightTextures[light.ID].clear(sf::Color::Transparent);
-    ShadowMaps[light.ID].create(800, 800);
-    ShadowMaps[light.ID].clear(sf::Color::Transparent);
-    LightMaps[light.ID].create(800, 800);
-    LightMaps[light.ID].clear(sf::Color::Transparent);
-   
-    sf::CircleShape circle;
-    circle.setRadius(light.Attenuation);
-    circle.setOrigin(light.Attenuation, light.Attenuation);
-    circle.setPosition({ 400, 400 });
-    circle.setFillColor(sf::Color::Transparent);
+  CasterHandle InsertCaster(LightObject &&caster) {
+    if (!caster.Edges.empty())
+      caster.Min = caster.Max = caster.Edges.front().Start;
+
+    for (auto & edge : caster.Edges) {
+      caster.Min.x = std::min({ caster.Min.x, edge.Start.x, edge.End.x }); caster.Min.y = std::min({ caster.Min.y, edge.Start.y, edge.End.y });
+      caster.Max.x = std::max({ caster.Max.x, edge.Start.x, edge.End.x }); caster.Max.y = std::max({ caster.Max.y, edge.Start.y, edge.End.y });
+    }
+
+    //WorldEdges and the grid are rebuilt once on the next update, so adding a pile of casters in a row stays linear
+    CasterEdgesDirty = true;
+    return Casters.Insert(std::move(caster));
+  }
+
+  //Replaces one chunk's caster with a fresh trace of its tiles
+  void TraceChunk(TileLayerCasters &layer, const std::vector<std::uint8_t> &solid, unsigned cx, unsigned cy) {
+    CasterHandle &chunk = layer.Chunks[static_cast<std::size_t>(cy) * layer.ChunkColumns + cx];
+    if (!chunk.IsNull())
+      RemoveShadowCaster(chunk);
+    chunk = CasterHandle();
+
+    const unsigned x0 = cx * layer.ChunkSize, y0 = cy * layer.ChunkSize;
+    Tracer.Trace(solid.data(), layer.Width, layer.Height, x0, y0, x0 + layer.ChunkSize, y0 + layer.ChunkSize,
+                 layer.TileSize, layer.Origin, TracedEdges);
+    if (TracedEdges.empty())
+      return;
+
+    LightObject caster;
+    caster.Edges = TracedEdges;
+    caster.Outline = true;
+    chunk = InsertCaster(std::move(caster));
+  }
+
+  //Rebuilds every light in UpdateOrder on pool, one scratch per worker
+  void RunLightUpdates(LightWorkerPool &pool) {
+    Scratch.resize(pool.GetThreadCount());
+    for (auto & scratch : Scratch)
+      scratch.CullStats = {};
+
+    //Each light only writes to its own vertex arrays, so they can go in any order on any thread
+    pool.Run(UpdateOrder.size(), [this](std::size_t index, unsigned worker) {
+      LSYS_PROFILE_SCOPE(UpdateLight);
+      Light &light = *UpdateOrder[index];
+      UpdateLight(light, Scratch[worker]);
+      light.Occluders = Scratch[worker].Batch;
+      LSYS_PROFILE_COUNT(ShadowTriangles, light.LightVerts.GetTriangleCount() + light.Shadowverts.GetTriangleCount());
+    });
+
+    LSYS_PROFILE_COUNT(LightsProcessed, UpdateOrder.size());
+    for (auto & scratch : Scratch)
+      LSYS_PROFILE_COUNT(EdgesTested, scratch.CullStats.CandidateEdges);
+  }
+
+  /*
+    Decides which lights the view rect culls and which ones drop to a cheaper LOD. A light whose LOD changed has to be
+    rebuilt, so it's dirtied here.
+  */
+  void ClassifyLights() {
+    ViewStats = {};
+    ForEachDrawnLight([this](Light &light) {
+      ViewStats.Lights++;
+      LightLod lod = LightLod::Full;
+      light.Visible = true;
+      if (HasView) {
+        //Nearest point of the view to the light
+        const float x = std::min(std::max(light.Position.x, View.left), View.left + View.width) - light.Position.x;
+        const float y = std::min(std::max(light.Position.y, View.top), View.top + View.height) - light.Position.y;
+        light.Visible = x * x + y * y <= light.Attenuation * light.Attenuation;
+        if (light.Attenuation * PixelsPerUnit < LodRadius)
+          lod = LightLod::Unshadowed;
+      }
+
+      if (!light.Visible) {
+        ViewStats.Culled++;
+        return;
+      }
+      if (lod != LightLod::Full)
+        ViewStats.Downgraded++;
+      if (lod != light.Lod) {
+        light.Lod = lod;
+        light.Dirty = true;
+      }
+    });
+  }
+
+  //Every light UpdateLights builds geometry for and the render calls draw: the lights not inside a cluster, then the cluster lights
+  template <typename Function>
+  void ForEachDrawnLight(Function &&function) {
+    for (auto & light : Lights) {
+      if (!light.Clustered)
+        function(light);
+    }
+    for (std::size_t i = 0; i < ActiveClusters; ++i)
+      function(ClusterLights[i]);
+  }
+
+  //Pointers into Lights, so this is redone by every call that uses it rather than once per UpdateLights
+  void CollectDrawLights() {
+    DrawLights.clear();
+    ForEachDrawnLight([this](Light &light) { DrawLights.push_back(&light); });
+  }
+
+  /*
+    Rebuilds the cluster tree if any light was added or removed, and refits it if any moved, then cuts it for this
+    frame's view. A refit that leaves some node's Error more than ClusterRebuildGrowth of the error budget over what a
+    fresh tree gave it rebuilds too, since the splits no longer match where the lights are. The lights under a node of
+    the cut with more than one light are drawn through a cluster light placed on that node's aggregate. A light that
+    comes back out of a cluster is dirtied, since its own geometry is as old as when it went in, and so is a cluster
+    light that goes unused, for the same reason.
+
+    A quarter of the budget is kept back for the cluster lights: the cut is to three quarters of it, and a cluster light
+    stays where it was while its node's aggregate is within the rest (see PlaceClusterLight). So particles jittering in
+    place don't rebuild every cluster light every frame.
+  */
+  void BuildLightClusters() {
+    const float maxError = ClusterError / (HasView ? PixelsPerUnit : 1.f);
+    const float slack = maxError * 0.25f;
+
+    ClusterCut.clear();
+    if (ClusterError > 0.f && !Lights.Empty()) {
+      if (ClusterTreeDirty || ClusterRefit) {
+        ClusterInputs.clear();
+        for (auto & light : Lights)
+          ClusterInputs.push_back({ light.Position, light.Attenuation, light.Radius, light.Expand, light.Intensity, light.Color });
+        if (ClusterTreeDirty || ClusterTree.Refit(ClusterInputs) > maxError * ClusterRebuildGrowth)
+          ClusterTree.Build(ClusterInputs, ClusterColorDistance);
+      }
+      ClusterTree.Cut(maxError - slack, HasView ? &View : nullptr, ClusterCut);
+    }
+    ClusterTreeDirty = false;
+    ClusterRefit = false;
+
+    InCluster.assign(Lights.Size(), 0);
+    std::size_t active = 0;
+    for (auto n : ClusterCut) {
+      const LightClusterNode &node = ClusterTree.GetNode(n);
+      if (node.Count == 1)
+        continue;
+
+      const std::uint32_t *members = ClusterTree.GetOrder().data() + node.First;
+      for (std::uint32_t i = 0; i < node.Count; ++i)
+        InCluster[members[i]] = 1;
+
+      if (ClusterLights.size() == active)
+        ClusterLights.emplace_back();
+      PlaceClusterLight(ClusterLights[active], node, static_cast<std::uint32_t>(active), slack);
+      ++active;
+    }
+
+    for (std::size_t i = 0; i < Lights.Size(); ++i) {
+      Light &light = Lights[i];
+      light.Dirty = light.Dirty || (light.Clustered && !InCluster[i]);
+      light.Clustered = InCluster[i] != 0;
+    }
+    for (std::size_t i = active; i < ActiveClusters; ++i)
+      ClusterLights[i].Dirty = true;
+    ActiveClusters = active;
+
+    ClusterStats = {};
+    ClusterStats.Lights = Lights.Size();
+    ClusterStats.Clusters = active;
+    ClusterStats.ClusteredLights = static_cast<std::size_t>(std::count(InCluster.begin(), InCluster.end(), 1));
+    ClusterStats.DrawnLights = Lights.Size() - ClusterStats.ClusteredLights + active;
+  }
+
+  /*
+    Puts a cluster light on node's aggregate light, and dirties it if that moved or changed it. It's placed reaching slack
+    further than the aggregate does, and left alone while the aggregate is within slack of it and it still reaches
+    everything the aggregate does
+  */
+  void PlaceClusterLight(Light &light, const LightClusterNode &node, std::uint32_t slot, float slack) {
+    const sf::Color color(static_cast<std::uint8_t>(node.Color[0] + 0.5f), static_cast<std::uint8_t>(node.Color[1] + 0.5f),
+                          static_cast<std::uint8_t>(node.Color[2] + 0.5f), static_cast<std::uint8_t>(node.Color[3] + 0.5f));
+    light.Cluster = slot;
+    const sf::Vector2f d = node.Position - light.Position;
+    const float drift = std::sqrt(d.x * d.x + d.y * d.y);
+    if (drift <= slack && light.Attenuation >= node.Attenuation + drift && light.Radius >= node.Radius + drift &&
+        light.Color == color && light.Intensity == node.Intensity && light.Expand == node.Expand)
+      return;
+
+    //Rounded up to steps of about 9%, so clusters share falloff textures instead of each needing their own
+    const float attenuation = std::exp2(std::ceil(std::log2(std::max(node.Attenuation + slack, 1.f)) * 8.f) / 8.f);
+    const bool resized = light.Attenuation != attenuation;
+    light.Position = node.Position;
+    light.Attenuation = attenuation;
+    light.Color = color;
+    light.Intensity = node.Intensity;
+    light.Radius = node.Radius + slack;
+    light.Expand = node.Expand;
+    light.Dirty = true;
+    if (resized) {
+      const unsigned falloffSize = LightTextureCache::FalloffSize(attenuation);
+      light.TextureSize = { falloffSize, falloffSize };
+      if (Backend == LightBackend::OpenGL)
+        CreateLightTexture(light);
+    }
+  }
+
+  void SumCullStats() {
+    CullStats = {};
+    for (auto & scratch : Scratch) {
+      CullStats.Lights += scratch.CullStats.Lights;
+      CullStats.TotalEdges += scratch.CullStats.TotalEdges;
+      CullStats.CandidateEdges += scratch.CullStats.CandidateEdges;
+      CullStats.CulledEdges += scratch.CullStats.CulledEdges;
+      CullStats.BackFacingEdges += scratch.CullStats.BackFacingEdges;
+    }
+  }
+
+  //Everything UpdateLight reads, and nothing else: the falloff and the current geometry stay with the real light
+  static void StageLight(const Light &from, Light &to) {
+    to.Handle = from.Handle;
+    to.Cluster = from.Cluster;
+    to.Position = from.Position;
+    to.Attenuation = from.Attenuation;
+    to.Radius = from.Radius;
+    to.Color = from.Color;
+    to.Expand = from.Expand;
+    to.Intensity = from.Intensity;
+    to.TextureSize = from.TextureSize;
+    to.ShadowBins = from.ShadowBins;
+    to.Lod = from.Lod;
+  }
+
+  /*
+    Bins every drawn light's attenuation circle into width x height screen tiles, moved onto the screen by the view rect
+    (see ToScreen). Culled lights get no tiles, so they aren't drawn
+  */
+  void BuildScreenTiles(unsigned width, unsigned height, unsigned tileSize) {
+    CollectDrawLights();
+    TileCircles.clear();
+    for (auto light : DrawLights)
+      TileCircles.push_back({ ToScreen(light->Position), light->Visible ? light->Attenuation * ScreenScale() : 0.f });
+    ScreenTiles.Build(width, height, tileSize, TileCircles);
+  }
+
+  //Where a world position is on the scene: the view rect's top left is pixel (0, 0), scaled by its pixels per unit
+  sf::Vector2f ToScreen(const sf::Vector2f &position) const {
+    return HasView ? (position - sf::Vector2f(View.left, View.top)) * PixelsPerUnit : position;
+  }
+
+  float ScreenScale() const {
+    return HasView ? PixelsPerUnit : 1.f;
+  }
+
+  //A light map's bounds from CreateLightMap, as MaskRect in scene pixels
+  sf::Glsl::Vec4 ScreenMaskRect(const sf::FloatRect &mapBounds) const {
+    const sf::Vector2f topLeft = ToScreen({ mapBounds.left, mapBounds.top });
+    return sf::Glsl::Vec4(topLeft.x, topLeft.y, mapBounds.width * ScreenScale(), mapBounds.height * ScreenScale());
+  }
+
+  /*
+    One mesh per light covering the tiles that list it, for BlendShader to be drawn through instead of a full screen quad.
+    Tiles next to each other on a row are merged into one quad. texScale maps screen positions to SceneTexture pixels.
+  */
+  void BuildTileQuads(const sf::Vector2f &texScale) {
+    TileQuads.resize(DrawLights.size());
+    for (auto & mesh : TileQuads)
+      mesh.Clear();
+    LastTile.assign(DrawLights.size(), NoTile);
+
+    for (std::size_t tile = 0; tile < ScreenTiles.GetTileCount(); ++tile) {
+      const sf::IntRect r = ScreenTiles.GetTileRect(tile);
+      const float x0 = static_cast<float>(r.left), y0 = static_cast<float>(r.top);
+      const float x1 = x0 + r.width, y1 = y0 + r.height;
+
+      for (const std::uint32_t *it = ScreenTiles.TileBegin(tile); it != ScreenTiles.TileEnd(tile); ++it) {
+        LightMesh &mesh = TileQuads[*it];
+
+        //Carries straight on from this light's last tile, so its quad just gets wider
+        if (LastTile[*it] + 1 == tile && r.left != 0) {
+          sf::Vertex *quad = &mesh.Vertices[mesh.Vertices.size() - 4];
+          quad[1].position.x = quad[2].position.x = x1;
+          quad[1].texCoords.x = quad[2].texCoords.x = x1 * texScale.x;
+        }
+        else {
+          const std::uint32_t first = mesh.AddVertex(sf::Vertex({ x0, y0 }, { x0 * texScale.x, y0 * texScale.y }));
+          mesh.AddVertex(sf::Vertex({ x1, y0 }, { x1 * texScale.x, y0 * texScale.y }));
+          mesh.AddVertex(sf::Vertex({ x1, y1 }, { x1 * texScale.x, y1 * texScale.y }));
+          mesh.AddVertex(sf::Vertex({ x0, y1 }, { x0 * texScale.x, y1 * texScale.y }));
+          mesh.AddTriangle(first, first + 1, first + 2);
+          mesh.AddTriangle(first, first + 2, first + 3);
+        }
+        LastTile[*it] = tile;
+      }
+    }
+  }
+
+  static std::uint64_t CaptureKey(const LightHandle &handle) {
+    return (static_cast<std::uint64_t>(handle.Generation) << 32) | handle.Index;
+  }
+
+  /*
+    Everything past GL 1.1 (the separate blend functions in DrawMesh, FrameCapture's pixel buffers and fences, the
+    GPUSceneBuffers storage) goes through GLEW, whose function pointers stay null until glewInit has run with a context
+    current. That happens once, from the first OpenGL LSystem. If the caller hasn't made a window yet, a context is made
+    just for it.
+  */
+  static bool InitGLEW() {
+    static const bool ready = [] {
+      std::unique_ptr<sf::Context> context;
+      if (!sf::Context::getActiveContext())
+        context = std::make_unique<sf::Context>();
+
+      glewExperimental = GL_TRUE;
+      const GLenum result = glewInit();
+      if (result != GLEW_OK) {
+        std::cerr << "glewInit failed: " << glewGetErrorString(result) << std::endl;
+        return false;
+      }
+      return true;
+    }();
+    return ready;
+  }
+
+  /*
+    sf::RenderTarget can't draw indexed geometry, so this sets up the same state SFML would (view, transform, blend mode,
+    texture in pixel coordinates, shader) and hands the mesh straight to glDrawElements.
+    SFML's cached GL state is reset afterwards so its own draws don't trip over ours.
+    Without GLEW the mesh is expanded into a vertex array and drawn by SFML instead, which sets the blend state itself.
+  */
+  static void DrawMesh(sf::RenderTarget &target, const LightMesh &mesh, const sf::RenderStates &states) {
+    if (mesh.Empty())
+      return;
+    if (!InitGLEW()) {
+      sf::VertexArray triangles(sf::Triangles, mesh.Indices.size());
+      for (std::size_t i = 0; i < mesh.Indices.size(); ++i)
+        triangles[i] = mesh.Vertices[mesh.Indices[i]];
+      target.draw(triangles, states);
+      return;
+    }
+    if (!target.setActive(true))
+      return;
+
+    target.resetGLStates();
+
+    const sf::View &view = target.getView();
+    const sf::IntRect viewport = target.getViewport(view);
+    glViewport(viewport.left, static_cast<GLint>(target.getSize().y) - (viewport.top + viewport.height), viewport.width, viewport.height);
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(view.getTransform().getMatrix());
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(states.transform.getMatrix());
+
+    const sf::BlendMode &blend = states.blendMode;
+    glBlendFuncSeparate(ToGLFactor(blend.colorSrcFactor), ToGLFactor(blend.colorDstFactor),
+                        ToGLFactor(blend.alphaSrcFactor), ToGLFactor(blend.alphaDstFactor));
+    glBlendEquationSeparate(ToGLEquation(blend.colorEquation), ToGLEquation(blend.alphaEquation));
+
+    sf::Texture::bind(states.texture, sf::Texture::Pixels);
+    sf::Shader::bind(states.shader);
 
-    LightTextures[light.ID].draw(circle, &LightShader);
-    LightTextures[light.ID].display();
+    const char *data = reinterpret_cast<const char*>(mesh.Vertices.data());
+    glVertexPointer(2, GL_FLOAT, sizeof(sf::Vertex), data + offsetof(sf::Vertex, position));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(sf::Vertex), data + offsetof(sf::Vertex, color));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(sf::Vertex), data + offsetof(sf::Vertex, texCoords));
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(mesh.Indices.size()), GL_UNSIGNED_INT, mesh.Indices.data());
 
-    auto image = LightTextures[light.ID].getTexture().copyToImage();
-    image.saveToFile("NEWLIGHTSYSTEMTEST" + std::to_string(light.ID) + ".png");
+    sf::Shader::bind(nullptr);
+    target.resetGLStates();
+  }
+
+  void CaptureLightMap(const Light &light, sf::RenderTexture &lightMap) {
+    if (Capture && Capture->HasLightRequests() && !light.Handle.IsNull() && Capture->TakeLight(CaptureKey(light.Handle))) {
+      Capture->ReadBack(lightMap, "light" + std::to_string(light.Handle.Index) + "." +
+                        std::to_string(light.Handle.Generation) + "_frame" + std::to_string(FrameNumber) + ".png");
+    }
+  }
+
+  /*
+    LightComposite::Accumulate. Each light still gets its own light map, but only its tile quads are drawn, and into
+    GlobalLightMap with additive blending rather than through the scene. The scene is read once, by the composite.
+  */
+  void AccumulateOntoScene(sf::RenderTexture &SceneTexture, sf::RenderTexture &NewSceneTexture) {
+    const sf::Vector2u sceneSize = SceneTexture.getSize();
+    PrepareLightBuffer(sceneSize);
+    const float logScale = LightAccumulation::LogScale(BufferPrecision);
+
+    sf::RectangleShape &rect = SceneQuad;
+    rect.setSize(static_cast<sf::Vector2f>(NewSceneTexture.getSize()));
+    BuildScreenTiles(NewSceneTexture.getSize().x, NewSceneTexture.getSize().y, ScreenTileSize);
+    BuildTileQuads({ sceneSize.x / rect.getSize().x, sceneSize.y / rect.getSize().y });
+
+    GlobalLightMap.clear(sf::Color::Transparent);
+    LSYS_PROFILE_COUNT(TargetSwitches, 1);
+    AccumulateShader.setUniform("SceneHeight", static_cast<float>(sceneSize.y));
+    AccumulateShader.setUniform("LogScale", logScale);
+    LSYS_PROFILE_COUNT(UniformUploads, 2);
+
+    sf::RenderStates state;
+    state.blendMode = sf::BlendMode(sf::BlendMode::One, sf::BlendMode::One, sf::BlendMode::Add);
+    state.shader = &AccumulateShader;
+    for (std::size_t i = 0; i < DrawLights.size(); ++i) {
+      if (TileQuads[i].Empty())
+        continue;
+
+      Light &light = *DrawLights[i];
+      sf::FloatRect mapBounds;
+      sf::RenderTexture *lightMap = CreateLightMap(light, mapBounds);
+      CaptureLightMap(light, *lightMap);
+
+      AccumulateShader.setUniform("MaskTexture", lightMap->getTexture());
+      AccumulateShader.setUniform("MaskRect", ScreenMaskRect(mapBounds));
+      AccumulateShader.setUniform("LightHue", sf::Glsl::Vec4(light.Color.r, light.Color.g, light.Color.b, light.Color.a));
+      AccumulateShader.setUniform("HueIntensity", light.Intensity);
+      LSYS_PROFILE_COUNT(UniformUploads, 4);
+
+      DrawMesh(GlobalLightMap, TileQuads[i], state);
+      LSYS_PROFILE_COUNT(TargetSwitches, 1);
+      Textures.ReleaseLightMap(lightMap);
+    }
+    GlobalLightMap.display();
+
+    //The one pass that touches every pixel of the scene
+    CompositeShader.setUniform("SceneTexture", sf::Shader::CurrentTexture);
+    CompositeShader.setUniform("LightBuffer", GlobalLightMap.getTexture());
+    CompositeShader.setUniform("LightBufferSize", static_cast<sf::Glsl::Vec2>(LightBufferSize));
+    CompositeShader.setUniform("LogScale", logScale);
+    LSYS_PROFILE_COUNT(UniformUploads, 4);
+
+    state.blendMode = sf::BlendNone;
+    state.shader = &CompositeShader;
+    rect.setTexture(&SceneTexture.getTexture());
+    NewSceneTexture.draw(rect, state);
+    LSYS_PROFILE_COUNT(TargetSwitches, 1);
+
+    if (Capture && Capture->IsFrameRequested(FrameNumber)) {
+      Capture->ReadBack(GlobalLightMap, "frame" + std::to_string(FrameNumber) + "_lightbuffer.png");
+      Capture->ReadBack(NewSceneTexture, "frame" + std::to_string(FrameNumber) + "_scene.png");
+    }
+  }
+
+  //(Re)makes GlobalLightMap at size. SFML only makes 8 bit render textures, so for Float16 the texture's storage is
+  //swapped out from under its framebuffer
+  void PrepareLightBuffer(const sf::Vector2u &size) {
+    if (size == LightBufferSize && BufferPrecision == LightBufferMade)
+      return;
+
+    GlobalLightMap.create(size.x, size.y);
+    if (BufferPrecision == LightBufferPrecision::Float16) {
+      GlobalLightMap.setActive(true);
+      sf::Texture::bind(&GlobalLightMap.getTexture());
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+      sf::Texture::bind(nullptr);
+      GlobalLightMap.setActive(false);
+    }
+    LightBufferSize = size;
+    LightBufferMade = BufferPrecision;
+  }
+
+  static GLenum ToGLFactor(sf::BlendMode::Factor factor) {
+    switch (factor) {
+      case sf::BlendMode::Zero:             return GL_ZERO;
+      case sf::BlendMode::One:              return GL_ONE;
+      case sf::BlendMode::SrcColor:         return GL_SRC_COLOR;
+      case sf::BlendMode::OneMinusSrcColor: return GL_ONE_MINUS_SRC_COLOR;
+      case sf::BlendMode::DstColor:         return GL_DST_COLOR;
+      case sf::BlendMode::OneMinusDstColor: return GL_ONE_MINUS_DST_COLOR;
+      case sf::BlendMode::SrcAlpha:         return GL_SRC_ALPHA;
+      case sf::BlendMode::OneMinusSrcAlpha: return GL_ONE_MINUS_SRC_ALPHA;
+      case sf::BlendMode::DstAlpha:         return GL_DST_ALPHA;
+      case sf::BlendMode::OneMinusDstAlpha: return GL_ONE_MINUS_DST_ALPHA;
+    }
+    return GL_ZERO;
+  }
+
+  static GLenum ToGLEquation(sf::BlendMode::Equation equation) {
+    switch (equation) {
+      case sf::BlendMode::Add:             return GL_FUNC_ADD;
+      case sf::BlendMode::Subtract:        return GL_FUNC_SUBTRACT;
+      case sf::BlendMode::ReverseSubtract: return GL_FUNC_REVERSE_SUBTRACT;
+    }
+    return GL_FUNC_ADD;
+  }
+
+  //The falloff is white, the light's color goes in when it's blended with the scene, so only the attenuation tells them apart
+  void CreateLightTexture(Light &light) {
+    light.Falloff = Textures.GetFalloff(light.Attenuation, sf::Color::White, [this](sf::RenderTexture &target, float attenuation, const sf::Color &color) {
+      //Centered in the texture, which is what UpdateLight's texCoords assume
+      const sf::Vector2f size = static_cast<sf::Vector2f>(target.getSize());
+      LightShader.setUniform("LightColor", sf::Glsl::Vec3(color.r, color.g, color.b));
+      LightShader.setUniform("LightOrigin", size / 2.f);
+      LightShader.setUniform("Attenuation", attenuation);
+      LightShader.setUniform("ScreenResolution", sf::Glsl::Vec2(size.x, size.y));
+      LSYS_PROFILE_COUNT(UniformUploads, 4);
+      LSYS_PROFILE_COUNT(TargetSwitches, 1);
+
+      sf::CircleShape circle;
+      circle.setRadius(attenuation);
+      circle.setOrigin(attenuation, attenuation);
+      circle.setPosition(size / 2.f);
+      circle.setFillColor(sf::Color::Transparent);
+
+      target.draw(circle, &LightShader);
+    });
   }
 
   void CreateCombinedLightMap(sf::RenderTexture &Target)
   {
-    static bool once = false;
-
     sf::CircleShape circle;
     sf::RenderStates state;
 
     state.blendMode = sf::BlendMultiply;
 
     Target.clear(sf::Color::Transparent);
-    for (auto & light : Lights) {
-      LightShader.setUniform("LightColor", sf::Glsl::Vec3(light.second.Color.r, light.second.Color.g, light.second.Color.b));
-      LightShader.setUniform("LightOrigin", light.second.Position);
-      LightShader.setUniform("Attenuation", light.second.Attenuation);
+    LSYS_PROFILE_COUNT(TargetSwitches, 1);
+    CollectDrawLights();
+    for (auto drawn : DrawLights) {
+      const Light &light = *drawn;
+      if (!light.Visible)
+        continue;
+
+      LightShader.setUniform("LightColor", sf::Glsl::Vec3(light.Color.r, light.Color.g, light.Color.b));
+      LightShader.setUniform("LightOrigin", light.Position);
+      LightShader.setUniform("Attenuation", light.Attenuation);
       LightShader.setUniform("ScreenResolution", sf::Glsl::Vec2(WindowHeight, WindowHeight));
+      LSYS_PROFILE_COUNT(UniformUploads, 4);
 
       state.shader = &LightShader;
       state.blendMode = sf::BlendAdd;
-      circle.setRadius(light.second.Attenuation);
-      circle.setOrigin(light.second.Attenuation, light.second.Attenuation);
-      circle.setPosition(light.second.Position);
+
+      //The lit fan is already clipped to what the light can see
+      if (Mode != ShadowMode::EdgeQuads && Mode != ShadowMode::Penumbra) {
+        DrawMesh(Target, light.LightVerts, state);
+        continue;
+      }
+
+      circle.setRadius(light.Attenuation);
+      circle.setOrigin(light.Attenuation, light.Attenuation);
+      circle.setPosition(light.Position);
       circle.setFillColor(sf::Color::Transparent);
 
       Target.draw(circle, state);
     }
 
+    //Every light's shadows, straight out of the light's own mesh - there's no second, combined copy
     state.blendMode = sf::BlendAlpha;
     state.shader = nullptr;
-    Target.draw(ShadowRegions, state);
-
-    //for (auto & light : Lights) {
-    //  state.blendMode = sf::BlendAlpha;
-    //  state.shader = nullptr;
-    //  
-    //  Target.draw(light.second.Shadowverts, state);
-    //}
+    for (auto light : DrawLights) {
+      if (light->Visible)
+        DrawMesh(Target, light->Shadowverts, state);
+    }
 
     Target.display();
     state.blendMode = sf::BlendAlpha;
     state.texture = &Target.getTexture();
-    for (auto & light : Lights) {
-      Target.draw(light.second.Shadowverts, state);
+    for (auto light : DrawLights) {
+      if (light->Visible)
+        DrawMesh(Target, light->Shadowverts, state);
     }
 
-    if (!once) {
-      auto image = Target.getTexture().copyToImage();
-      image.saveToFile("combinedlightmap.png");
-      once = true;
-    }
+    if (Capture && Capture->IsFrameRequested(FrameNumber))
+      Capture->ReadBack(Target, "frame" + std::to_string(FrameNumber) + "_combined.png");
   }
 
-  void CreateLightMap(const Light &light) {
+  /*
+    Draws the light into a pooled target that only covers its attenuation square (nothing outside it is lit).
+    bounds is where that target sits in the scene. The caller hands the target back to Textures once it's been used.
+  */
+  sf::RenderTexture* CreateLightMap(const Light &light, sf::FloatRect &bounds) {
+    LSYS_PROFILE_SCOPE(CreateLightMap);
+    LSYS_PROFILE_COUNT(TargetSwitches, 1);
+    const unsigned size = LightTextureCache::FalloffSize(light.Attenuation);
+    sf::RenderTexture *map = Textures.AcquireLightMap(size, size);
+
+    //Pooled targets can be bigger than asked for, the view just covers more of the scene then
+    const sf::Vector2u mapSize = map->getSize();
+    bounds = sf::FloatRect(std::floor(light.Position.x - light.Attenuation) - 1.f, std::floor(light.Position.y - light.Attenuation) - 1.f,
+                           static_cast<float>(mapSize.x), static_cast<float>(mapSize.y));
+    map->setView(sf::View(bounds));
+
     //Just render the radial shader onto the texture, then apply the shadow regions
-    sf::RectangleShape rect;
-    rect.setSize(static_cast<sf::Vector2f>(LightTextures[light.ID].getSize()));
-    rect.setTexture(&LightTextures[light.ID].getTexture());
     sf::RenderStates state;
 
     //Now draw the normal radial light gradient to the LightMap texture using our light triangles
-    state.texture = &LightTextures[light.ID].getTexture();
-    LightMaps[light.ID].clear(sf::Color::Transparent);
-    LightMaps[light.ID].draw(light.LightVerts, state);
+    state.texture = &light.Falloff->getTexture();
+    map->clear(sf::Color::Transparent);
+    DrawMesh(*map, light.LightVerts, state);
 
     //Now draw the shadow regions
     state.blendMode = sf::BlendMultiply; //We want the black regions to COMPLETELY remove the lighting effect (ie 0 * anything = 0, no color added when blending)
-    state.texture = &LightTextures[light.ID].getTexture();
-    LightMaps[light.ID].draw(light.Shadowverts, state);
+
+    //Penumbra wedges carry their falloff in texCoords, for the shader instead of the falloff texture
+    if (Mode == ShadowMode::Penumbra) {
+      state.texture = nullptr;
+      state.shader = &PenumbraShader;
+    }
+    DrawMesh(*map, light.Shadowverts, state);
 
     //And display the texture
-    LightMaps[light.ID].display();
+    map->display();
+    return map;
   }
 
   /*
@@ -349,27 +1643,18 @@ protected:
            L  *
   */
 
-  void UpdateLight(Light &light) {
-    static sf::Vector2f vToEdge1, vToEdge2;
-    static sf::Vector2f outerPt1, outerPt2;
-    static sf::Vector2f OffsetFromCenterOfTexture;
-    static sf::Vector2f TextureSize;
+  void UpdateLight(Light &light, LightUpdateScratch &scratch) {
 
     //Find out where the light is relative to the center of the texture
-    TextureSize = static_cast<sf::Vector2f>(LightTextures[light.ID].getSize());
-    OffsetFromCenterOfTexture = light.Position - sf::Vector2f(TextureSize.x / 2.f, TextureSize.y / 2.f);
+    const sf::Vector2f TextureSize = static_cast<sf::Vector2f>(light.TextureSize);
+    const sf::Vector2f OffsetFromCenterOfTexture = light.Position - sf::Vector2f(TextureSize.x / 2.f, TextureSize.y / 2.f);
 
-    //we wll always have 4 vertices
-    sf::Vertex V1, V2, V3, V4;
-    light.Shadowverts.clear();
-    light.Shadowverts = sf::VertexArray(sf::Triangles);
-
-    light.LightVerts.clear();
-    light.LightVerts = sf::VertexArray(sf::Triangles);
+    //we wll have 4 vertices, 5 for the few edges that need a peak (see below)
+    sf::Vertex V1, V2, V3, V4, V5;
+    light.Shadowverts.Clear();
+    light.LightVerts.Clear();
 
     //we will have 4 points that shoot out in 4 directions w the length of the attenuation radius
-    sf::VertexArray TL, TR, BR, BL;
-
     //sf::Vector2f vToTL = { -0.7071678f, 0.7071678f };
     //sf::Vector2f vToTR = { 0.7071678f , 0.7071678f };
     //sf::Vector2f vToBR = { 0.7071678f , -0.7071678f };
@@ -401,98 +1686,549 @@ protected:
     VOutBL.position = outBL;
     VOutBL.texCoords = outBL - OffsetFromCenterOfTexture;
 
+    const bool Shadowed = light.Lod == LightLod::Full;
+    if (Shadowed && Mode == ShadowMode::VisibilityPolygon) {
+      UpdateLightVisibility(light, OffsetFromCenterOfTexture, scratch);
+      return;
+    }
+
+    if (Shadowed && Mode == ShadowMode::PolarMap) {
+      UpdateLightPolar(light, OffsetFromCenterOfTexture, scratch);
+      return;
+    }
+
+    const std::uint32_t Center = light.LightVerts.AddVertex(VCenter);
+    const std::uint32_t TL = light.LightVerts.AddVertex(VOutTL);
+    const std::uint32_t TR = light.LightVerts.AddVertex(VOutTR);
+    const std::uint32_t BR = light.LightVerts.AddVertex(VOutBR);
+    const std::uint32_t BL = light.LightVerts.AddVertex(VOutBL);
+
     //Light triangle 1 : VCenter -> VOutTL -> VOutRT
-    light.LightVerts.append(VCenter);
-    light.LightVerts.append(VOutTL);
-    light.LightVerts.append(VOutTR);
+    light.LightVerts.AddTriangle(Center, TL, TR);
 
     //Light triangle 2 : VCenter -> VOutTR -> VOutBR
-    light.LightVerts.append(VCenter);
-    light.LightVerts.append(VOutTR);
-    light.LightVerts.append(VOutBR);
+    light.LightVerts.AddTriangle(Center, TR, BR);
 
     //Light triangle 3 : VCenter -> VOutBR -> VOutBL
-    light.LightVerts.append(VCenter);
-    light.LightVerts.append(VOutBR);
-    light.LightVerts.append(VOutBL);
+    light.LightVerts.AddTriangle(Center, BR, BL);
 
     //Light triangle 4 : VCenter -> VOutBL -> VOutTL
-    light.LightVerts.append(VCenter);
-    light.LightVerts.append(VOutBL);
-    light.LightVerts.append(VOutTL);
+    light.LightVerts.AddTriangle(Center, BL, TL);
 
-    TestTriangles.clear();
-    TestTriangles = sf::VertexArray(sf::Triangles);
-
-    const sf::Vector2f lightSource = light.Position;
-    
-    for (auto & obj : Casters) {
-      //For each edge, we will create 2 triangles out of it
-      //Some will overlap, but they are all black, so it shouldn't hurt us if we just use a BlendAdd - we can optimize it away later
-      
-      for (auto & edge : obj.second.Edges) {
-        vToEdge1 = edge.Start - light.Position;
-        vToEdge2 = edge.End - light.Position;
-        normalize(vToEdge1); normalize(vToEdge2);
-
-        outerPt1 = edge.Start + (vToEdge1 * light.Attenuation);
-        outerPt2 = edge.End + (vToEdge2 * light.Attenuation);
-
-        V1.position = edge.Start; V1.color = sf::Color(0, 0, 0, 0); //V1.texCoords = edge.Start - OffsetFromCenterOfTexture;
-        V2.position = outerPt1;   V2.color = sf::Color(0, 0, 0, 0); //V2.texCoords = outerPt1 - OffsetFromCenterOfTexture;
-        V3.position = edge.End;   V3.color = sf::Color(0, 0, 0, 0); //V2.texCoords = edge.End - OffsetFromCenterOfTexture;
-        V4.position = outerPt2;   V4.color = sf::Color(0, 0, 0, 0); //V3.texCoords = outerPt2 - OffsetFromCenterOfTexture;
+    //Nothing blocks an unshadowed light, so there are no occluders either
+    if (!Shadowed) {
+      scratch.Batch.Clear();
+      return;
+    }
 
-        //Triangle 1 : V1 -> V2 -> V3
-        ShadowRegions.append(V1);
-        ShadowRegions.append(V2);
-        ShadowRegions.append(V3);
+    GatherCasterEdges(light, scratch);
 
-        //Triangle 2 : V2 -> V3 -> V4
-        ShadowRegions.append(V2);
-        ShadowRegions.append(V3);
-        ShadowRegions.append(V4);
+    const float Reach = 1.4142135f * light.Attenuation;
+    if (Mode == ShadowMode::Penumbra && light.Expand > 0.f) {
+      scratch.Penumbra.Build(scratch.Batch, light.Position, light.Expand, Reach, light.Shadowverts);
+      return;
+    }
 
+    /*
+      Push every candidate edge's endpoints out in one vectorized pass, to the corner of the light's square. The far side
+      of a quad is a straight line between the two pushed out points, which cuts back inside the light's circle when the
+      edge is close and wide. Back facing edges used to paper over that. Now only the edges whose far side would reach
+      inside the circle get a fifth point straight out from the light between the two, which splits the far side into two
+      that span at most 90 degrees each, and a 90 degree chord at 1.4142 * Attenuation only just touches the circle.
+    */
+    ShadowExtrusion::Extrude(scratch.Batch, light.Position, Reach, scratch.Extruded);
+
+    //For each edge, we will create 2 triangles out of it, 3 if it needs the peak
+    //Some will overlap, but they are all black, so it shouldn't hurt us if we just use a BlendAdd - we can optimize it away later
+    for (std::size_t i = 0; i < scratch.Batch.Size(); ++i) {
+      const sf::Vector2f Start = scratch.Batch.Start(i);
+      const sf::Vector2f End = scratch.Batch.End(i);
+      const sf::Vector2f OuterStart = scratch.Extruded.Start(i);
+      const sf::Vector2f OuterEnd = scratch.Extruded.End(i);
+
+      V1.position = Start;                                              V1.color = sf::Color(0, 0, 0, 0);
+      V2.position = OuterStart;                                         V2.color = sf::Color(0, 0, 0, 0);
+      V3.position = End;                                                V3.color = sf::Color(0, 0, 0, 0);
+      V4.position = OuterEnd;                                           V4.color = sf::Color(0, 0, 0, 0);
+
+      const std::uint32_t I1 = light.Shadowverts.AddVertex(V1);
+      const std::uint32_t I2 = light.Shadowverts.AddVertex(V2);
+      const std::uint32_t I3 = light.Shadowverts.AddVertex(V3);
+      const std::uint32_t I4 = light.Shadowverts.AddVertex(V4);
+
+      //Nearest point of the far side to the light. Both ends are past Reach, so only the inside of the chord can come close
+      const sf::Vector2f Chord = OuterEnd - OuterStart;
+      const sf::Vector2f FromStart = light.Position - OuterStart;
+      const float ChordLength = Chord.x * Chord.x + Chord.y * Chord.y;
+      const float t = ChordLength > 0.f ? std::min(std::max((FromStart.x * Chord.x + FromStart.y * Chord.y) / ChordLength, 0.f), 1.f) : 0.f;
+      const sf::Vector2f Nearest = FromStart - Chord * t;
+      if (Nearest.x * Nearest.x + Nearest.y * Nearest.y >= light.Attenuation * light.Attenuation) {
         //Triangle 1 : V1 -> V2 -> V3
-        light.Shadowverts.append(V1);
-        light.Shadowverts.append(V2);
-        light.Shadowverts.append(V3);
+        light.Shadowverts.AddTriangle(I1, I2, I3);
 
         //Triangle 2 : V2 -> V3 -> V4
-        light.Shadowverts.append(V2);
-        light.Shadowverts.append(V3);
-        light.Shadowverts.append(V4);
+        light.Shadowverts.AddTriangle(I2, I3, I4);
+        continue;
+      }
+
+      //Between the two outward directions. They only cancel out when the light sits on the (two-sided) edge's line
+      sf::Vector2f Middle = (OuterStart - Start) + (OuterEnd - End);
+      if (Middle.x * Middle.x + Middle.y * Middle.y < 1e-6f * Reach * Reach) {
+        Middle = { End.y - Start.y, Start.x - End.x };
+        if (Middle.x * (Start.x - light.Position.x) + Middle.y * (Start.y - light.Position.y) < 0.f)
+          Middle = -Middle;
       }
-      
+      normalize(Middle);
+
+      const sf::Vector2f ToStart = Start - light.Position;
+      const sf::Vector2f ToEnd = End - light.Position;
+      const float Farthest = std::sqrt(std::max(ToStart.x * ToStart.x + ToStart.y * ToStart.y, ToEnd.x * ToEnd.x + ToEnd.y * ToEnd.y));
+
+      V5.position = light.Position + Middle * (Farthest + Reach);       V5.color = sf::Color(0, 0, 0, 0);
+      const std::uint32_t I5 = light.Shadowverts.AddVertex(V5);
+
+      //Triangle 1 : V1 -> V2 -> V5
+      light.Shadowverts.AddTriangle(I1, I2, I5);
+
+      //Triangle 2 : V1 -> V5 -> V3
+      light.Shadowverts.AddTriangle(I1, I5, I3);
+
+      //Triangle 3 : V3 -> V5 -> V4
+      light.Shadowverts.AddTriangle(I3, I5, I4);
     }
+  }
+
+  void UpdateLightVisibility(Light &light, const sf::Vector2f &OffsetFromCenterOfTexture, LightUpdateScratch &scratch) {
+    //Nothing to darken afterwards, the fan itself is the lit region
+    GatherCasterEdges(light, scratch);
 
+    VisibilityScratch &Sweep = scratch.Sweep;
+    VisibilityPolygon::Begin(Sweep);
+    for (std::size_t i = 0; i < scratch.Batch.Size(); ++i)
+      VisibilityPolygon::AddSegment(Sweep, scratch.Batch.Start(i), scratch.Batch.End(i));
 
+    //Same square the 4 light triangles cover in the quad path
+    VisibilityPolygon::Build(Sweep, light.Position, 1.4142135f * light.Attenuation);
+
+    sf::Vertex VCenter;
+    VCenter.position = light.Position;
+    VCenter.texCoords = light.Position - OffsetFromCenterOfTexture;
+    const std::uint32_t Center = light.LightVerts.AddVertex(VCenter);
+
+    //Neighbouring fan triangles usually share a rim point, so only add a point if it isn't the one we just added
+    std::uint32_t Last = Center;
+    auto RimPoint = [&](const sf::Vector2f &p) {
+      if (Last != Center && light.LightVerts.Vertices[Last].position == p)
+        return Last;
+      sf::Vertex V;
+      V.position = p;
+      V.texCoords = p - OffsetFromCenterOfTexture;
+      return Last = light.LightVerts.AddVertex(V);
+    };
+
+    for (std::size_t i = 0; i + 1 < Sweep.Fan.size(); i += 2) {
+      const std::uint32_t P = RimPoint(Sweep.Fan[i]);
+      const std::uint32_t Q = RimPoint(Sweep.Fan[i + 1]);
+      light.LightVerts.AddTriangle(Center, P, Q);
+    }
   }
 
-  std::map<int, Light> Lights;
-  std::map<int, LightObject> Casters;
+  /*
+    Same output as UpdateLightVisibility (a lit fan, no shadow geometry), but through a PolarShadowMap: one triangle per
+    bin out to its nearest occluder. Open bins reach far enough that their flat far side still clears the attenuation
+    circle, and runs of open bins are merged up to a quarter turn, which at 1.4142 * Attenuation still just clears it.
+  */
+  void UpdateLightPolar(Light &light, const sf::Vector2f &OffsetFromCenterOfTexture, LightUpdateScratch &scratch) {
+    GatherCasterEdges(light, scratch);
+
+    const unsigned bins = light.ShadowBins ? light.ShadowBins : PolarShadowMap::BinsForRadius(light.Radius);
+    const float Reach = 1.4142135f * light.Attenuation;
+    PolarShadowMap &map = light.ShadowMap;
+    map.Build(light.Position, Reach, bins, scratch.Batch);
+
+    sf::Vertex VCenter;
+    VCenter.position = light.Position;
+    VCenter.texCoords = light.Position - OffsetFromCenterOfTexture;
+    const std::uint32_t Center = light.LightVerts.AddVertex(VCenter);
+
+    auto RimPoint = [&](unsigned boundary, float distance) {
+      sf::Vertex V;
+      V.position = light.Position + map.BoundaryDirection(boundary) * distance;
+      V.texCoords = V.position - OffsetFromCenterOfTexture;
+      return light.LightVerts.AddVertex(V);
+    };
+
+    const unsigned count = map.GetBinCount();
+    const unsigned maxRun = std::max(count / 4, 1u);
+    unsigned bin = 0;
+    while (bin < count) {
+      const float distance = map.GetDistance(bin);
+      unsigned end = bin + 1;
+      if (distance >= Reach) {
+        while (end < count && end - bin < maxRun && map.GetDistance(end) >= Reach)
+          ++end;
+      }
+
+      light.LightVerts.AddTriangle(Center, RimPoint(bin, distance), RimPoint(end, distance));
+      bin = end;
+    }
+  }
+
+  /*
+    Runs every caster back through CasterEdgeBuilder. Adding or removing one caster can merge or drop its neighbours' edges,
+    so instead of guessing which lights that reaches, the new list is diffed against the old one (both come out sorted)
+    and only lights within reach of an edge that appeared or disappeared are dirtied.
+  */
+  void RebuildWorldEdges() {
+    EdgeBuilder.Begin();
+    for (auto & caster : Casters) {
+      if (caster.Outline)
+        EdgeBuilder.AddOutline(caster.Edges);
+      else
+        EdgeBuilder.AddCaster(caster.Edges);
+    }
+    EdgeBuilder.Finish(NextWorldEdges, NextWorldEdgeTwoSided, NextWorldEdgeLoops);
+
+    ChangedEdges.Clear();
+    std::size_t a = 0, b = 0;
+    while (a < WorldEdges.Size() || b < NextWorldEdges.Size()) {
+      const bool oldFirst = b == NextWorldEdges.Size() || (a < WorldEdges.Size() &&
+        CasterEdgeBuilder::Less(WorldEdges.Start(a), WorldEdges.End(a), WorldEdgeTwoSided[a] != 0,
+                                NextWorldEdges.Start(b), NextWorldEdges.End(b), NextWorldEdgeTwoSided[b] != 0));
+      const bool newFirst = !oldFirst && (a == WorldEdges.Size() ||
+        CasterEdgeBuilder::Less(NextWorldEdges.Start(b), NextWorldEdges.End(b), NextWorldEdgeTwoSided[b] != 0,
+                                WorldEdges.Start(a), WorldEdges.End(a), WorldEdgeTwoSided[a] != 0));
+
+      if (oldFirst) {
+        ChangedEdges.Push(WorldEdges.Start(a), WorldEdges.End(a));
+        ++a;
+      }
+      else if (newFirst) {
+        ChangedEdges.Push(NextWorldEdges.Start(b), NextWorldEdges.End(b));
+        ++b;
+      }
+      else {
+        ++a;
+        ++b;
+      }
+    }
+
+    std::swap(WorldEdges, NextWorldEdges);
+    std::swap(WorldEdgeTwoSided, NextWorldEdgeTwoSided);
+    std::swap(WorldEdgeLoops, NextWorldEdgeLoops);
+    CasterGridDirty = true;
+    GPUEdgesDirty = true;
+
+    if (ChangedEdges.Empty())
+      return;
+
+    ChangedGrid.SetCellSize(CasterGrid.GetCellSize());
+    ChangedGrid.Build(ChangedEdges);
+    ForEachDrawnLight([this](Light &light) {
+      if (light.Dirty)
+        return;
 
-  std::map<int, sf::RenderTexture> LightTextures;
-  std::map<int, sf::RenderTexture> LightMaps;
-  std::map<int, sf::RenderTexture> ShadowMaps;
+      ChangedGrid.Query(ChangedEdges, light.Position, light.Attenuation, ChangedHits);
+      light.Dirty = !ChangedHits.empty();
+    });
+  }
+
+  /*
+    Puts every caster whose transform changed into place, then rebuilds the dynamic edge list and its grid. The bounds
+    each caster had before and has now (or had when it was removed) go into ChangedBounds for DirtyLightsNear.
+  */
+  void RefitDynamicCasters() {
+    for (auto & handle : MovedCasters) {
+      DynamicCaster *caster = DynamicCasters.Get(handle);
+      if (!caster)
+        continue;
+
+      if (caster->Placed)
+        ChangedBounds.push_back({ caster->Min, caster->Max - caster->Min });
+      PlaceCaster(*caster);
+      if (caster->Placed)
+        ChangedBounds.push_back({ caster->Min, caster->Max - caster->Min });
+    }
+    MovedCasters.clear();
+
+    //Just a concatenation, every caster already did its own preprocessing. Only the loop numbers are shifted past the
+    //previous casters'
+    DynamicEdges.Clear();
+    DynamicEdgeTwoSided.clear();
+    DynamicEdgeLoops.clear();
+    std::uint32_t loopBase = 0;
+    for (auto & caster : DynamicCasters) {
+      DynamicEdges.Append(caster.Edges);
+      DynamicEdgeTwoSided.insert(DynamicEdgeTwoSided.end(), caster.TwoSided.begin(), caster.TwoSided.end());
+      for (auto loop : caster.Loops)
+        DynamicEdgeLoops.push_back(loop == CasterEdgeBuilder::NoLoop ? loop : loop + loopBase);
+      loopBase += caster.LoopCount;
+    }
+    DynamicGrid.SetCellSize(CasterGrid.GetCellSize());
+    DynamicGrid.Build(DynamicEdges);
+    DynamicEdgesDirty = false;
+    GPUEdgesDirty = true;
+  }
+
+  //Dirties every light whose circle overlaps one of bounds, then empties it
+  void DirtyLightsNear(std::vector<sf::FloatRect> &bounds) {
+    ForEachDrawnLight([&](Light &light) {
+      if (light.Dirty)
+        return;
+
+      for (auto & box : bounds) {
+        if (CircleTouchesBox(light.Position, light.Attenuation, { box.left, box.top }, { box.left + box.width, box.top + box.height })) {
+          light.Dirty = true;
+          break;
+        }
+      }
+    });
+    bounds.clear();
+  }
+
+  static bool CircleTouchesBox(const sf::Vector2f &center, float radius, const sf::Vector2f &min, const sf::Vector2f &max) {
+    //Nearest point of the box to the center
+    const float x = std::min(std::max(center.x, min.x), max.x) - center.x;
+    const float y = std::min(std::max(center.y, min.y), max.y) - center.y;
+    return x * x + y * y <= radius * radius;
+  }
+
+  //LocalEdges through Transform, and bounds refit around the result
+  static void PlaceCaster(DynamicCaster &caster) {
+    //A mirroring transform turns the clockwise loops anticlockwise, so their edges are flipped back to face outwards
+    const float *m = caster.Transform.getMatrix();
+    const bool mirrored = m[0] * m[5] - m[4] * m[1] < 0.f;
+
+    caster.Edges.Clear();
+    caster.Placed = !caster.LocalEdges.Empty();
+    caster.Moved = false;
+    for (std::size_t i = 0; i < caster.LocalEdges.Size(); ++i) {
+      sf::Vector2f start = caster.Transform.transformPoint(caster.LocalEdges.Start(i));
+      sf::Vector2f end = caster.Transform.transformPoint(caster.LocalEdges.End(i));
+      if (mirrored && !caster.TwoSided[i])
+        std::swap(start, end);
+      caster.Edges.Push(start, end);
+
+      if (i == 0)
+        caster.Min = caster.Max = start;
+      caster.Min.x = std::min({ caster.Min.x, start.x, end.x }); caster.Min.y = std::min({ caster.Min.y, start.y, end.y });
+      caster.Max.x = std::max({ caster.Max.x, start.x, end.x }); caster.Max.y = std::max({ caster.Max.y, start.y, end.y });
+    }
+  }
+
+  /*
+    Only edges within the attenuation radius can darken anything the light reaches,
+    and of the loop edges only the ones whose outward side faces the light, unless the light is inside their loop.
+    Static edges come first, then the dynamic casters', then the loaded scene's resident chunks that reach the light,
+    then the edges facing away from it of the loops it's inside.
+  */
+  void GatherCasterEdges(const Light &light, LightUpdateScratch &scratch) {
+    scratch.Batch.Clear();
+    scratch.LoopEdges.clear();
+    GatherEdges(WorldEdges.View(), WorldEdgeTwoSided.data(), WorldEdgeLoops.data(), WorldLoops, CasterGrid.GetView(), light, scratch);
+    if (!DynamicEdges.Empty())
+      GatherEdges(DynamicEdges.View(), DynamicEdgeTwoSided.data(), DynamicEdgeLoops.data(), DynamicLoops, DynamicGrid.GetView(), light, scratch);
+
+    for (auto index : BakedScene.GetResident()) {
+      const SceneChunkView &chunk = BakedScene.GetChunk(index);
+      if (CircleTouchesBox(light.Position, light.Attenuation, chunk.Min, chunk.Max))
+        GatherEdges(chunk.Edges, chunk.TwoSided, chunk.Loops, SceneLoops, chunk.Grid, light, scratch);
+      else {
+        scratch.CullStats.TotalEdges += chunk.Edges.Size();
+        scratch.CullStats.CulledEdges += chunk.Edges.Size();
+      }
+    }
+    KeepEnclosingLoops(light, scratch);
+    scratch.CullStats.Lights++;
+  }
+
+  //Loop numbers of WorldEdges, DynamicEdges and the scene's chunks are counted separately, so each list gets its own range
+  static constexpr std::uint64_t WorldLoops = 0;
+  static constexpr std::uint64_t DynamicLoops = std::uint64_t(1) << 32;
+  static constexpr std::uint64_t SceneLoops = std::uint64_t(2) << 32;
+
+  static void GatherEdges(const EdgeSoAView &edges, const std::uint8_t *twoSided, const std::uint32_t *loops, std::uint64_t loopBase,
+                          const EdgeGridView &grid, const Light &light, LightUpdateScratch &scratch) {
+    grid.Query(edges, light.Position, light.Attenuation, scratch.CandidateEdges);
+
+    for (auto index : scratch.CandidateEdges) {
+      const sf::Vector2f start = edges.Start(index);
+      const sf::Vector2f end = edges.End(index);
+      if (twoSided[index]) {
+        scratch.Batch.Push(start, end);
+        continue;
+      }
+
+      const bool faces = CasterEdgeBuilder::FacesLight(start, end, light.Position);
+      if (faces)
+        scratch.Batch.Push(start, end);
+      scratch.LoopEdges.push_back({ loopBase + loops[index], start, end, faces, static_cast<std::uint32_t>(scratch.LoopEdges.size()) });
+    }
+
+    scratch.CullStats.TotalEdges += edges.Size();
+    scratch.CullStats.CandidateEdges += scratch.CandidateEdges.size();
+    scratch.CullStats.CulledEdges += edges.Size() - scratch.CandidateEdges.size();
+  }
+
+  //The edges facing away from the light are only needed from the loops it's inside, see CasterEdgeBuilder::EnclosesLight
+  static void KeepEnclosingLoops(const Light &light, LightUpdateScratch &scratch) {
+    auto &loopEdges = scratch.LoopEdges;
+    //Not stable_sort: that grabs a temporary buffer every call
+    std::sort(loopEdges.begin(), loopEdges.end(), [](const CasterEdgeBuilder::LoopEdge &a, const CasterEdgeBuilder::LoopEdge &b) {
+      return a.Loop != b.Loop ? a.Loop < b.Loop : a.Order < b.Order;
+    });
+
+    for (std::size_t first = 0, last = 0; first < loopEdges.size(); first = last) {
+      last = first;
+      while (last < loopEdges.size() && loopEdges[last].Loop == loopEdges[first].Loop)
+        ++last;
+
+      const bool inside = CasterEdgeBuilder::EnclosesLight(&loopEdges[first], last - first, light.Position, light.Attenuation);
+      for (std::size_t i = first; i < last; ++i) {
+        if (loopEdges[i].Faces)
+          continue;
+        if (inside)
+          scratch.Batch.Push(loopEdges[i].Start, loopEdges[i].End);
+        else
+          ++scratch.CullStats.BackFacingEdges;
+      }
+    }
+  }
+
+  SlotMap<Light, Light> Lights;
+  SlotMap<LightObject, LightObject> Casters;
+  SlotMap<DynamicCaster, DynamicCaster> DynamicCasters;
 
   //One main renderTexture for drawing all the lights to
   sf::RenderTexture ShadowedLights;
   sf::RenderTexture GlobalLightMap;
 
+  //LightComposite::Accumulate's light buffer is GlobalLightMap, see SetLightComposite
+  LightComposite Composite = LightComposite::PerLight;
+  LightBufferPrecision BufferPrecision = LightBufferPrecision::RGBA8;
+  LightBufferPrecision LightBufferMade = LightBufferPrecision::RGBA8;
+  sf::Vector2u LightBufferSize;
+
   sf::VertexArray TestTriangles;
-  sf::VertexArray ShadowRegions;
+  sf::RectangleShape SceneQuad;
+
+  //Falloff textures and light maps for the OpenGL backend
+  LightTextureCache Textures;
+
+  //Screen tiling for compositing, rebuilt by every render call
+  static constexpr unsigned ScreenTileSize = 32;
+  static constexpr std::size_t NoTile = ~std::size_t(0);
+  LightTileGrid ScreenTiles;
+  std::vector<LightCircle> TileCircles;
+  std::vector<LightMesh> TileQuads;
+  std::vector<std::size_t> LastTile;
 
   sf::Shader LightShader;
   sf::Shader BlendShader;
   sf::Shader ShadowingShader;
+  sf::Shader PenumbraShader;
+  sf::Shader AccumulateShader;
+  sf::Shader CompositeShader;
 
   float WindowHeight = 0.f;
 
   //Please ignore, shader-only lighting in the works!
   bool UseGPU = false;
-  GLuint LightSSBOBuffer;
-  GLuint EdgeSSBOBuffer;
-
-  light_stc_data_type TestGPULight;
+  GPUScenePacker GPUPacker;
+  std::unique_ptr<GPUSceneBuffers> GPUBuffers;
+  bool GPUEdgesDirty = true;
+  EdgeSoA GPUEdges; //WorldEdges, DynamicEdges and the resident scene chunks, only needed while there's more than WorldEdges
+
+  //Every caster's edges after CasterEdgeBuilder is done with them, sorted by position, with a grid over it
+  EdgeSoA WorldEdges;
+  std::vector<std::uint8_t> WorldEdgeTwoSided;
+  std::vector<std::uint32_t> WorldEdgeLoops;
+  EdgeGrid CasterGrid;
+  bool CasterEdgesDirty = false;
+  bool CasterGridDirty = false;
+
+  //Every dynamic caster's edges in world space, one after the other, with their own grid. Rebuilt when one moved
+  EdgeSoA DynamicEdges;
+  std::vector<std::uint8_t> DynamicEdgeTwoSided;
+  std::vector<std::uint32_t> DynamicEdgeLoops;
+  EdgeGrid DynamicGrid;
+  bool DynamicEdgesDirty = false;
+  std::vector<DynamicCasterHandle> MovedCasters;
+  std::vector<sf::FloatRect> ChangedBounds; //Where moved or removed dynamic casters and streamed scene chunks were and are
+
+  //Scene file from LoadScene, queried in place. Only its resident chunks reach the lights, see SetStreamRegion
+  MappedScene BakedScene;
+  bool SceneStreamDirty = false;
+  bool HasStreamRegion = false;
+  sf::FloatRect StreamRegion;
+
+  //Only used while RebuildWorldEdges (or AddDynamicCaster) runs, kept so it doesn't reallocate
+  CasterEdgeBuilder EdgeBuilder;
+  EdgeSoA NextWorldEdges;
+  std::vector<std::uint8_t> NextWorldEdgeTwoSided;
+  std::vector<std::uint32_t> NextWorldEdgeLoops;
+  EdgeSoA ChangedEdges;
+  EdgeGrid ChangedGrid;
+  std::vector<std::uint32_t> ChangedHits;
+
+  //Scratch for AddTileLayer/RefreshTiles
+  TileOutlineTracer Tracer;
+  std::vector<Edge> TracedEdges;
+  CasterCullStats CullStats;
+
+  ShadowMode Mode = ShadowMode::EdgeQuads;
+
+  //Parallel update: one scratch per worker, lights handed out by index
+  LightWorkerPool Workers;
+  std::vector<LightUpdateScratch> Scratch;
+  std::vector<Light*> UpdateOrder;
+
+  PointVisibilityQuery PointQuery;
+  std::vector<VisibilityQueryLight> QueryLights;
+
+  LightBackend Backend = LightBackend::OpenGL;
+  SoftwareLightRenderer Software;
+  std::vector<SoftwareLight> SoftwareInputs;
+  LightMesh NoGeometry;
+
+  //Null unless EnableCapture was called, so capturing costs a pointer check when it's off
+  std::unique_ptr<FrameCapture> Capture;
+  std::uint64_t FrameNumber = 0;
+
+  //View rect culling and LOD, see SetViewRect
+  bool HasView = false;
+  sf::FloatRect View;
+  float PixelsPerUnit = 1.f;
+  float LodRadius = 8.f;
+  LightViewStats ViewStats;
+
+  //Light clustering, see SetClusterError. ClusterLights[0 .. ActiveClusters) stand in for the clustered lights this
+  //frame, the rest are kept around so their meshes keep their capacity
+  float ClusterError = 0.f;
+  float ClusterColorDistance = 64.f;
+  bool ClusterTreeDirty = true; //Lights were added or removed: build the tree again
+  bool ClusterRefit = false;    //Lights moved or changed: refit the tree's aggregates
+  static constexpr float ClusterRebuildGrowth = 0.5f; //Share of the error budget a refit node may grow by, see BuildLightClusters
+  LightClusterTree ClusterTree;
+  std::vector<LightClusterInput> ClusterInputs;
+  std::vector<std::uint32_t> ClusterCut;
+  std::vector<std::uint8_t> InCluster;
+  std::vector<Light> ClusterLights;
+  std::size_t ActiveClusters = 0;
+  LightClusterStats ClusterStats;
+  std::vector<Light*> DrawLights;
+
+#ifdef LSYS_PROFILE
+  LightProfiler Profiler;
+#endif
+
+  //Pipelined updates (latency 1). The dirty lights are copied into Staged and rebuilt on Pipeline's thread
+  unsigned Latency = 0;
+  unsigned UpdateThreads = 1;
+  bool UpdateInFlight = false;
+  std::vector<Light> Staged;
+  LightWorkerPool PipelineWorkers;
+
+  //Last, so it's destroyed first and any update still in flight finishes before what it uses goes away
+  LightPipeline Pipeline;
 };
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "LightGeometry.h"
+#include "LightMesh.h"
+
+/*
+  Shadow geometry for ShadowMode::Penumbra: one pass per light that comes out soft-edged, for a light that's a disc of
+  radius Extent (Light::Expand) instead of a point.
+
+  Seen from the light, a chain of caster edges only has a soft border where it ends. Those endpoints are the
+  silhouette endpoints. An endpoint is one if every edge touching it lies on the same side of the ray from the light
+  through it. For each one:
+    - the inner ray leaves it turned towards the edge by the angle the disc takes up from there. The umbra, and so the
+      edge's black quad, is bounded by the inner ray instead of the ray straight out from the light
+    - the outer ray leaves it turned the other way. Nothing beyond it is shadowed by this endpoint
+    - the wedge between the two is one triangle, with texCoords (0, 0) at the endpoint, (1, 1) far out along the outer
+      ray and (0, 1) far out along the inner ray. texCoords.x / texCoords.y is then 0 on the inner ray, 1 on the outer
+      ray, and in between how far across the wedge the pixel is. That's the falloff coordinate: PenumbraShader.fsh and
+      SoftwareLightRenderer multiply the light map by it
+  Endpoints shared by edges on both sides of the ray are inside the chain and keep hard rays, so neighbouring quads
+  still meet. Umbra quads keep the (0, 0) texCoords of the hard shadows, which reads as fully shadowed.
+
+  Where an edge is small next to the light the two inner rays cross, and the umbra is just the triangle up to where
+  they do. Past that, the two wedges overlap and multiply, which is darker than the true antumbra.
+*/
+class PenumbraBuilder
+{
+public:
+  //Half the wedge angle is capped here, so wedges stay narrower than a half plane even with the light right on the edge
+  static constexpr float MaxHalfAngle = 1.0471976f;
+
+  //Emits into shadows. reach is how far past the light the shadows have to cover, as in UpdateLight's quad path
+  void Build(const EdgeSoA &edges, const sf::Vector2f &light, float extent, float reach, LightMesh &shadows) {
+    FindSilhouettes(edges, light);
+
+    for (std::size_t i = 0; i < edges.Size(); ++i) {
+      const sf::Vector2f start = edges.Start(i), end = edges.End(i);
+      const float turn = Cross(start - light, end - light);
+      const float side = turn > 0.f ? 1.f : -1.f;
+
+      //Towards the other end of the edge: counterclockwise from the start when the edge turns counterclockwise
+      const sf::Vector2f startDir = Direction(start, light, extent, Soft[i * 2] ? side : 0.f);
+      const sf::Vector2f endDir = Direction(end, light, extent, Soft[i * 2 + 1] ? -side : 0.f);
+      AddUmbra(start, end, startDir, endDir, Soft[i * 2] ? side : 0.f, Soft[i * 2 + 1] ? -side : 0.f, light, reach, shadows);
+
+      if (Wedge[i * 2])
+        AddWedge(start, light, extent, reach, side, shadows);
+      if (Wedge[i * 2 + 1])
+        AddWedge(end, light, extent, reach, -side, shadows);
+    }
+  }
+
+private:
+  static float Cross(const sf::Vector2f &a, const sf::Vector2f &b) {
+    return a.x * b.y - a.y * b.x;
+  }
+
+  static sf::Vector2f Rotate(const sf::Vector2f &v, float angle) {
+    const float c = std::cos(angle), s = std::sin(angle);
+    return { v.x * c - v.y * s, v.x * s + v.y * c };
+  }
+
+  static sf::Vector2f Unit(const sf::Vector2f &v) {
+    const float length = std::sqrt(v.x * v.x + v.y * v.y);
+    return length > 0.f ? v / length : sf::Vector2f(1.f, 0.f);
+  }
+
+  //Half the angle the disc takes up seen from point
+  static float HalfAngle(const sf::Vector2f &point, const sf::Vector2f &light, float extent) {
+    const sf::Vector2f d = point - light;
+    const float distance = std::sqrt(d.x * d.x + d.y * d.y);
+    if (distance <= extent)
+      return MaxHalfAngle;
+    return std::min(std::asin(extent / distance), MaxHalfAngle);
+  }
+
+  //Straight out from the light, or turned by the half angle (inwards is the sign of towards)
+  static sf::Vector2f Direction(const sf::Vector2f &point, const sf::Vector2f &light, float extent, float towards) {
+    const sf::Vector2f out = Unit(point - light);
+    if (towards == 0.f)
+      return out;
+    return Rotate(out, towards * HalfAngle(point, light, extent));
+  }
+
+  /*
+    Sorts the endpoints so the ones edges share end up next to each other, then marks the endpoints that have every
+    touching edge on one side of their ray. Soft is per endpoint (edge * 2 + 0 for the start, + 1 for the end), Wedge
+    is only set on the first of a shared endpoint, so it gets one wedge however many edges meet there.
+  */
+  void FindSilhouettes(const EdgeSoA &edges, const sf::Vector2f &light) {
+    const std::size_t count = edges.Size() * 2;
+    Ends.resize(count);
+    for (std::uint32_t i = 0; i < count; ++i)
+      Ends[i] = i;
+    auto point = [&](std::uint32_t end) {
+      return (end & 1) ? edges.End(end / 2) : edges.Start(end / 2);
+    };
+    std::sort(Ends.begin(), Ends.end(), [&](std::uint32_t a, std::uint32_t b) {
+      const sf::Vector2f pa = point(a), pb = point(b);
+      return pa.y < pb.y || (pa.y == pb.y && pa.x < pb.x);
+    });
+
+    Soft.assign(count, 0);
+    Wedge.assign(count, 0);
+    for (std::size_t first = 0; first < count;) {
+      const sf::Vector2f p = point(Ends[first]);
+      std::size_t last = first + 1;
+      while (last < count && point(Ends[last]) == p)
+        ++last;
+
+      //Bit 0: some edge runs counterclockwise away from the ray, bit 1: some edge runs clockwise
+      unsigned sides = 0;
+      for (std::size_t k = first; k < last; ++k) {
+        const std::uint32_t edge = Ends[k] / 2;
+        const float turn = Cross(edges.Start(edge) - light, edges.End(edge) - light);
+        if (turn == 0.f)
+          sides |= 3;
+        else
+          sides |= ((turn > 0.f) != ((Ends[k] & 1) != 0)) ? 1 : 2;
+      }
+
+      if (sides != 3) {
+        for (std::size_t k = first; k < last; ++k)
+          Soft[Ends[k]] = 1;
+        Wedge[Ends[first]] = 1;
+      }
+      first = last;
+    }
+  }
+
+  /*
+    The edge's hard shadow, as UpdateLight's quad path builds it, cut down to the inner side of the inner ray at each
+    soft end. When the light is big next to the edge an inner ray can swing right across the hard shadow. The cut then
+    leaves a triangle up to where the two cross, or nothing at all.
+  */
+  void AddUmbra(const sf::Vector2f &start, const sf::Vector2f &end, const sf::Vector2f &startDir, const sf::Vector2f &endDir,
+                float startTurn, float endTurn, const sf::Vector2f &light, float reach, LightMesh &shadows) {
+    const sf::Vector2f toStart = start - light, toEnd = end - light;
+    const sf::Vector2f outStart = Unit(toStart), outEnd = Unit(toEnd);
+
+    //Between the two outward directions. They only cancel out when the light sits on the (two-sided) edge's line
+    sf::Vector2f middle = outStart + outEnd;
+    if (middle.x * middle.x + middle.y * middle.y < 1e-6f) {
+      middle = { end.y - start.y, start.x - end.x };
+      if (middle.x * toStart.x + middle.y * toStart.y < 0.f)
+        middle = -middle;
+    }
+    middle = Unit(middle);
+    const float farthest = std::sqrt(std::max(toStart.x * toStart.x + toStart.y * toStart.y, toEnd.x * toEnd.x + toEnd.y * toEnd.y));
+
+    Polygon.assign({ start, start + outStart * reach, light + middle * (farthest + reach), end + outEnd * reach, end });
+    if (startTurn != 0.f)
+      Clip(start, startDir, startTurn);
+    if (endTurn != 0.f)
+      Clip(end, endDir, endTurn);
+    if (Polygon.size() < 3)
+      return;
+
+    sf::Vertex v;
+    v.color = sf::Color(0, 0, 0, 0);
+    const std::uint32_t first = static_cast<std::uint32_t>(shadows.Vertices.size());
+    for (auto & point : Polygon) {
+      v.position = point;
+      shadows.AddVertex(v);
+    }
+    for (std::uint32_t k = 1; k + 1 < Polygon.size(); ++k)
+      shadows.AddTriangle(first, first + k, first + k + 1);
+  }
+
+  //Keeps the part of Polygon (convex) on the side of the ray from point along dir that turning by the sign of turn leads to
+  void Clip(const sf::Vector2f &point, const sf::Vector2f &dir, float turn) {
+    Clipped.clear();
+    for (std::size_t k = 0; k < Polygon.size(); ++k) {
+      const sf::Vector2f &a = Polygon[k], &b = Polygon[(k + 1) % Polygon.size()];
+      const float da = Cross(dir, a - point) * turn, db = Cross(dir, b - point) * turn;
+      if (da >= 0.f)
+        Clipped.push_back(a);
+      if ((da >= 0.f) != (db >= 0.f))
+        Clipped.push_back(a + (b - a) * (da / (da - db)));
+    }
+    Polygon.swap(Clipped);
+  }
+
+  //inwards is the sign of the turn from the ray straight out towards the edge
+  static void AddWedge(const sf::Vector2f &point, const sf::Vector2f &light, float extent, float reach, float inwards, LightMesh &shadows) {
+    const sf::Vector2f out = Unit(point - light);
+    const float half = HalfAngle(point, light, extent);
+    const sf::Vector2f d = point - light;
+
+    //Far enough that the wedge's far side stays past everything the light reaches
+    const float distance = (std::sqrt(d.x * d.x + d.y * d.y) + reach) / std::cos(half);
+
+    sf::Vertex v;
+    v.color = sf::Color(0, 0, 0, 0);
+    v.position = point;                                           v.texCoords = { 0.f, 0.f };
+    const std::uint32_t apex = shadows.AddVertex(v);
+    v.position = point + Rotate(out, -inwards * half) * distance; v.texCoords = { 1.f, 1.f };
+    const std::uint32_t outer = shadows.AddVertex(v);
+    v.position = point + Rotate(out, inwards * half) * distance;  v.texCoords = { 0.f, 1.f };
+    const std::uint32_t inner = shadows.AddVertex(v);
+    shadows.AddTriangle(apex, outer, inner);
+  }
+
+  std::vector<std::uint32_t> Ends;
+  std::vector<std::uint8_t> Soft;
+  std::vector<std::uint8_t> Wedge;
+  std::vector<sf::Vector2f> Polygon;
+  std::vector<sf::Vector2f> Clipped;
+};
+
+/*
+  The many-sample reference the penumbra geometry is checked against: what jittering the light into copies would give.
+  In 2D a disc light seen from a point is the segment across it at right angles to the line of sight, so the copies are
+  spread evenly along that.
+*/
+class PenumbraReference
+{
+public:
+  //How many of samples copies of the light point can see past edges, as a share of samples
+  static float SampleVisibility(const EdgeSoA &edges, const sf::Vector2f &light, float extent, const sf::Vector2f &point, unsigned samples) {
+    samples = std::max(samples, 1u);
+    sf::Vector2f across = point - light;
+    const float length = std::sqrt(across.x * across.x + across.y * across.y);
+    across = length > 0.f ? sf::Vector2f(-across.y, across.x) / length : sf::Vector2f(0.f, 1.f);
+
+    unsigned visible = 0;
+    for (unsigned s = 0; s < samples; ++s) {
+      const float offset = extent * ((2.f * s + 1.f) / samples - 1.f);
+      const sf::Vector2f copy = light + across * offset;
+      bool blocked = false;
+      for (std::size_t i = 0; i < edges.Size() && !blocked; ++i)
+        blocked = SegmentsCross(copy, point, edges.Start(i), edges.End(i));
+      visible += blocked ? 0 : 1;
+    }
+    return static_cast<float>(visible) / samples;
+  }
+
+  //What shadows leaves of the light at point: every triangle over it multiplied in, as CreateLightMap's BlendMultiply does
+  static float MeshVisibility(const LightMesh &shadows, const sf::Vector2f &point) {
+    float visibility = 1.f;
+    for (std::size_t t = 0; t < shadows.GetTriangleCount() && visibility > 0.f; ++t) {
+      const sf::Vertex &a = shadows.GetCorner(t, 0), &b = shadows.GetCorner(t, 1), &c = shadows.GetCorner(t, 2);
+      const float area = Cross(b.position - a.position, c.position - a.position);
+      if (area == 0.f)
+        continue;
+
+      const float wb = Cross(point - a.position, c.position - a.position) / area;
+      const float wc = Cross(b.position - a.position, point - a.position) / area;
+      const float wa = 1.f - wb - wc;
+      if (wa < 0.f || wb < 0.f || wc < 0.f)
+        continue;
+
+      //PenumbraShader.fsh
+      const sf::Vector2f uv = a.texCoords * wa + b.texCoords * wb + c.texCoords * wc;
+      visibility *= uv.y > 0.f ? std::min(std::max(uv.x / uv.y, 0.f), 1.f) : 0.f;
+    }
+    return visibility;
+  }
+
+private:
+  static float Cross(const sf::Vector2f &a, const sf::Vector2f &b) {
+    return a.x * b.y - a.y * b.x;
+  }
+
+  static bool SegmentsCross(const sf::Vector2f &a, const sf::Vector2f &b, const sf::Vector2f &c, const sf::Vector2f &d) {
+    const float d1 = Cross(b - a, c - a), d2 = Cross(b - a, d - a);
+    const float d3 = Cross(d - c, a - c), d4 = Cross(d - c, b - c);
+    return ((d1 > 0.f) != (d2 > 0.f)) && ((d3 > 0.f) != (d4 > 0.f));
+  }
+};
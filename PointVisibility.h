@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "LightGeometry.h"
+#include "LightSimd.h"
+#include "LightWorkerPool.h"
+#include "PolarShadowMap.h"
+
+//One light as the point query sees it
+struct VisibilityQueryLight
+{
+  sf::Vector2f Position;
+  float Attenuation = 0.f;
+  float Intensity = 1.f;
+  const EdgeSoA *Occluders = nullptr; //Edges that can block it, e.g. the ones its last update shadowed with
+  const PolarShadowMap *ShadowMap = nullptr; //When set, looked up instead of testing Occluders
+};
+
+/*
+  Answer to a point query: for every point, which lights reach it and how much light it gets in total
+
+  LitBy holds WordsPerPoint 64 bit words per point, bit l set when light l reaches it. Intensity is the sum over those
+  lights of the SuperBright.fsh falloff (1 - sqrt(sqrt(distance / Attenuation))) times the light's Intensity.
+*/
+struct PointVisibilityResult
+{
+  std::size_t PointCount = 0;
+  std::size_t LightCount = 0;
+  std::size_t WordsPerPoint = 0;
+  std::vector<std::uint64_t> LitBy;
+  std::vector<float> Intensity;
+
+  bool IsLit(std::size_t point) const {
+    return Intensity[point] > 0.f;
+  }
+
+  bool IsLitBy(std::size_t point, std::size_t light) const {
+    return (LitBy[point * WordsPerPoint + light / 64] >> (light % 64)) & 1u;
+  }
+};
+
+/*
+  Batched "which lights can see this point" test
+
+  Points are bucketed into a grid (CSR, like EdgeGrid) and the cells are handed to the worker pool, so every point is
+  only ever written by one worker and the results don't depend on the thread count. Per cell, a light is skipped unless
+  its circle reaches the cell's bounds, and of its occluders only the ones that overlap the box around the light and
+  the cell are tested. Points then go 4 at a time against one edge at a time, stopping once all 4 are blocked.
+
+  The occlusion test is the ray/segment solve from CastRay (SSBOLighting.fsh), written without the divide: the point
+  is blocked if the segment light -> point crosses the edge strictly between the two. A point lying on an edge still
+  counts as lit, so something standing against a wall isn't hidden by it. Lights with a ShadowMap skip all of that and
+  just compare each point's distance with its bin's.
+*/
+class PointVisibilityQuery
+{
+public:
+  void SetCellSize(float size) {
+    CellSize = std::max(size, 1.f);
+  }
+
+  void Run(const std::vector<sf::Vector2f> &points, const std::vector<VisibilityQueryLight> &lights, LightWorkerPool &workers,
+           PointVisibilityResult &out) {
+    out.PointCount = points.size();
+    out.LightCount = lights.size();
+    out.WordsPerPoint = (lights.size() + 63) / 64;
+    out.LitBy.assign(points.size() * out.WordsPerPoint, 0);
+    out.Intensity.assign(points.size(), 0.f);
+    if (points.empty() || lights.empty())
+      return;
+
+    Bucket(points);
+
+    Scratch.resize(workers.GetThreadCount());
+    workers.Run(Cells.size(), [&](std::size_t cell, unsigned worker) {
+      RunCell(Cells[cell], lights, out, Scratch[worker]);
+    });
+  }
+
+private:
+  static constexpr std::size_t MaxCells = 1 << 20;
+
+  struct Cell
+  {
+    std::uint32_t First = 0; //Into X/Y/Index
+    std::uint32_t Count = 0;
+    float MinX, MinY, MaxX, MaxY; //Bounds of the points actually in it
+  };
+
+  //The occluders of one light that can matter for one cell, relative to the light
+  struct CellScratch
+  {
+    std::vector<float> WX, WY; //Edge start - light
+    std::vector<float> EX, EY; //Edge end - edge start
+    std::vector<float> TN;     //cross(w, e), how far along light -> point the edge's line is hit (times the denominator)
+  };
+
+  void Bucket(const std::vector<sf::Vector2f> &points) {
+    float minX = points[0].x, minY = points[0].y, maxX = minX, maxY = minY;
+    for (auto & p : points) {
+      minX = std::min(minX, p.x); minY = std::min(minY, p.y);
+      maxX = std::max(maxX, p.x); maxY = std::max(maxY, p.y);
+    }
+
+    float cell = CellSize;
+    while ((static_cast<std::size_t>((maxX - minX) / cell) + 1) * (static_cast<std::size_t>((maxY - minY) / cell) + 1) > MaxCells)
+      cell *= 2.f;
+    const std::size_t columns = static_cast<std::size_t>((maxX - minX) / cell) + 1;
+    const std::size_t rows = static_cast<std::size_t>((maxY - minY) / cell) + 1;
+
+    auto cellOf = [&](const sf::Vector2f &p) {
+      const std::size_t x = std::min(static_cast<std::size_t>((p.x - minX) / cell), columns - 1);
+      const std::size_t y = std::min(static_cast<std::size_t>((p.y - minY) / cell), rows - 1);
+      return y * columns + x;
+    };
+
+    //Count, prefix sum, then fill, so each cell's points end up next to each other for the SIMD loads
+    CellStart.assign(columns * rows + 1, 0);
+    for (auto & p : points)
+      CellStart[cellOf(p) + 1]++;
+    for (std::size_t c = 1; c < CellStart.size(); ++c)
+      CellStart[c] += CellStart[c - 1];
+
+    X.resize(points.size());
+    Y.resize(points.size());
+    Index.resize(points.size());
+    Fill.assign(CellStart.begin(), CellStart.end() - 1);
+    for (std::uint32_t i = 0; i < points.size(); ++i) {
+      const std::uint32_t slot = Fill[cellOf(points[i])]++;
+      X[slot] = points[i].x;
+      Y[slot] = points[i].y;
+      Index[slot] = i;
+    }
+
+    Cells.clear();
+    for (std::size_t c = 0; c + 1 < CellStart.size(); ++c) {
+      if (CellStart[c] == CellStart[c + 1])
+        continue;
+
+      Cell entry;
+      entry.First = CellStart[c];
+      entry.Count = CellStart[c + 1] - CellStart[c];
+      entry.MinX = entry.MaxX = X[entry.First];
+      entry.MinY = entry.MaxY = Y[entry.First];
+      for (std::uint32_t i = entry.First; i < entry.First + entry.Count; ++i) {
+        entry.MinX = std::min(entry.MinX, X[i]); entry.MaxX = std::max(entry.MaxX, X[i]);
+        entry.MinY = std::min(entry.MinY, Y[i]); entry.MaxY = std::max(entry.MaxY, Y[i]);
+      }
+      Cells.push_back(entry);
+    }
+  }
+
+  void RunCell(const Cell &cell, const std::vector<VisibilityQueryLight> &lights, PointVisibilityResult &out, CellScratch &s) const {
+    for (std::size_t l = 0; l < lights.size(); ++l) {
+      const VisibilityQueryLight &light = lights[l];
+      const float cx = std::min(std::max(light.Position.x, cell.MinX), cell.MaxX) - light.Position.x;
+      const float cy = std::min(std::max(light.Position.y, cell.MinY), cell.MaxY) - light.Position.y;
+      if (!(light.Attenuation > 0.f) || cx * cx + cy * cy >= light.Attenuation * light.Attenuation)
+        continue;
+
+      if (!light.ShadowMap)
+        GatherOccluders(light, cell, s);
+      TestCell(light, l, cell, out, s);
+    }
+  }
+
+  //Only an edge that overlaps the box around the light and the cell can cross a segment from one to the other
+  static void GatherOccluders(const VisibilityQueryLight &light, const Cell &cell, CellScratch &s) {
+    s.WX.clear(); s.WY.clear(); s.EX.clear(); s.EY.clear(); s.TN.clear();
+    if (!light.Occluders)
+      return;
+
+    const float minX = std::min(light.Position.x, cell.MinX), maxX = std::max(light.Position.x, cell.MaxX);
+    const float minY = std::min(light.Position.y, cell.MinY), maxY = std::max(light.Position.y, cell.MaxY);
+
+    const EdgeSoA &edges = *light.Occluders;
+    for (std::size_t i = 0; i < edges.Size(); ++i) {
+      const float sx = edges.StartX[i], sy = edges.StartY[i], ex = edges.EndX[i], ey = edges.EndY[i];
+      if (std::max(sx, ex) < minX || std::min(sx, ex) > maxX || std::max(sy, ey) < minY || std::min(sy, ey) > maxY)
+        continue;
+
+      const float wx = sx - light.Position.x, wy = sy - light.Position.y;
+      const float dx = ex - sx, dy = ey - sy;
+      s.WX.push_back(wx); s.WY.push_back(wy);
+      s.EX.push_back(dx); s.EY.push_back(dy);
+      s.TN.push_back(wx * dy - wy * dx);
+    }
+  }
+
+  void TestCell(const VisibilityQueryLight &light, std::size_t lightIndex, const Cell &cell, PointVisibilityResult &out,
+                const CellScratch &s) const {
+    const SimdF4 zero = SimdF4::Set1(0.f);
+    const SimdF4 one = SimdF4::Set1(1.f);
+    const SimdF4 minusOne = SimdF4::Set1(-1.f);
+    const SimdF4 lx = SimdF4::Set1(light.Position.x);
+    const SimdF4 ly = SimdF4::Set1(light.Position.y);
+    const SimdF4 range2 = SimdF4::Set1(light.Attenuation * light.Attenuation);
+    const SimdF4 invAtten = SimdF4::Set1(1.f / light.Attenuation);
+    const SimdF4 intensity = SimdF4::Set1(light.Intensity);
+    const std::size_t word = lightIndex / 64;
+    const std::uint64_t bit = std::uint64_t(1) << (lightIndex % 64);
+
+    for (std::uint32_t first = cell.First; first < cell.First + cell.Count; first += 4) {
+      //The last group repeats its last point in the missing lanes and masks them off
+      const std::uint32_t last = cell.First + cell.Count - 1;
+      const std::uint32_t i1 = std::min(first + 1, last), i2 = std::min(first + 2, last), i3 = std::min(first + 3, last);
+      const SimdF4 dx = SimdF4::Set(X[first], X[i1], X[i2], X[i3]) - lx;
+      const SimdF4 dy = SimdF4::Set(Y[first], Y[i1], Y[i2], Y[i3]) - ly;
+      const int lanes = (1 << std::min<std::uint32_t>(4, last - first + 1)) - 1;
+
+      const SimdF4 dist2 = dx * dx + dy * dy;
+      const int inRange = SimdF4::MoveMask(SimdF4::Less(dist2, range2)) & lanes;
+      if (!inRange)
+        continue;
+
+      SimdF4 blocked = zero;
+      if (light.ShadowMap) {
+        float x[4], y[4], limit[4];
+        dx.Store(x);
+        dy.Store(y);
+        for (int lane = 0; lane < 4; ++lane)
+          limit[lane] = light.ShadowMap->GetDistance(light.ShadowMap->BinOf(x[lane], y[lane]));
+        const SimdF4 nearest = SimdF4::Load(limit);
+        blocked = SimdF4::Greater(dist2, nearest * nearest);
+      }
+      else {
+        for (std::size_t e = 0; e < s.TN.size(); ++e) {
+          const SimdF4 ex = SimdF4::Set1(s.EX[e]), ey = SimdF4::Set1(s.EY[e]);
+          const SimdF4 wx = SimdF4::Set1(s.WX[e]), wy = SimdF4::Set1(s.WY[e]);
+
+          //light + t * d = start + u * e, with t = cross(w, e) / cross(d, e) and u = cross(w, d) / cross(d, e)
+          const SimdF4 denom = dx * ey - dy * ex;
+          const SimdF4 sign = SimdF4::Select(SimdF4::Less(denom, zero), minusOne, one);
+          const SimdF4 den = denom * sign;
+          const SimdF4 tn = SimdF4::Set1(s.TN[e]) * sign;
+          const SimdF4 un = (wx * dy - wy * dx) * sign;
+
+          const SimdF4 hit = SimdF4::Greater(den, zero) & SimdF4::Greater(tn, zero) & SimdF4::Less(tn, den)
+                           & SimdF4::GreaterEqual(un, zero) & SimdF4::LessEqual(un, den);
+          blocked = blocked | hit;
+          if ((SimdF4::MoveMask(blocked) & inRange) == inRange)
+            break;
+        }
+      }
+
+      const int lit = inRange & ~SimdF4::MoveMask(blocked);
+      if (!lit)
+        continue;
+
+      //SuperBright.fsh's falloff
+      const SimdF4 atten = one - SimdF4::Sqrt(SimdF4::Sqrt(SimdF4::Sqrt(dist2) * invAtten));
+      float amount[4];
+      (SimdF4::Min(SimdF4::Max(atten, zero), one) * intensity).Store(amount);
+
+      for (int lane = 0; lane < 4; ++lane) {
+        if (!(lit & (1 << lane)))
+          continue;
+        const std::uint32_t point = Index[first + lane];
+        out.LitBy[point * out.WordsPerPoint + word] |= bit;
+        out.Intensity[point] += amount[lane];
+      }
+    }
+  }
+
+  float CellSize = 64.f;
+
+  //Points sorted by cell
+  std::vector<std::uint32_t> CellStart;
+  std::vector<std::uint32_t> Fill;
+  std::vector<float> X, Y;
+  std::vector<std::uint32_t> Index;
+  std::vector<Cell> Cells;
+
+  std::vector<CellScratch> Scratch;
+};
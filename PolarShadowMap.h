@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "LightGeometry.h"
+
+/*
+  1D shadow map: the circle around a light cut into Bins equal angular slices, each holding the distance to the
+  nearest caster edge along the ray through the slice's middle (Reach if nothing is in the way)
+
+  Building it is one pass over the edges, each one only touching the slices it spans. After that, whether a point is
+  lit is a single lookup, and the lit region is a fan with one triangle per slice (fewer where neighbouring slices
+  are open), however many edges went in. The price is resolution: anything narrower than a slice can slip between two
+  slice centers, and shadow outlines come out stepped, so the bin count should grow with the size of the light.
+*/
+class PolarShadowMap
+{
+public:
+  static constexpr unsigned MinBins = 64;
+  static constexpr unsigned MaxBins = 4096;
+  static constexpr float PixelsPerBin = 2.f; //Arc length of one slice at the light's radius
+
+  //Enough slices that one is about PixelsPerBin wide where the light runs out
+  static unsigned BinsForRadius(float radius) {
+    const float bins = std::ceil(2.f * Pi * std::max(radius, 0.f) / PixelsPerBin);
+    return static_cast<unsigned>(std::min(std::max(bins, static_cast<float>(MinBins)), static_cast<float>(MaxBins)));
+  }
+
+  void Build(const sf::Vector2f &origin, float reach, unsigned bins, const EdgeSoA &edges) {
+    Origin = origin;
+    Reach = reach;
+    SetBinCount(bins);
+    Distances.assign(Bins, Reach);
+
+    for (std::size_t i = 0; i < edges.Size(); ++i)
+      AddEdge(edges.Start(i) - origin, edges.End(i) - origin);
+  }
+
+  unsigned GetBinCount() const {
+    return Bins;
+  }
+
+  float GetReach() const {
+    return Reach;
+  }
+
+  const sf::Vector2f& GetOrigin() const {
+    return Origin;
+  }
+
+  //Nearest occluder in a slice, Reach if there's none
+  float GetDistance(unsigned bin) const {
+    return Distances[bin];
+  }
+
+  //Slice an offset from the origin falls in
+  unsigned BinOf(float dx, float dy) const {
+    const int bin = static_cast<int>((std::atan2(dy, dx) + Pi) * BinsPerRadian);
+    return static_cast<unsigned>(std::min(std::max(bin, 0), static_cast<int>(Bins) - 1));
+  }
+
+  //Points exactly on the occluder count as lit, like PointVisibilityQuery's edge test
+  bool IsLit(const sf::Vector2f &point) const {
+    const float dx = point.x - Origin.x, dy = point.y - Origin.y;
+    const float limit = Distances[BinOf(dx, dy)];
+    return dx * dx + dy * dy <= limit * limit;
+  }
+
+  //Unit vector along the boundary between slice bin - 1 and bin (bin == Bins wraps back to 0)
+  sf::Vector2f BoundaryDirection(unsigned bin) const {
+    return { BoundaryCos[bin], BoundarySin[bin] };
+  }
+
+private:
+  static constexpr float Pi = 3.14159265f;
+
+  void SetBinCount(unsigned bins) {
+    bins = std::min(std::max(bins, MinBins), MaxBins);
+    if (bins == Bins)
+      return;
+
+    Bins = bins;
+    BinsPerRadian = Bins / (2.f * Pi);
+    BoundaryCos.resize(Bins + 1);
+    BoundarySin.resize(Bins + 1);
+    CenterCos.resize(Bins);
+    CenterSin.resize(Bins);
+    for (unsigned i = 0; i <= Bins; ++i) {
+      const float angle = -Pi + 2.f * Pi * i / Bins;
+      BoundaryCos[i] = std::cos(angle);
+      BoundarySin[i] = std::sin(angle);
+      if (i < Bins) {
+        CenterCos[i] = std::cos(angle + Pi / Bins);
+        CenterSin[i] = std::sin(angle + Pi / Bins);
+      }
+    }
+  }
+
+  //a and b relative to the origin. Only slices whose middle ray crosses the edge are touched
+  void AddEdge(sf::Vector2f a, sf::Vector2f b) {
+    //Edges pointing straight at the light (or touching it) don't block anything, same as the visibility sweep
+    float cross = a.x * b.y - a.y * b.x;
+    if (std::abs(cross) < 1e-6f)
+      return;
+    if (cross < 0.f) {
+      std::swap(a, b);
+      cross = -cross;
+    }
+
+    //Any ray between a and b (counter-clockwise) hits the edge at t = cross(a, b) / cross(d, b - a)
+    const sf::Vector2f e = b - a;
+    const float from = std::atan2(a.y, a.x);
+    float to = std::atan2(b.y, b.x);
+    if (to < from)
+      to += 2.f * Pi; //Wraps past +pi
+    const float first = std::ceil((from + Pi) * BinsPerRadian - 0.5f);
+    const float last = std::floor((to + Pi) * BinsPerRadian - 0.5f);
+
+    for (int i = static_cast<int>(first); i <= static_cast<int>(last); ++i) {
+      const unsigned bin = static_cast<unsigned>(i) % Bins;
+      const float denom = CenterCos[bin] * e.y - CenterSin[bin] * e.x;
+      if (denom <= 0.f)
+        continue;
+      Distances[bin] = std::min(Distances[bin], cross / denom);
+    }
+  }
+
+  sf::Vector2f Origin;
+  float Reach = 0.f;
+  unsigned Bins = 0;
+  float BinsPerRadian = 0.f;
+  std::vector<float> Distances;
+
+  //Per bin count, so only recomputed when it changes
+  std::vector<float> BoundaryCos, BoundarySin;
+  std::vector<float> CenterCos, CenterSin;
+};
@@ -0,0 +1,623 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <SFML\Graphics.hpp>
+
+#include "EdgeGrid.h"
+#include "LightGeometry.h"
+
+/*
+  Binary scene files: the lights, plus the static caster edges after CasterEdgeBuilder is done with them, cut into
+  square chunks that each carry their own edge grid. Everything is stored the way LSystem queries it (flat float and
+  uint32 arrays in native byte order, which is little-endian everywhere SFML runs), so a mapped file is used in place:
+  opening one checks the header and the chunk table and nothing else, no edge is parsed or copied.
+
+  Layout, every block 16 byte aligned:
+    SceneFileHeader
+    SceneFileLight[LightCount]
+    SceneFileChunk[ChunkCount]
+    each chunk's data at its DataOffset, as laid out by SceneChunkLayout
+
+  An edge goes into the chunk its midpoint is in, so no edge is stored twice. A chunk's bounds cover its edges whole,
+  which means neighbouring chunks' bounds can overlap a little. Version is bumped whenever any of this changes, and
+  files of any other version are refused.
+*/
+static constexpr char SceneFileMagic[4] = { 'L', 'S', 'Y', 'S' };
+static constexpr std::uint32_t SceneFileVersion = 2;
+
+struct SceneFileHeader
+{
+  char Magic[4];
+  std::uint32_t Version;
+  std::uint32_t HeaderSize;   //sizeof(SceneFileHeader), as a sanity check on the struct packing
+  std::uint32_t LightCount;
+  std::uint32_t ChunkCount;
+  float ChunkSize;
+  std::uint64_t LightsOffset;
+  std::uint64_t ChunksOffset;
+  std::uint64_t FileSize;
+  std::uint64_t EdgeCount;    //Summed over every chunk
+  std::uint32_t Reserved[2];
+};
+
+struct SceneFileLight
+{
+  float X, Y;
+  float Intensity;
+  float Attenuation;
+  float Expand;
+  float Radius;
+  std::uint8_t R, G, B, A;
+  std::uint32_t ShadowBins;
+};
+
+struct SceneFileChunk
+{
+  float MinX, MinY, MaxX, MaxY; //Bounds of the chunk's edges
+  float GridMinX, GridMinY;
+  float CellSize;
+  std::int32_t Columns;
+  std::int32_t Rows;
+  std::uint32_t EdgeCount;
+  std::uint32_t CellEdgeCount;
+  std::uint32_t Reserved;
+  std::uint64_t DataOffset;
+  std::uint64_t DataSize;
+};
+
+static_assert(sizeof(SceneFileHeader) == 64, "SceneFileHeader must pack to 64 bytes");
+static_assert(sizeof(SceneFileLight) == 32, "SceneFileLight must pack to 32 bytes");
+static_assert(sizeof(SceneFileChunk) == 64, "SceneFileChunk must pack to 64 bytes");
+
+//Where each of a chunk's arrays starts, in bytes from its DataOffset. Shared by the writer and the reader so they can't disagree
+struct SceneChunkLayout
+{
+  std::uint64_t StartX = 0, StartY = 0, EndX = 0, EndY = 0; //float[EdgeCount] each
+  std::uint64_t Loops = 0;                                  //uint32[EdgeCount], see CasterEdgeBuilder::Finish
+  std::uint64_t TwoSided = 0;                               //uint8[EdgeCount], 1 for edges that shadow from both sides
+  std::uint64_t CellStart = 0;                              //uint32[Columns * Rows + 1], none without a grid
+  std::uint64_t CellEdges = 0;                              //uint32[CellEdgeCount]
+  std::uint64_t Size = 0;
+
+  SceneChunkLayout(std::uint64_t edges, std::uint64_t cells, std::uint64_t cellEdges) {
+    const std::uint64_t floats = edges * sizeof(float);
+    StartX = 0;
+    StartY = StartX + floats;
+    EndX = StartY + floats;
+    EndY = EndX + floats;
+    Loops = EndY + floats;
+    TwoSided = Loops + edges * sizeof(std::uint32_t);
+    CellStart = Align(TwoSided + edges, 4);
+    CellEdges = CellStart + (cells == 0 ? 0 : (cells + 1) * sizeof(std::uint32_t));
+    Size = Align(CellEdges + cellEdges * sizeof(std::uint32_t), 16);
+  }
+
+  static std::uint64_t Align(std::uint64_t offset, std::uint64_t to) {
+    return (offset + to - 1) / to * to;
+  }
+};
+
+/*
+  A whole file mapped read-only. The mapping outlives the handles, so only the view is kept around.
+  Prefetch and Release are only hints to the OS about which pages are worth keeping in memory, the data stays valid
+  (and readable) either way.
+*/
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile& operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    Close();
+  }
+
+  bool Open(const std::string &path) {
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && static_cast<std::uint64_t>(size.QuadPart) <= SIZE_MAX)
+      mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) {
+      Bytes = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      Length = Bytes ? static_cast<std::size_t>(size.QuadPart) : 0;
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    const int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0)
+      return false;
+
+    struct stat info;
+    if (::fstat(file, &info) == 0 && info.st_size > 0) {
+      void *view = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+      if (view != MAP_FAILED) {
+        Bytes = static_cast<const std::uint8_t*>(view);
+        Length = static_cast<std::size_t>(info.st_size);
+      }
+    }
+    ::close(file);
+#endif
+    return Bytes != nullptr;
+  }
+
+  void Close() {
+    if (!Bytes)
+      return;
+#ifdef _WIN32
+    UnmapViewOfFile(Bytes);
+#else
+    ::munmap(const_cast<std::uint8_t*>(Bytes), Length);
+#endif
+    Bytes = nullptr;
+    Length = 0;
+  }
+
+  bool IsOpen() const {
+    return Bytes != nullptr;
+  }
+
+  const std::uint8_t* Data() const {
+    return Bytes;
+  }
+
+  std::size_t Size() const {
+    return Length;
+  }
+
+  //[offset, offset + size) is about to be read
+  void Prefetch(std::size_t offset, std::size_t size) {
+#ifndef _WIN32
+    //Rounded outwards, so the first and last pages are fetched too
+    const std::size_t page = PageSize();
+    const std::size_t first = offset / page * page;
+    const std::size_t last = std::min(offset + size, Length);
+    if (last > first)
+      ::madvise(const_cast<std::uint8_t*>(Bytes) + first, last - first, MADV_WILLNEED);
+#else
+    (void)offset; (void)size;
+#endif
+  }
+
+  //[offset, offset + size) won't be read for a while, so its pages can go
+  void Release(std::size_t offset, std::size_t size) {
+    //Rounded inwards, so pages shared with whatever is next to it stay
+    const std::size_t page = PageSize();
+    const std::size_t first = (offset + page - 1) / page * page;
+    const std::size_t last = std::min(offset + size, Length) / page * page;
+    if (last <= first)
+      return;
+#ifdef _WIN32
+    //Unlocking pages that aren't locked takes them out of the working set, which is what we're after here
+    VirtualUnlock(const_cast<std::uint8_t*>(Bytes) + first, last - first);
+#else
+    ::madvise(const_cast<std::uint8_t*>(Bytes) + first, last - first, MADV_DONTNEED);
+#endif
+  }
+
+private:
+  static std::size_t PageSize() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+  }
+
+  const std::uint8_t *Bytes = nullptr;
+  std::size_t Length = 0;
+};
+
+/*
+  Writes scene files. The edges are expected to come straight out of CasterEdgeBuilder::Finish (LSystem::SaveScene
+  hands over its WorldEdges), they're only sorted into chunks here.
+
+  The file is written next to path and renamed over it once it's complete, so a scene that's mapped from path right now
+  keeps reading the old file instead of one being truncated under it.
+*/
+class SceneFileWriter
+{
+public:
+  bool Write(const std::string &path, const std::vector<SceneFileLight> &lights, const EdgeSoA &edges,
+             const std::vector<std::uint8_t> &twoSided, const std::vector<std::uint32_t> &loops, float chunkSize, float cellSize) {
+    chunkSize = std::max(chunkSize, 1.f);
+    SortIntoChunks(edges, chunkSize);
+
+    SceneFileHeader header = {};
+    std::memcpy(header.Magic, SceneFileMagic, sizeof(header.Magic));
+    header.Version = SceneFileVersion;
+    header.HeaderSize = sizeof(SceneFileHeader);
+    header.LightCount = static_cast<std::uint32_t>(lights.size());
+    header.ChunkCount = static_cast<std::uint32_t>(ChunkStart.size() - 1);
+    header.ChunkSize = chunkSize;
+    header.LightsOffset = sizeof(SceneFileHeader);
+    header.ChunksOffset = header.LightsOffset + lights.size() * sizeof(SceneFileLight);
+    header.EdgeCount = edges.Size();
+
+    const std::string temporary = path + ".tmp";
+    FILE *file = std::fopen(temporary.c_str(), "wb");
+    if (!file)
+      return false;
+
+    //The header and chunk table are only complete once every chunk is written, so they're written last
+    std::uint64_t offset = SceneChunkLayout::Align(header.ChunksOffset + header.ChunkCount * sizeof(SceneFileChunk), 16);
+    bool ok = std::fseek(file, static_cast<long>(header.LightsOffset), SEEK_SET) == 0 &&
+              WriteArray(file, lights.data(), lights.size());
+    Table.clear();
+    Grid.SetCellSize(cellSize);
+    for (std::size_t c = 0; ok && c + 1 < ChunkStart.size(); ++c) {
+      ChunkEdges.Clear();
+      ChunkTwoSided.clear();
+      ChunkLoops.clear();
+      for (std::size_t i = ChunkStart[c]; i < ChunkStart[c + 1]; ++i) {
+        ChunkEdges.Push(edges.Start(Order[i]), edges.End(Order[i]));
+        ChunkTwoSided.push_back(twoSided[Order[i]]);
+        ChunkLoops.push_back(loops[Order[i]]);
+      }
+      Grid.Build(ChunkEdges);
+      const EdgeGridView grid = Grid.GetView();
+      const std::size_t cells = static_cast<std::size_t>(grid.Columns) * grid.Rows;
+      const SceneChunkLayout layout(ChunkEdges.Size(), cells, grid.GetCellEdgeCount());
+
+      SceneFileChunk chunk = {};
+      sf::Vector2f min = ChunkEdges.Start(0), max = min;
+      for (std::size_t i = 0; i < ChunkEdges.Size(); ++i) {
+        const sf::Vector2f start = ChunkEdges.Start(i), end = ChunkEdges.End(i);
+        min.x = std::min({ min.x, start.x, end.x }); min.y = std::min({ min.y, start.y, end.y });
+        max.x = std::max({ max.x, start.x, end.x }); max.y = std::max({ max.y, start.y, end.y });
+      }
+      chunk.MinX = min.x; chunk.MinY = min.y;
+      chunk.MaxX = max.x; chunk.MaxY = max.y;
+      chunk.GridMinX = grid.Min.x;
+      chunk.GridMinY = grid.Min.y;
+      chunk.CellSize = grid.CellSize;
+      chunk.Columns = grid.Columns;
+      chunk.Rows = grid.Rows;
+      chunk.EdgeCount = static_cast<std::uint32_t>(ChunkEdges.Size());
+      chunk.CellEdgeCount = static_cast<std::uint32_t>(grid.GetCellEdgeCount());
+      chunk.DataOffset = offset;
+      chunk.DataSize = layout.Size;
+      Table.push_back(chunk);
+
+      ok = WriteAt(file, offset + layout.StartX, ChunkEdges.StartX.data(), ChunkEdges.Size()) &&
+           WriteAt(file, offset + layout.StartY, ChunkEdges.StartY.data(), ChunkEdges.Size()) &&
+           WriteAt(file, offset + layout.EndX, ChunkEdges.EndX.data(), ChunkEdges.Size()) &&
+           WriteAt(file, offset + layout.EndY, ChunkEdges.EndY.data(), ChunkEdges.Size()) &&
+           WriteAt(file, offset + layout.Loops, ChunkLoops.data(), ChunkLoops.size()) &&
+           WriteAt(file, offset + layout.TwoSided, ChunkTwoSided.data(), ChunkTwoSided.size()) &&
+           (cells == 0 || WriteAt(file, offset + layout.CellStart, grid.CellStart, cells + 1)) &&
+           WriteAt(file, offset + layout.CellEdges, grid.CellEdges, grid.GetCellEdgeCount());
+      offset += layout.Size;
+    }
+
+    header.FileSize = offset;
+    ok = ok && Pad(file, offset) &&
+         WriteAt(file, header.ChunksOffset, Table.data(), Table.size()) &&
+         WriteAt(file, 0, &header, 1);
+    ok = std::fclose(file) == 0 && ok;
+
+    //Renaming over an existing file fails on some platforms, so that's retried once it's out of the way
+    if (ok && std::rename(temporary.c_str(), path.c_str()) != 0) {
+      std::remove(path.c_str());
+      ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+      std::remove(temporary.c_str());
+    return ok;
+  }
+
+private:
+  //Order lists the edges chunk by chunk (rows top to bottom, then columns), ChunkStart[c] .. ChunkStart[c + 1] is chunk c's part
+  void SortIntoChunks(const EdgeSoA &edges, float chunkSize) {
+    Keys.clear();
+    for (std::uint32_t i = 0; i < edges.Size(); ++i) {
+      const sf::Vector2f mid = (edges.Start(i) + edges.End(i)) * 0.5f;
+      Keys.push_back({ static_cast<std::int64_t>(std::floor(mid.y / chunkSize)), static_cast<std::int64_t>(std::floor(mid.x / chunkSize)), i });
+    }
+    //Stable, so each chunk keeps the edges in CasterEdgeBuilder's order
+    std::stable_sort(Keys.begin(), Keys.end(), [](const ChunkKey &a, const ChunkKey &b) {
+      return std::tie(a.Row, a.Column) < std::tie(b.Row, b.Column);
+    });
+
+    Order.clear();
+    ChunkStart.assign(1, 0);
+    for (std::size_t i = 0; i < Keys.size(); ++i) {
+      if (i > 0 && (Keys[i].Row != Keys[i - 1].Row || Keys[i].Column != Keys[i - 1].Column))
+        ChunkStart.push_back(static_cast<std::uint32_t>(i));
+      Order.push_back(Keys[i].Edge);
+    }
+    if (!Keys.empty())
+      ChunkStart.push_back(static_cast<std::uint32_t>(Keys.size()));
+  }
+
+  template <typename T>
+  static bool WriteArray(FILE *file, const T *data, std::size_t count) {
+    return count == 0 || std::fwrite(data, sizeof(T), count, file) == count;
+  }
+
+  //fseek only takes a long, so files past 2GB are refused rather than written wrong where long is 32 bits
+  template <typename T>
+  static bool WriteAt(FILE *file, std::uint64_t offset, const T *data, std::size_t count) {
+    return offset <= static_cast<std::uint64_t>(LONG_MAX) &&
+           std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0 && WriteArray(file, data, count);
+  }
+
+  //Makes sure the file really is size bytes long, even if the last chunk ends in padding
+  static bool Pad(FILE *file, std::uint64_t size) {
+    if (std::fseek(file, 0, SEEK_END) != 0)
+      return false;
+    const long end = std::ftell(file);
+    if (end < 0 || static_cast<std::uint64_t>(end) > size)
+      return false;
+
+    const std::uint8_t zero[16] = {};
+    for (std::uint64_t left = size - end; left > 0; ) {
+      const std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(left, sizeof(zero)));
+      if (!WriteArray(file, zero, count))
+        return false;
+      left -= count;
+    }
+    return true;
+  }
+
+  struct ChunkKey
+  {
+    std::int64_t Row;
+    std::int64_t Column;
+    std::uint32_t Edge;
+  };
+
+  std::vector<ChunkKey> Keys;
+  std::vector<std::uint32_t> Order;
+  std::vector<std::uint32_t> ChunkStart;
+  std::vector<SceneFileChunk> Table;
+  EdgeSoA ChunkEdges;
+  std::vector<std::uint8_t> ChunkTwoSided;
+  std::vector<std::uint32_t> ChunkLoops;
+  EdgeGrid Grid;
+};
+
+//One chunk of a MappedScene, pointing straight into the mapping
+struct SceneChunkView
+{
+  sf::Vector2f Min;
+  sf::Vector2f Max;
+  EdgeSoAView Edges;
+  const std::uint8_t *TwoSided = nullptr;
+  const std::uint32_t *Loops = nullptr;
+  EdgeGridView Grid;
+
+  std::uint32_t CellEdgeCount = 0;
+  std::uint64_t DataOffset = 0;
+  std::uint64_t DataSize = 0;
+  bool Checked = false;  //The grid has been looked over, see MappedScene::CheckChunk
+  bool Valid = false;
+  bool Resident = false;
+};
+
+//Chunk counts of the scene LSystem::LoadScene mapped
+struct SceneStreamStats
+{
+  std::size_t Chunks = 0;
+  std::size_t ResidentChunks = 0;
+  std::size_t ResidentEdges = 0;
+  std::size_t RejectedChunks = 0; //Chunks whose grid turned out to be broken, they're left out
+};
+
+/*
+  A scene file mapped into memory. Open only reads the header and the chunk table. A chunk's grid is checked the first
+  time it's made resident, so a broken or truncated file can't send a query outside the mapping, and a chunk that fails
+  is just left out.
+*/
+class MappedScene
+{
+public:
+  bool Open(const std::string &path) {
+    Close();
+    if (!File.Open(path))
+      return Fail("can't map the file");
+
+    const std::uint8_t *data = File.Data();
+    const std::uint64_t size = File.Size();
+    if (size < sizeof(SceneFileHeader))
+      return Fail("too short for a scene file");
+
+    std::memcpy(&Header, data, sizeof(SceneFileHeader));
+    if (std::memcmp(Header.Magic, SceneFileMagic, sizeof(Header.Magic)) != 0)
+      return Fail("not a scene file");
+    if (Header.Version != SceneFileVersion || Header.HeaderSize != sizeof(SceneFileHeader))
+      return Fail("unsupported scene file version");
+    if (Header.FileSize != size)
+      return Fail("file size doesn't match the header");
+    if (!Fits(Header.LightsOffset, Header.LightCount, sizeof(SceneFileLight)) ||
+        !Fits(Header.ChunksOffset, Header.ChunkCount, sizeof(SceneFileChunk)))
+      return Fail("light or chunk table out of range");
+
+    Chunks.resize(Header.ChunkCount);
+    for (std::uint32_t c = 0; c < Header.ChunkCount; ++c) {
+      SceneFileChunk entry;
+      std::memcpy(&entry, data + Header.ChunksOffset + c * sizeof(SceneFileChunk), sizeof(SceneFileChunk));
+
+      const bool hasGrid = entry.Columns > 0 && entry.Rows > 0;
+      if (entry.Columns < 0 || entry.Rows < 0 || (entry.EdgeCount > 0 && !hasGrid) ||
+          !std::isfinite(entry.CellSize) || !(entry.CellSize > 0.f))
+        return Fail("bad chunk grid");
+
+      const std::uint64_t cells = hasGrid ? static_cast<std::uint64_t>(entry.Columns) * entry.Rows : 0;
+      const SceneChunkLayout layout(entry.EdgeCount, cells, entry.CellEdgeCount);
+      if (entry.DataOffset % 16 != 0 || entry.DataSize != layout.Size || !Fits(entry.DataOffset, 1, layout.Size))
+        return Fail("chunk data out of range");
+
+      SceneChunkView &chunk = Chunks[c];
+      const std::uint8_t *base = data + entry.DataOffset;
+      chunk.Min = { entry.MinX, entry.MinY };
+      chunk.Max = { entry.MaxX, entry.MaxY };
+      chunk.Edges.StartX = reinterpret_cast<const float*>(base + layout.StartX);
+      chunk.Edges.StartY = reinterpret_cast<const float*>(base + layout.StartY);
+      chunk.Edges.EndX = reinterpret_cast<const float*>(base + layout.EndX);
+      chunk.Edges.EndY = reinterpret_cast<const float*>(base + layout.EndY);
+      chunk.Edges.Count = entry.EdgeCount;
+      chunk.TwoSided = base + layout.TwoSided;
+      chunk.Loops = reinterpret_cast<const std::uint32_t*>(base + layout.Loops);
+      chunk.Grid.CellStart = reinterpret_cast<const std::uint32_t*>(base + layout.CellStart);
+      chunk.Grid.CellEdges = reinterpret_cast<const std::uint32_t*>(base + layout.CellEdges);
+      chunk.Grid.Columns = hasGrid ? entry.Columns : 0;
+      chunk.Grid.Rows = hasGrid ? entry.Rows : 0;
+      chunk.Grid.Min = { entry.GridMinX, entry.GridMinY };
+      chunk.Grid.CellSize = entry.CellSize;
+      chunk.CellEdgeCount = entry.CellEdgeCount;
+      chunk.DataOffset = entry.DataOffset;
+      chunk.DataSize = entry.DataSize;
+    }
+    return true;
+  }
+
+  void Close() {
+    File.Close();
+    Chunks.clear();
+    Resident.clear();
+    Header = {};
+    Error = nullptr;
+  }
+
+  bool IsOpen() const {
+    return File.IsOpen();
+  }
+
+  //Why the last Open failed
+  const char* GetError() const {
+    return Error ? Error : "";
+  }
+
+  std::size_t GetLightCount() const {
+    return Header.LightCount;
+  }
+
+  SceneFileLight GetLight(std::size_t i) const {
+    SceneFileLight light;
+    std::memcpy(&light, File.Data() + Header.LightsOffset + i * sizeof(SceneFileLight), sizeof(SceneFileLight));
+    return light;
+  }
+
+  std::size_t GetChunkCount() const {
+    return Chunks.size();
+  }
+
+  const SceneChunkView& GetChunk(std::size_t i) const {
+    return Chunks[i];
+  }
+
+  //Indices of the resident chunks, in file order
+  const std::vector<std::uint32_t>& GetResident() const {
+    return Resident;
+  }
+
+  /*
+    Makes the chunks whose bounds touch region resident and lets the rest go, or keeps every chunk resident when region
+    is null. The bounds of each chunk that came in or went out are added to changed.
+  */
+  void Stream(const sf::FloatRect *region, std::vector<sf::FloatRect> &changed) {
+    Resident.clear();
+    for (std::uint32_t c = 0; c < Chunks.size(); ++c) {
+      SceneChunkView &chunk = Chunks[c];
+      bool wanted = !region || (chunk.Min.x <= region->left + region->width && chunk.Max.x >= region->left &&
+                                chunk.Min.y <= region->top + region->height && chunk.Max.y >= region->top);
+      if (wanted && !chunk.Checked) {
+        chunk.Valid = CheckChunk(chunk);
+        chunk.Checked = true;
+      }
+      wanted = wanted && chunk.Valid;
+
+      if (wanted != chunk.Resident) {
+        chunk.Resident = wanted;
+        changed.push_back({ chunk.Min, chunk.Max - chunk.Min });
+        if (wanted)
+          File.Prefetch(static_cast<std::size_t>(chunk.DataOffset), static_cast<std::size_t>(chunk.DataSize));
+        else
+          File.Release(static_cast<std::size_t>(chunk.DataOffset), static_cast<std::size_t>(chunk.DataSize));
+      }
+      if (wanted)
+        Resident.push_back(c);
+    }
+  }
+
+  SceneStreamStats GetStats() const {
+    SceneStreamStats stats;
+    stats.Chunks = Chunks.size();
+    stats.ResidentChunks = Resident.size();
+    for (auto & chunk : Chunks) {
+      stats.ResidentEdges += chunk.Resident ? chunk.Edges.Size() : 0;
+      stats.RejectedChunks += chunk.Checked && !chunk.Valid ? 1 : 0;
+    }
+    return stats;
+  }
+
+private:
+  bool Fail(const char *error) {
+    Close();
+    Error = error;
+    return false;
+  }
+
+  //count items of size bytes at offset lie inside the file
+  bool Fits(std::uint64_t offset, std::uint64_t count, std::uint64_t size) const {
+    return offset % 4 == 0 && offset <= File.Size() && (size == 0 || count <= (File.Size() - offset) / size);
+  }
+
+  //CellStart has to run from 0 up to CellEdgeCount without going backwards, and CellEdges can only name the chunk's own edges
+  static bool CheckChunk(const SceneChunkView &chunk) {
+    const EdgeGridView &grid = chunk.Grid;
+    if (grid.Columns == 0)
+      return true;
+
+    const std::size_t cells = static_cast<std::size_t>(grid.Columns) * grid.Rows;
+    if (grid.CellStart[0] != 0 || grid.CellStart[cells] != chunk.CellEdgeCount)
+      return false;
+    for (std::size_t c = 0; c < cells; ++c) {
+      if (grid.CellStart[c + 1] < grid.CellStart[c])
+        return false;
+    }
+
+    for (std::uint32_t i = 0; i < chunk.CellEdgeCount; ++i) {
+      if (grid.CellEdges[i] >= chunk.Edges.Size())
+        return false;
+    }
+    return true;
+  }
+
+  MappedFile File;
+  SceneFileHeader Header = {};
+  std::vector<SceneChunkView> Chunks;
+  std::vector<std::uint32_t> Resident;
+  const char *Error = nullptr;
+};
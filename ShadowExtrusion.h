@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include "LightGeometry.h"
+#include "LightSimd.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+//Outer points of a batch of extruded edges, laid out like EdgeSoA
+struct ExtrudedEdges
+{
+  std::vector<float> StartX;
+  std::vector<float> StartY;
+  std::vector<float> EndX;
+  std::vector<float> EndY;
+
+  void Resize(std::size_t count) {
+    StartX.resize(count); StartY.resize(count); EndX.resize(count); EndY.resize(count);
+  }
+
+  sf::Vector2f Start(std::size_t i) const {
+    return { StartX[i], StartY[i] };
+  }
+
+  sf::Vector2f End(std::size_t i) const {
+    return { EndX[i], EndY[i] };
+  }
+};
+
+/*
+  The per-edge part of UpdateLight's quad path: push both endpoints of every edge directly away from the light
+
+    outer = p + normalize(p - light) * distance
+
+  Extrude picks AVX (8 at a time) or SSE2 (4 at a time) depending on what the compiler targets, with the scalar loop
+  picking up the tail. All of them use a real sqrt and divide rather than the reciprocal estimates, so they give the same
+  numbers as ExtrudeScalar, which is kept around as the reference (LightingBenchmark checks the two against each other).
+  That only holds if neither gets its multiply and add fused, which GCC and Clang will do on their own when targeting FMA.
+*/
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+class ShadowExtrusion
+{
+public:
+  static void Extrude(const EdgeSoA &edges, const sf::Vector2f &light, float distance, ExtrudedEdges &out) {
+    const std::size_t count = edges.Size();
+    out.Resize(count);
+    if (count == 0)
+      return;
+
+    ExtrudePoints(edges.StartX.data(), edges.StartY.data(), count, light, distance, out.StartX.data(), out.StartY.data());
+    ExtrudePoints(edges.EndX.data(), edges.EndY.data(), count, light, distance, out.EndX.data(), out.EndY.data());
+  }
+
+  static void ExtrudeScalar(const EdgeSoA &edges, const sf::Vector2f &light, float distance, ExtrudedEdges &out) {
+    const std::size_t count = edges.Size();
+    out.Resize(count);
+    if (count == 0)
+      return;
+
+    ExtrudePointsScalar(edges.StartX.data(), edges.StartY.data(), 0, count, light, distance, out.StartX.data(), out.StartY.data());
+    ExtrudePointsScalar(edges.EndX.data(), edges.EndY.data(), 0, count, light, distance, out.EndX.data(), out.EndY.data());
+  }
+
+  static void ExtrudePoints(const float *x, const float *y, std::size_t count, const sf::Vector2f &light, float distance, float *outX, float *outY) {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    std::size_t i = 0;
+
+#if defined(__AVX__)
+    {
+      const __m256 lx = _mm256_set1_ps(light.x);
+      const __m256 ly = _mm256_set1_ps(light.y);
+      const __m256 atten = _mm256_set1_ps(distance);
+      for (; i + 8 <= count; i += 8) {
+        const __m256 px = _mm256_loadu_ps(x + i);
+        const __m256 py = _mm256_loadu_ps(y + i);
+        const __m256 dx = _mm256_sub_ps(px, lx);
+        const __m256 dy = _mm256_sub_ps(py, ly);
+        const __m256 mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        _mm256_storeu_ps(outX + i, _mm256_add_ps(px, _mm256_mul_ps(_mm256_div_ps(dx, mag), atten)));
+        _mm256_storeu_ps(outY + i, _mm256_add_ps(py, _mm256_mul_ps(_mm256_div_ps(dy, mag), atten)));
+      }
+    }
+#endif
+
+#if defined(LSYS_SSE2)
+    {
+      const SimdF4 lx = SimdF4::Set1(light.x);
+      const SimdF4 ly = SimdF4::Set1(light.y);
+      const SimdF4 atten = SimdF4::Set1(distance);
+      for (; i + 4 <= count; i += 4) {
+        const SimdF4 px = SimdF4::Load(x + i);
+        const SimdF4 py = SimdF4::Load(y + i);
+        const SimdF4 dx = px - lx;
+        const SimdF4 dy = py - ly;
+        const SimdF4 mag = SimdF4::Sqrt(dx * dx + dy * dy);
+        (px + (dx / mag) * atten).Store(outX + i);
+        (py + (dy / mag) * atten).Store(outY + i);
+      }
+    }
+#endif
+
+    ExtrudePointsScalar(x, y, i, count, light, distance, outX, outY);
+  }
+
+private:
+  //Same steps as normalize() in NewLightSystem.h
+  static void ExtrudePointsScalar(const float *x, const float *y, std::size_t first, std::size_t count, const sf::Vector2f &light, float distance, float *outX, float *outY) {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    for (std::size_t i = first; i < count; ++i) {
+      const float dx = x[i] - light.x;
+      const float dy = y[i] - light.y;
+      const float mag = std::sqrt(dx * dx + dy * dy);
+      outX[i] = x[i] + (dx / mag) * distance;
+      outY[i] = y[i] + (dy / mag) * distance;
+    }
+  }
+};
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
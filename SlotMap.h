@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+  Handle into a SlotMap. Index picks the slot, Generation has to match the slot's current generation,
+  so a handle to something that was removed (even if the slot got reused since) is detected as stale.
+  Tag only exists so light and caster handles can't be mixed up.
+*/
+template <typename Tag>
+struct SlotHandle
+{
+  static constexpr std::uint32_t InvalidIndex = 0xFFFFFFFFu;
+
+  std::uint32_t Index = InvalidIndex;
+  std::uint32_t Generation = 0;
+
+  bool IsNull() const {
+    return Index == InvalidIndex;
+  }
+
+  friend bool operator==(const SlotHandle &a, const SlotHandle &b) {
+    return a.Index == b.Index && a.Generation == b.Generation;
+  }
+
+  friend bool operator!=(const SlotHandle &a, const SlotHandle &b) {
+    return !(a == b);
+  }
+};
+
+/*
+  Dense storage with stable handles
+
+  Values live packed in one vector, so iterating them is a straight walk over memory. Slots map a handle to the value's
+  current dense position. Removing swaps the last value into the hole, so add, remove and lookup are all O(1),
+  but removal does change the iteration order.
+*/
+template <typename T, typename Tag>
+class SlotMap
+{
+public:
+  using Handle = SlotHandle<Tag>;
+
+  Handle Insert(T &&value) {
+    std::uint32_t index;
+    if (FreeHead != Handle::InvalidIndex) {
+      index = FreeHead;
+      FreeHead = Slots[index].Dense;
+    }
+    else {
+      index = static_cast<std::uint32_t>(Slots.size());
+      Slots.push_back({});
+    }
+
+    Slots[index].Dense = static_cast<std::uint32_t>(Dense.size());
+    Dense.push_back(std::move(value));
+    DenseToSlot.push_back(index);
+    return { index, Slots[index].Generation };
+  }
+
+  bool Remove(const Handle &handle) {
+    if (!Contains(handle))
+      return false;
+
+    Slot &slot = Slots[handle.Index];
+    const std::uint32_t hole = slot.Dense;
+    const std::uint32_t last = static_cast<std::uint32_t>(Dense.size()) - 1;
+    if (hole != last) {
+      Dense[hole] = std::move(Dense[last]);
+      DenseToSlot[hole] = DenseToSlot[last];
+      Slots[DenseToSlot[hole]].Dense = hole;
+    }
+    Dense.pop_back();
+    DenseToSlot.pop_back();
+
+    //Bumping the generation is what makes old handles stale
+    slot.Generation++;
+    slot.Dense = FreeHead;
+    FreeHead = handle.Index;
+    return true;
+  }
+
+  bool Contains(const Handle &handle) const {
+    return handle.Index < Slots.size() && Slots[handle.Index].Generation == handle.Generation
+      && Slots[handle.Index].Dense < Dense.size() && DenseToSlot[Slots[handle.Index].Dense] == handle.Index;
+  }
+
+  T* Get(const Handle &handle) {
+    return Contains(handle) ? &Dense[Slots[handle.Index].Dense] : nullptr;
+  }
+
+  const T* Get(const Handle &handle) const {
+    return Contains(handle) ? &Dense[Slots[handle.Index].Dense] : nullptr;
+  }
+
+  //Handle of the value currently at dense position i
+  Handle HandleAt(std::size_t i) const {
+    return { DenseToSlot[i], Slots[DenseToSlot[i]].Generation };
+  }
+
+  std::size_t Size() const { return Dense.size(); }
+  bool Empty() const { return Dense.empty(); }
+
+  T& operator[](std::size_t i) { return Dense[i]; }
+  const T& operator[](std::size_t i) const { return Dense[i]; }
+
+  typename std::vector<T>::iterator begin() { return Dense.begin(); }
+  typename std::vector<T>::iterator end() { return Dense.end(); }
+  typename std::vector<T>::const_iterator begin() const { return Dense.begin(); }
+  typename std::vector<T>::const_iterator end() const { return Dense.end(); }
+
+private:
+  struct Slot
+  {
+    std::uint32_t Dense = 0;      //Dense position while alive, next free slot while free
+    std::uint32_t Generation = 0;
+  };
+
+  std::vector<T> Dense;
+  std::vector<std::uint32_t> DenseToSlot;
+  std::vector<Slot> Slots;
+  std::uint32_t FreeHead = Handle::InvalidIndex;
+};
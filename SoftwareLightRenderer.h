@@ -0,0 +1,499 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "LightAccumulation.h"
+#include "LightMesh.h"
+#include "LightSimd.h"
+#include "LightTiles.h"
+#include "LightWorkerPool.h"
+
+//Plain float RGBA image, row 0 at the top like the window, values in [0, 1]
+struct SoftwareLightTarget
+{
+  unsigned Width = 0;
+  unsigned Height = 0;
+  std::vector<float> Pixels;
+
+  void Create(unsigned width, unsigned height) {
+    Width = width;
+    Height = height;
+    Pixels.assign(static_cast<std::size_t>(width) * height * 4, 0.f);
+  }
+
+  void Clear(const sf::Color &color) {
+    for (std::size_t i = 0; i < Pixels.size(); i += 4) {
+      Pixels[i + 0] = color.r / 255.f;
+      Pixels[i + 1] = color.g / 255.f;
+      Pixels[i + 2] = color.b / 255.f;
+      Pixels[i + 3] = color.a / 255.f;
+    }
+  }
+
+  void LoadRGBA8(const std::uint8_t *pixels) {
+    for (std::size_t i = 0; i < Pixels.size(); ++i)
+      Pixels[i] = pixels[i] / 255.f;
+  }
+
+  void ToRGBA8(std::vector<std::uint8_t> &out) const {
+    out.resize(Pixels.size());
+    for (std::size_t i = 0; i < Pixels.size(); ++i)
+      out[i] = static_cast<std::uint8_t>(std::min(std::max(Pixels[i], 0.f), 1.f) * 255.f + 0.5f);
+  }
+};
+
+//One light as the software path sees it, the same things RenderOntoScene hands to MaskShader.fsh
+struct SoftwareLight
+{
+  sf::Vector2f Position;
+  float Attenuation = 0.f;
+  sf::Color Color;
+  float Intensity = 1.f;
+  const LightMesh *LitRegion = nullptr;    //Light::LightVerts
+  const LightMesh *ShadowRegion = nullptr; //Light::Shadowverts
+};
+
+/*
+  CPU version of RenderOntoScene
+
+  For every pixel and every light, in light order:
+    - the radial falloff from SuperBright.fsh (as it ends up in the falloff texture after the alpha blend)
+    - drawn through LightVerts into the light map, then multiplied to nothing under Shadowverts (CreateLightMap), or
+      by PenumbraShader.fsh's falloff under ShadowMode::Penumbra's wedges
+    - blended into the scene the way MaskShader.fsh does it, including the 8 bit clamp and the alpha blend on the way out
+
+  The image is cut into TileSize x TileSize tiles that are handed to the worker pool. A tile only looks at the lights
+  its LightTileGrid list names (the ones whose attenuation circle touches it), and only at the triangles whose bounds
+  touch it. Pixels are done 4 at a time.
+
+  With SetAccumulate on it follows LightComposite::Accumulate instead: every light's log gain is summed per pixel (rounded
+  the way an 8 bit light buffer would when asked), and the scene is composited once at the end. On opaque scenes the two
+  should agree, which is what this is here to check.
+
+  Lights and their meshes are in world coordinates. SetViewTransform says where the scene's top left pixel is in the
+  world and how many pixels one unit takes up (LSystem passes its view rect), and everything is moved onto the scene's
+  pixels when it's prepared.
+*/
+class SoftwareLightRenderer
+{
+public:
+  static constexpr unsigned TileSize = 32;
+
+  void SetAccumulate(bool accumulate, LightBufferPrecision precision = LightBufferPrecision::RGBA8) {
+    Accumulate = accumulate;
+    Precision = precision;
+  }
+
+  void SetViewTransform(const sf::Vector2f &origin, float pixelsPerUnit) {
+    ViewOrigin = origin;
+    ViewScale = pixelsPerUnit;
+  }
+
+  void Render(SoftwareLightTarget &scene, const std::vector<SoftwareLight> &lights, LightWorkerPool &workers) {
+    Circles.clear();
+    for (auto & light : lights)
+      Circles.push_back({ (light.Position - ViewOrigin) * ViewScale, light.Attenuation * ViewScale });
+    OwnTiles.Build(scene.Width, scene.Height, TileSize, Circles);
+
+    Render(scene, lights, OwnTiles, workers);
+  }
+
+  //tiles has to have been built over lights (same order) for this scene, with TileSize tiles, under the same view transform
+  void Render(SoftwareLightTarget &scene, const std::vector<SoftwareLight> &lights, const LightTileGrid &tiles, LightWorkerPool &workers) {
+    if (scene.Width == 0 || scene.Height == 0)
+      return;
+    if (tiles.GetTileSize() != TileSize || tiles.GetWidth() != scene.Width || tiles.GetHeight() != scene.Height) {
+      Render(scene, lights, workers);
+      return;
+    }
+
+    Prepared.resize(lights.size());
+    workers.Run(lights.size(), [&](std::size_t index, unsigned) {
+      Prepare(lights[index], Prepared[index]);
+    });
+
+    Scratch.resize(workers.GetThreadCount());
+
+    workers.Run(tiles.GetTileCount(), [&](std::size_t tile, unsigned worker) {
+      if (tiles.TileBegin(tile) != tiles.TileEnd(tile))
+        RenderTile(scene, tiles, tile, Scratch[worker]);
+    });
+  }
+
+private:
+  static constexpr unsigned TilePixels = TileSize * TileSize;
+
+  struct Triangle
+  {
+    //Edge functions A * (x - X) + B * (y - Y), all >= 0 inside. (X, Y) is the edge's first point, which keeps the values small near the edge
+    float A[3], B[3], X[3], Y[3];
+    float MinX, MinY, MaxX, MaxY;
+
+    //Penumbra wedges only: texCoords as planes U + dUx * (x - X[0]) + dUy * (y - Y[0]), see PenumbraBuilder
+    bool Soft = false;
+    float U = 0.f, dUx = 0.f, dUy = 0.f, V = 0.f, dVx = 0.f, dVy = 0.f;
+  };
+
+  struct PreparedLight
+  {
+    float X = 0.f, Y = 0.f;
+    float Attenuation = 0.f;
+    float Hue[4] = {};
+    float HueIntensity = 0.f;
+    std::vector<Triangle> Lit;
+    std::vector<Triangle> Shadow;
+  };
+
+  struct TileScratch
+  {
+    float R[TilePixels], G[TilePixels], B[TilePixels], A[TilePixels];
+    float Coverage[TilePixels];
+    float GainR[TilePixels], GainG[TilePixels], GainB[TilePixels]; //Accumulate only: the light buffer's tile
+  };
+
+  void Prepare(const SoftwareLight &light, PreparedLight &out) const {
+    const sf::Vector2f position = (light.Position - ViewOrigin) * ViewScale;
+    out.X = position.x;
+    out.Y = position.y;
+    out.Attenuation = light.Attenuation * ViewScale;
+    out.Hue[0] = light.Color.r; out.Hue[1] = light.Color.g; out.Hue[2] = light.Color.b; out.Hue[3] = light.Color.a;
+    out.HueIntensity = light.Intensity;
+    AddTriangles(light.LitRegion, out.Lit, false);
+    AddTriangles(light.ShadowRegion, out.Shadow, true);
+  }
+
+  //shadows: the texCoords are PenumbraBuilder's falloff coordinates rather than falloff texture positions
+  void AddTriangles(const LightMesh *mesh, std::vector<Triangle> &out, bool shadows) const {
+    out.clear();
+    if (!mesh)
+      return;
+
+    for (std::size_t t = 0; t < mesh->GetTriangleCount(); ++t) {
+      sf::Vector2f p[3] = { (mesh->GetCorner(t, 0).position - ViewOrigin) * ViewScale, (mesh->GetCorner(t, 1).position - ViewOrigin) * ViewScale,
+                            (mesh->GetCorner(t, 2).position - ViewOrigin) * ViewScale };
+      sf::Vector2f uv[3] = { mesh->GetCorner(t, 0).texCoords, mesh->GetCorner(t, 1).texCoords, mesh->GetCorner(t, 2).texCoords };
+
+      float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+      if (area == 0.f)
+        continue;
+      if (area < 0.f) {
+        std::swap(p[1], p[2]);
+        std::swap(uv[1], uv[2]);
+        area = -area;
+      }
+
+      Triangle tri;
+      for (int e = 0; e < 3; ++e) {
+        const sf::Vector2f &a = p[e];
+        const sf::Vector2f &b = p[(e + 1) % 3];
+        tri.A[e] = a.y - b.y;
+        tri.B[e] = b.x - a.x;
+        tri.X[e] = a.x;
+        tri.Y[e] = a.y;
+      }
+      tri.MinX = std::min({ p[0].x, p[1].x, p[2].x });
+      tri.MinY = std::min({ p[0].y, p[1].y, p[2].y });
+      tri.MaxX = std::max({ p[0].x, p[1].x, p[2].x });
+      tri.MaxY = std::max({ p[0].y, p[1].y, p[2].y });
+
+      //Hard shadows have all their texCoords at (0, 0)
+      tri.Soft = shadows && (uv[0].y != 0.f || uv[1].y != 0.f || uv[2].y != 0.f);
+      if (tri.Soft) {
+        const sf::Vector2f e1 = p[1] - p[0], e2 = p[2] - p[0];
+        const sf::Vector2f d1 = uv[1] - uv[0], d2 = uv[2] - uv[0];
+        tri.U = uv[0].x;
+        tri.dUx = (d1.x * e2.y - d2.x * e1.y) / area;
+        tri.dUy = (d2.x * e1.x - d1.x * e2.x) / area;
+        tri.V = uv[0].y;
+        tri.dVx = (d1.y * e2.y - d2.y * e1.y) / area;
+        tri.dVy = (d2.y * e1.x - d1.y * e2.x) / area;
+      }
+      out.push_back(tri);
+    }
+  }
+
+  //Sets Coverage to value for every pixel center inside tri, or for a soft tri multiplies it by PenumbraShader.fsh's falloff
+  static void Rasterize(const Triangle &tri, float value, unsigned x0, unsigned y0, float *coverage) {
+    const int px0 = std::max(0, static_cast<int>(std::floor(tri.MinX - 0.5f)) - static_cast<int>(x0));
+    const int py0 = std::max(0, static_cast<int>(std::floor(tri.MinY - 0.5f)) - static_cast<int>(y0));
+    const int px1 = std::min(static_cast<int>(TileSize) - 1, static_cast<int>(std::ceil(tri.MaxX - 0.5f)) - static_cast<int>(x0));
+    const int py1 = std::min(static_cast<int>(TileSize) - 1, static_cast<int>(std::ceil(tri.MaxY - 0.5f)) - static_cast<int>(y0));
+    if (px0 > px1 || py0 > py1)
+      return;
+
+    const SimdF4 zero = SimdF4::Set1(0.f);
+    const SimdF4 one = SimdF4::Set1(1.f);
+    const SimdF4 fill = SimdF4::Set1(value);
+    const int gx0 = px0 & ~3;
+
+    //The x part of each edge function only depends on the column, so it's worked out once per 4 columns
+    const float cx = static_cast<float>(x0 + gx0) + 0.5f;
+    const SimdF4 px = SimdF4::Set(cx, cx + 1.f, cx + 2.f, cx + 3.f);
+    SimdF4 colStart[3];
+    for (int e = 0; e < 3; ++e)
+      colStart[e] = SimdF4::Set1(tri.A[e]) * (px - SimdF4::Set1(tri.X[e]));
+    const SimdF4 colU = SimdF4::Set1(tri.dUx) * (px - SimdF4::Set1(tri.X[0]));
+    const SimdF4 colV = SimdF4::Set1(tri.dVx) * (px - SimdF4::Set1(tri.X[0]));
+
+    for (int y = py0; y <= py1; ++y) {
+      //Evaluated fresh every row and only stepped across one tile, so rounding can't pile up
+      const float cy = static_cast<float>(y0 + y) + 0.5f;
+      const SimdF4 row0 = SimdF4::Set1(tri.B[0] * (cy - tri.Y[0]));
+      const SimdF4 row1 = SimdF4::Set1(tri.B[1] * (cy - tri.Y[1]));
+      const SimdF4 row2 = SimdF4::Set1(tri.B[2] * (cy - tri.Y[2]));
+      float *out = coverage + y * TileSize;
+
+      for (int x = gx0, k = 0; x <= px1; x += 4, ++k) {
+        const SimdF4 offset = SimdF4::Set1(4.f * k);
+        const SimdF4 e0 = colStart[0] + SimdF4::Set1(tri.A[0]) * offset + row0;
+        const SimdF4 e1 = colStart[1] + SimdF4::Set1(tri.A[1]) * offset + row1;
+        const SimdF4 e2 = colStart[2] + SimdF4::Set1(tri.A[2]) * offset + row2;
+
+        const SimdF4 inside = SimdF4::GreaterEqual(e0, zero) & SimdF4::GreaterEqual(e1, zero) & SimdF4::GreaterEqual(e2, zero);
+        if (!SimdF4::MoveMask(inside))
+          continue;
+
+        if (!tri.Soft) {
+          SimdF4::Select(inside, fill, SimdF4::Load(out + x)).Store(out + x);
+          continue;
+        }
+
+        //Both planes are exact at any pixel, so the ratio is the wedge's falloff coordinate there
+        const float rowY = cy - tri.Y[0];
+        const SimdF4 u = SimdF4::Set1(tri.U + tri.dUy * rowY) + colU + SimdF4::Set1(tri.dUx * 4.f * k);
+        const SimdF4 v = SimdF4::Set1(tri.V + tri.dVy * rowY) + colV + SimdF4::Set1(tri.dVx * 4.f * k);
+        const SimdF4 positive = SimdF4::Greater(v, zero);
+        const SimdF4 lit = SimdF4::Select(positive, SimdF4::Min(SimdF4::Max(u / SimdF4::Select(positive, v, one), zero), one), zero);
+        const SimdF4 current = SimdF4::Load(out + x);
+        SimdF4::Select(inside, current * lit, current).Store(out + x);
+      }
+    }
+  }
+
+  static bool Overlaps(const Triangle &tri, float x0, float y0, float x1, float y1) {
+    return tri.MaxX >= x0 && tri.MinX <= x1 && tri.MaxY >= y0 && tri.MinY <= y1;
+  }
+
+  void RenderTile(SoftwareLightTarget &scene, const LightTileGrid &tiles, std::size_t tile, TileScratch &s) const {
+    const sf::IntRect rect = tiles.GetTileRect(tile);
+    const unsigned x0 = static_cast<unsigned>(rect.left), y0 = static_cast<unsigned>(rect.top);
+    const unsigned w = static_cast<unsigned>(rect.width), h = static_cast<unsigned>(rect.height);
+    const float fx0 = static_cast<float>(x0), fy0 = static_cast<float>(y0);
+    const float fx1 = fx0 + w, fy1 = fy0 + h;
+
+    //Only the lights that reach this tile, already in light order
+    bool loaded = false;
+    for (const std::uint32_t *it = tiles.TileBegin(tile); it != tiles.TileEnd(tile); ++it) {
+      const PreparedLight &light = Prepared[*it];
+
+      std::fill(s.Coverage, s.Coverage + TilePixels, 0.f);
+      bool any = false;
+      for (const Triangle &tri : light.Lit) {
+        if (Overlaps(tri, fx0, fy0, fx1, fy1)) {
+          Rasterize(tri, 1.f, x0, y0, s.Coverage);
+          any = true;
+        }
+      }
+      if (!any)
+        continue;
+
+      for (const Triangle &tri : light.Shadow) {
+        if (Overlaps(tri, fx0, fy0, fx1, fy1))
+          Rasterize(tri, 0.f, x0, y0, s.Coverage);
+      }
+
+      if (Accumulate) {
+        if (!loaded) {
+          std::fill(s.GainR, s.GainR + TilePixels, 0.f);
+          std::fill(s.GainG, s.GainG + TilePixels, 0.f);
+          std::fill(s.GainB, s.GainB + TilePixels, 0.f);
+          loaded = true;
+        }
+        AddGain(light, x0, y0, h, Precision, s);
+        continue;
+      }
+
+      if (!loaded) {
+        Load(scene, x0, y0, w, h, s);
+        loaded = true;
+      }
+      Shade(light, x0, y0, h, s);
+    }
+
+    if (!loaded)
+      return;
+    if (Accumulate) {
+      Load(scene, x0, y0, w, h, s);
+      Composite(h, Precision, s);
+    }
+    Store(scene, x0, y0, w, h, s);
+  }
+
+  static void Load(const SoftwareLightTarget &scene, unsigned x0, unsigned y0, unsigned w, unsigned h, TileScratch &s) {
+    for (unsigned y = 0; y < h; ++y) {
+      const float *src = &scene.Pixels[(static_cast<std::size_t>(y0 + y) * scene.Width + x0) * 4];
+      for (unsigned x = 0; x < w; ++x) {
+        const unsigned i = y * TileSize + x;
+        s.R[i] = src[x * 4 + 0];
+        s.G[i] = src[x * 4 + 1];
+        s.B[i] = src[x * 4 + 2];
+        s.A[i] = src[x * 4 + 3];
+      }
+    }
+  }
+
+  static void Store(SoftwareLightTarget &scene, unsigned x0, unsigned y0, unsigned w, unsigned h, const TileScratch &s) {
+    for (unsigned y = 0; y < h; ++y) {
+      float *dst = &scene.Pixels[(static_cast<std::size_t>(y0 + y) * scene.Width + x0) * 4];
+      for (unsigned x = 0; x < w; ++x) {
+        const unsigned i = y * TileSize + x;
+        dst[x * 4 + 0] = s.R[i];
+        dst[x * 4 + 1] = s.G[i];
+        dst[x * 4 + 2] = s.B[i];
+        dst[x * 4 + 3] = s.A[i];
+      }
+    }
+  }
+
+  //The light map's value at a pixel dx, dy from the light
+  static void Mask(const SimdF4 &dx, const SimdF4 &dy, const SimdF4 &invAtten, const SimdF4 &coverage, SimdF4 &maskRGB, SimdF4 &maskA) {
+    const SimdF4 zero = SimdF4::Set1(0.f);
+    const SimdF4 one = SimdF4::Set1(1.f);
+
+    //SuperBright.fsh: atten = 1 - sqrt(sqrt(distance / Attenuation)), written with LightColor = 255 so rgb saturates
+    const SimdF4 dist = SimdF4::Sqrt(dx * dx + dy * dy);
+    const SimdF4 atten = one - SimdF4::Sqrt(SimdF4::Sqrt(dist * invAtten));
+    const SimdF4 texA = SimdF4::Min(SimdF4::Max(atten, zero), one);
+    const SimdF4 texRGB = SimdF4::Min(SimdF4::Max(atten * SimdF4::Set1(255.f), zero), one);
+
+    //Alpha blended into the falloff texture, then again into the light map, then zeroed under the shadows
+    maskRGB = texRGB * texA * texA * coverage;
+    maskA = texA * coverage;
+  }
+
+  static void Shade(const PreparedLight &light, unsigned x0, unsigned y0, unsigned h, TileScratch &s) {
+    const SimdF4 zero = SimdF4::Set1(0.f);
+    const SimdF4 one = SimdF4::Set1(1.f);
+    const SimdF4 lx = SimdF4::Set1(light.X);
+    const SimdF4 ly = SimdF4::Set1(light.Y);
+    const SimdF4 invAtten = SimdF4::Set1(1.f / light.Attenuation);
+    const SimdF4 hueR = SimdF4::Set1(light.Hue[0] * light.HueIntensity);
+    const SimdF4 hueG = SimdF4::Set1(light.Hue[1] * light.HueIntensity);
+    const SimdF4 hueB = SimdF4::Set1(light.Hue[2] * light.HueIntensity);
+    const SimdF4 hueA = SimdF4::Set1(light.Hue[3] * light.HueIntensity);
+
+    for (unsigned y = 0; y < h; ++y) {
+      const SimdF4 dy = SimdF4::Set1(static_cast<float>(y0 + y) + 0.5f) - ly;
+      for (unsigned x = 0; x < TileSize; x += 4) {
+        const unsigned i = y * TileSize + x;
+        const SimdF4 coverage = SimdF4::Load(s.Coverage + i);
+        if (!SimdF4::MoveMask(SimdF4::Greater(coverage, zero)))
+          continue;
+
+        const float cx = static_cast<float>(x0 + x) + 0.5f;
+        SimdF4 maskRGB, maskA;
+        Mask(SimdF4::Set(cx, cx + 1.f, cx + 2.f, cx + 3.f) - lx, dy, invAtten, coverage, maskRGB, maskA);
+
+        //MaskShader.fsh
+        const SimdF4 lit = SimdF4::Greater(maskRGB, zero);
+        const SimdF4 influenceA = maskA * hueA;
+        const SimdF4 r = SimdF4::Load(s.R + i), g = SimdF4::Load(s.G + i), b = SimdF4::Load(s.B + i), a = SimdF4::Load(s.A + i);
+        const SimdF4 outR = SimdF4::Select(lit, r + r * (maskRGB * hueR) * influenceA, r);
+        const SimdF4 outG = SimdF4::Select(lit, g + g * (maskRGB * hueG) * influenceA, g);
+        const SimdF4 outB = SimdF4::Select(lit, b + b * (maskRGB * hueB) * influenceA, b);
+
+        //Clamped to the render texture's range, then BlendAlpha over what was there
+        const SimdF4 srcA = SimdF4::Min(SimdF4::Max(a, zero), one);
+        const SimdF4 keep = one - srcA;
+        (SimdF4::Min(SimdF4::Max(SimdF4::Min(outR, one) * srcA + r * keep, zero), one)).Store(s.R + i);
+        (SimdF4::Min(SimdF4::Max(SimdF4::Min(outG, one) * srcA + g * keep, zero), one)).Store(s.G + i);
+        (SimdF4::Min(SimdF4::Max(SimdF4::Min(outB, one) * srcA + b * keep, zero), one)).Store(s.B + i);
+        (SimdF4::Min(srcA + a * keep, one)).Store(s.A + i);
+      }
+    }
+  }
+
+  //AccumulateShader.fsh into the tile's light buffer, with the additive blend (and 8 bit rounding and clamp) it's drawn with
+  static void AddGain(const PreparedLight &light, unsigned x0, unsigned y0, unsigned h, LightBufferPrecision precision, TileScratch &s) {
+    const SimdF4 zero = SimdF4::Set1(0.f);
+    const SimdF4 lx = SimdF4::Set1(light.X);
+    const SimdF4 ly = SimdF4::Set1(light.Y);
+    const SimdF4 invAtten = SimdF4::Set1(1.f / light.Attenuation);
+    const SimdF4 hueR = SimdF4::Set1(light.Hue[0] * light.HueIntensity);
+    const SimdF4 hueG = SimdF4::Set1(light.Hue[1] * light.HueIntensity);
+    const SimdF4 hueB = SimdF4::Set1(light.Hue[2] * light.HueIntensity);
+    const SimdF4 hueA = SimdF4::Set1(light.Hue[3] * light.HueIntensity);
+    const float logScale = LightAccumulation::LogScale(precision);
+    const bool rounded = precision == LightBufferPrecision::RGBA8;
+    //White (or any gray) lights add the same to every channel, so the log is only taken once
+    const bool gray = light.Hue[0] == light.Hue[1] && light.Hue[1] == light.Hue[2];
+
+    for (unsigned y = 0; y < h; ++y) {
+      const SimdF4 dy = SimdF4::Set1(static_cast<float>(y0 + y) + 0.5f) - ly;
+      for (unsigned x = 0; x < TileSize; x += 4) {
+        const unsigned i = y * TileSize + x;
+        const SimdF4 coverage = SimdF4::Load(s.Coverage + i);
+        if (!SimdF4::MoveMask(SimdF4::Greater(coverage, zero)))
+          continue;
+
+        const float cx = static_cast<float>(x0 + x) + 0.5f;
+        SimdF4 maskRGB, maskA;
+        Mask(SimdF4::Set(cx, cx + 1.f, cx + 2.f, cx + 3.f) - lx, dy, invAtten, coverage, maskRGB, maskA);
+
+        const SimdF4 influenceA = maskA * hueA;
+        if (gray) {
+          const SimdF4 value = Encode(maskRGB * hueR * influenceA, logScale, rounded);
+          AddChannel(value, rounded, s.GainR + i);
+          AddChannel(value, rounded, s.GainG + i);
+          AddChannel(value, rounded, s.GainB + i);
+          continue;
+        }
+        AddChannel(Encode(maskRGB * hueR * influenceA, logScale, rounded), rounded, s.GainR + i);
+        AddChannel(Encode(maskRGB * hueG * influenceA, logScale, rounded), rounded, s.GainG + i);
+        AddChannel(Encode(maskRGB * hueB * influenceA, logScale, rounded), rounded, s.GainB + i);
+      }
+    }
+  }
+
+  //Four pixels of one channel's share, rounded the way the 8 bit target stores it
+  static SimdF4 Encode(const SimdF4 &gain, float logScale, bool rounded) {
+    const SimdF4 value = LightAccumulation::Encode(gain, logScale);
+    if (!rounded)
+      return value;
+    return SimdF4::Round(SimdF4::Min(value, SimdF4::Set1(1.f)) * SimdF4::Set1(255.f)) * SimdF4::Set1(1.f / 255.f);
+  }
+
+  static void AddChannel(const SimdF4 &value, bool rounded, float *sum) {
+    const SimdF4 added = SimdF4::Load(sum) + value;
+    (rounded ? SimdF4::Min(added, SimdF4::Set1(1.f)) : added).Store(sum);
+  }
+
+  //CompositeShader.fsh: the scene scaled by the summed gain, clamped once
+  static void Composite(unsigned h, LightBufferPrecision precision, TileScratch &s) {
+    const SimdF4 one = SimdF4::Set1(1.f);
+    const float logScale = LightAccumulation::LogScale(precision);
+    for (unsigned i = 0; i < h * TileSize; i += 4) {
+      SimdF4::Min(SimdF4::Load(s.R + i) * LightAccumulation::Decode(SimdF4::Load(s.GainR + i), logScale), one).Store(s.R + i);
+      SimdF4::Min(SimdF4::Load(s.G + i) * LightAccumulation::Decode(SimdF4::Load(s.GainG + i), logScale), one).Store(s.G + i);
+      SimdF4::Min(SimdF4::Load(s.B + i) * LightAccumulation::Decode(SimdF4::Load(s.GainB + i), logScale), one).Store(s.B + i);
+    }
+  }
+
+  std::vector<PreparedLight> Prepared;
+  std::vector<TileScratch> Scratch;
+
+  bool Accumulate = false;
+  LightBufferPrecision Precision = LightBufferPrecision::RGBA8;
+
+  sf::Vector2f ViewOrigin;
+  float ViewScale = 1.f;
+
+  //Only used when the caller doesn't hand over a tile grid
+  std::vector<LightCircle> Circles;
+  LightTileGrid OwnTiles;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <SFML\Graphics.hpp>
+
+#include "LightGeometry.h"
+#include "SlotMap.h"
+
+struct LightObject;
+
+/*
+  Outline of the solid tiles in one rectangle of a tile layer, as the fewest axis-aligned edges that bound it
+
+  Every edge lies on a tile boundary with a solid tile on one side and an empty one (or the outside of the layer) on the
+  other, and runs as far as that stays true, so a solid block of any shape becomes just its outline: a wall of 200 tiles
+  is 4 edges, not 800. Holes come out as their own outlines. Edges are wound the way CasterEdgeBuilder winds loops, with
+  the outward normal (dy, -dx) pointing away from the solid side.
+
+  Tracing a rectangle looks at the tiles just outside it too, so each boundary is only emitted where the solid/empty pair
+  actually is. Boundaries on a rectangle's top and left sides belong to it, the ones on its bottom and right sides to
+  the next rectangle over (or to it, at the edge of the layer), so tracing a layer rectangle by rectangle emits every
+  boundary exactly once. Runs that cross from one rectangle into the next are joined again by CasterEdgeBuilder.
+*/
+class TileOutlineTracer
+{
+public:
+  //solid is width x height, row-major, nonzero for solid. Tiles [x0, x1) x [y0, y1) are traced, out is cleared first
+  void Trace(const std::uint8_t *solid, unsigned width, unsigned height, unsigned x0, unsigned y0, unsigned x1, unsigned y1,
+             float tileSize, const sf::Vector2f &origin, std::vector<Edge> &out) {
+    out.clear();
+    x1 = std::min(x1, width);
+    y1 = std::min(y1, height);
+    if (x0 >= x1 || y0 >= y1)
+      return;
+
+    auto at = [&](unsigned x, unsigned y) -> bool {
+      return x < width && y < height && solid[static_cast<std::size_t>(y) * width + x] != 0;
+    };
+    auto corner = [&](unsigned x, unsigned y) {
+      return origin + sf::Vector2f(x * tileSize, y * tileSize);
+    };
+
+    //The boundary lines this rectangle owns: its own top/left sides, and its bottom/right sides at the edge of the layer
+    const unsigned rowsEnd = y1 == height ? y1 + 1 : y1;
+    const unsigned columnsEnd = x1 == width ? x1 + 1 : x1;
+
+    //Vertical runs are built a row at a time, one open run per boundary line
+    VerticalKind.assign(columnsEnd - x0, None);
+    VerticalStart.assign(columnsEnd - x0, 0);
+
+    for (unsigned y = y0; y < rowsEnd; ++y) {
+      //Horizontal boundary above row y: solid below is a top side (runs +x), solid above is a bottom side (runs -x)
+      unsigned runStart = x0;
+      Kind run = None;
+      for (unsigned x = x0; x <= x1; ++x) {
+        Kind kind = None;
+        if (x < x1) {
+          const bool above = y > 0 && at(x, y - 1);
+          const bool below = at(x, y);
+          kind = below && !above ? Forward : (above && !below ? Backward : None);
+        }
+        if (kind == run)
+          continue;
+
+        if (run == Forward)
+          out.push_back({ corner(runStart, y), corner(x, y) });
+        else if (run == Backward)
+          out.push_back({ corner(x, y), corner(runStart, y) });
+        run = kind;
+        runStart = x;
+      }
+
+      if (y == y1)
+        break;
+
+      //Vertical boundary left of column x in row y: solid right is a left side (runs -y), solid left is a right side (runs +y)
+      for (unsigned x = x0; x < columnsEnd; ++x) {
+        const bool left = x > 0 && at(x - 1, y);
+        const bool right = at(x, y);
+        const Kind kind = right && !left ? Backward : (left && !right ? Forward : None);
+        CloseVertical(x, y, kind, x0, corner, out);
+      }
+    }
+
+    for (unsigned x = x0; x < columnsEnd; ++x)
+      CloseVertical(x, y1, None, x0, corner, out);
+  }
+
+private:
+  enum Kind : std::uint8_t { None, Forward, Backward };
+
+  //Ends column x's open run at row y if the boundary changes there, and starts the next one
+  template <typename Corner>
+  void CloseVertical(unsigned x, unsigned y, Kind kind, unsigned x0, Corner &&corner, std::vector<Edge> &out) {
+    Kind &run = VerticalKind[x - x0];
+    if (kind == run)
+      return;
+
+    const unsigned start = VerticalStart[x - x0];
+    if (run == Forward)
+      out.push_back({ corner(x, start), corner(x, y) });
+    else if (run == Backward)
+      out.push_back({ corner(x, y), corner(x, start) });
+    run = kind;
+    VerticalStart[x - x0] = y;
+  }
+
+  std::vector<Kind> VerticalKind;
+  std::vector<unsigned> VerticalStart;
+};
+
+/*
+  A tile layer added through LSystem::AddTileLayer: one caster per ChunkSize x ChunkSize chunk, row-major, with a null
+  handle for chunks that have nothing solid in them
+*/
+struct TileLayerCasters
+{
+  unsigned Width = 0;
+  unsigned Height = 0;
+  float TileSize = 0.f;
+  sf::Vector2f Origin;
+  unsigned ChunkSize = 64;
+  unsigned ChunkColumns = 0;
+  unsigned ChunkRows = 0;
+  std::vector<SlotHandle<LightObject>> Chunks;
+};
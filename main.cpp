@@ -10,13 +10,15 @@ int main()
   sf::RenderTexture Scene;
   Scene.create(800, 800);
   
-  int light_index = 0;
-  int light_index_2 = 0;
-  int light_index_3 = 0;
-  int light_index_4 = 0;
+  LightHandle light_index;
+  LightHandle light_index_2;
+  LightHandle light_index_3;
+  LightHandle light_index_4;
 
   LSystem system;
   system.SetWindowHeight(800.f);
+  //Lights that can't reach the window aren't updated or drawn
+  system.SetViewRect(sf::FloatRect(0.f, 0.f, 800.f, 800.f));
   light_index = system.AddLight({ 400, 400 }, .05f, sf::Color(0, 255, 17), 200.f, 30.f, 200.f);
   //light_index_2 = system.AddLight({ 310, 375 }, .05f, sf::Color(255, 0, 0), 200.f, 30.f, 200.f);
   //light_index_3 = system.AddLight({ 450, 520 }, .05f, sf::Color(195, 0, 255), 200.f, 30.f, 200.f);